@@ -1,7 +1,6 @@
 #include "Consts.hpp"
 
-const std::array<std::wstring, (int)Column::Count> COLUMNS{
-	L"Process name", L"PID", L"Protocol",
-	L"IP version", L"Local Address", L"Local Port",
-	L"Remote Address", L"Remote Port", L"State",
-};
\ No newline at end of file
+#include "libTcpSpy/Columns.hpp"
+
+// headers come from column descriptors, see Columns.hpp
+const std::array<std::wstring, (int)Column::Count> COLUMNS = Columns::Names();
\ No newline at end of file
@@ -4,18 +4,20 @@
 #include "framework.h"
 
 #include "libTcpSpy/FileSaver.hpp"
-#include "libTcpSpy/ConnectionsTableManager.hpp"
+#include "libTcpSpy/SortView.hpp"
+#include "libTcpSpy/Columns.hpp"
 
 #include "Consts.hpp"
 
-class FileSaverCSV : public FileSaver<ConnectionsTableManager> {
+class FileSaverCSV : public FileSaver<SortView> {
 public:
 	FileSaverCSV(LPCWSTR filePath)
 		: FileSaver(filePath)
 	{
 	}
 
-	bool save(const ConnectionsTableManager& mgr) override {
+	// view is the one shown by list view, so the file has the rows user sees, in the same order
+	bool save(const SortView& view) override {
 
 		int i = 0;
 		for (; i < COLUMNS.size(); i++) {
@@ -28,36 +30,26 @@ public:
 			}
 		}
 
-		for (const auto& row : mgr)
+		// export streams through columns in the order shown by UI, no ConnectionEntry is touched.
+		// Row is written by formatters of all column descriptors, unrolled at compile time;
+		// columns UDP rows do not have are left empty, so that every line has all fields
+		const auto& snap = view.snapshot();
+
+		for (size_t k = 0; k < view.size(); k++)
 		{
-			m_file << row->get_process_name()
-				<< ";"
-				<< row->pid_str()
-				<< ";"
-				<< row->proto_str()
-				<< ";"
-				<< row->address_family_str()
-				<< ";"
-				<< row->local_addr_str()
-				<< ";"
-				<< row->local_port_str();
+			size_t i = view[k];
+			bool first = true;
 
-			if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
-				ConnectionEntryTCP* tcp_row = nullptr;
-				if (tcp_row = dynamic_cast<ConnectionEntryTCP*>(row.get())) {
-					m_file << ";";
-					m_file << tcp_row->remote_addr_str()
-						<< ";"
-						<< tcp_row->remote_port_str()
-						<< ";"
-						<< tcp_row->state_str();
-				}
-				else {
-					return false;
-				}
-			}
+			Columns::ForEach([this, &snap, i, &first](auto column) {
+				using D = decltype(column);
+
+				if (!first) m_file << ";";
+				first = false;
+
+				if (Columns::Has<D>(snap, i)) m_file << D::Format(snap, i);
+				});
 
-			m_file << std::endl;
+			m_file << L'\n';
 		}
 
 		return true;
@@ -10,6 +10,24 @@
 #include <string>
 #include <functional>
 
-HWND InitFindDialog(HWND hWnd, const std::array<std::wstring, (int)Column::Count>& columns);
+enum class FindAction {
+	Next,
+	All,
+	// input text changed, rows are narrowed as user types
+	Narrow,
+};
+
+struct FindRequest {
+	std::wstring text;
+	// column to search when text is not a query
+	SearchBy column;
+	bool search_downwards;
+	FindAction action;
+};
+
+// called with dialog's input when Find Next or Find All is pressed, and on every edit of the input
+using FindHandler = std::function<void(HWND hFind, const FindRequest& request)>;
+
+HWND InitFindDialog(HWND hWnd, const std::array<std::wstring, (int)Column::Count>& columns, FindHandler on_find);
 
 #endif
\ No newline at end of file
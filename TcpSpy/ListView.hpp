@@ -3,21 +3,30 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <stdexcept>
 #include <format>
+#include <optional>
 
 #include "framework.h"
 #include "libTcpSpy/ConnectionsTableManager.hpp"
+#include "libTcpSpy/ConnectionKey.hpp"
 #include "libTcpSpy/DomainResolver.hpp"
+#include "libTcpSpy/Query.hpp"
 #include "libTcpSpy/Column.hpp"
+#include "libTcpSpy/Columns.hpp"
 
 #include "PopupMenu.hpp"
+#include "FindDlg.hpp"
 //#include "Cursor.hpp"
 
 #include "Shell.hpp"
 #include "Clipboard.hpp"
 #include "StatusBar.hpp"
 
+// posted to parent window by ListView::resolve_addresses(), lParam is passed to ListView::set_resolved_domain()
+#define WM_DOMAIN_RESOLVED (WM_APP + 3)
+
 class ListView {
 public:
 	using pointer = std::unique_ptr<ListView>;
@@ -49,10 +58,9 @@ public:
 
 		SetFocus(m_lv);
 
-		m_find_dlg = InitFindDialog(m_lv, { 
-			L"Process name", L"PID", L"Protocol", 
-			L"IP version", L"Local Address", L"Local Port", 
-			L"Remote Address", L"Remote Port", L"State",
+		m_find_dlg = InitFindDialog(m_lv, Columns::Names(),
+			[this](HWND hFind, const FindRequest& request) {
+				find(hFind, request);
 			});
 
 		m_tooltip = CreateWindow(TOOLTIPS_CLASS, NULL,
@@ -82,82 +90,43 @@ public:
 
 		lvColumn.mask = LVCF_FMT | LVCF_WIDTH | LVCF_TEXT | LVCF_SUBITEM;
 		lvColumn.fmt = LVCFMT_LEFT;
-		lvColumn.cx = m_first_column_len;
-		lvColumn.pszText = const_cast<LPWSTR>(columns[0].data());
-		lvColumn.iSubItem = 0;
-
-		ListView_InsertColumn(m_lv, 0, &lvColumn);
-
-		lvColumn.cx = m_column_len;
-		for (int i = 1; i < columns.size(); i++) {
+		for (int i = 0; i < columns.size(); i++) {
+			lvColumn.cx = i < (int)Column::Count ? Columns::Width((Column)i) : Columns::Defaults::Width;
 			lvColumn.pszText = const_cast<LPWSTR>(columns[i].data());
 			lvColumn.iSubItem = i;
 			ListView_InsertColumn(m_lv, i, &lvColumn);
 		}
 	}
 
+	// shows the latest published view, rows are refreshed by ConnectionsRefresher
 	void update() {
-		m_mgr.update();
-		insert_items();
-
-		m_status_bar->update(m_mgr);
+		show(m_mgr.view());
+		m_status_bar->show(m_view->size(), m_mgr);
 	}
 
 	LPWSTR draw_cell(int item, Column col) {
-		const auto& row = m_mgr[item];
-
 		constexpr int BUF_LEN = 512;
 		static WCHAR buf[BUF_LEN];
-		std::wstring tmp;
 
-		switch (col)
-		{
-		case Column::ProcessName:
-			tmp = row->get_process_name();
-			break;
-		case Column::PID:
-			tmp = row->pid_str();
-			break;
-		case Column::Protocol:
-			tmp = row->proto_str();
-			break;
-		case Column::INET:
-			tmp = row->address_family_str();
-			break;
-		case Column::LocalAddress:
-			tmp = row->local_addr_str();
-			break;
-		case Column::LocalPort:
-			tmp = row->local_port_str();
-			break;
-		case Column::RemoteAddress:
-			if (const auto p = dynamic_cast<ConnectionEntryTCP*>(row.get())) {
-				tmp = p->remote_addr_str();
-			}
-			else {
-				return nullptr;
-			}
-			break;
-		case Column::RemotePort:
-			if (const auto p = dynamic_cast<ConnectionEntryTCP*>(row.get())) {
-				tmp = p->remote_port_str();
-			}
-			else {
-				return nullptr;
-			}
-			break;
-		case Column::State:
-			if (const auto p = dynamic_cast<ConnectionEntryTCP*>(row.get())) {
-				tmp = p->state_str();
-			}
-			else {
-				return nullptr;
-			}
-			break;
-		default:
+		if (col < Column::ProcessName || col >= Column::Count) {
+			return nullptr;
+		}
+
+		// cells are formatted from snapshot columns by column's descriptor
+		const auto& snap = m_view->snapshot();
+		const size_t i = (*m_view)[item];
+
+		if (!Columns::Has(col, snap, i)) {
 			return nullptr;
 		}
 
+		std::wstring tmp = Columns::Text(col, snap, i);
+
+		if (col == Column::RemoteAddress) {
+			auto domain = m_domains.find(tmp);
+			if (domain != m_domains.end()) tmp = domain->second;
+		}
+
 		HRESULT res = StringCchCopyW(buf, BUF_LEN, (LPWSTR)tmp.c_str());
 
 		if (res == STRSAFE_E_INVALID_PARAMETER) {
@@ -167,21 +136,17 @@ public:
 		return buf;
 	}
 
-	void sort_column(Column col) {
-		static Column prev_clicked_column{};
-		static bool asc = true;
+	// list is virtual, icons are asked for with texts
+	int item_image(int item) {
+		return icon_image(m_view->entry(item)->icon());
+	}
 
-		if (prev_clicked_column == col) {
-			asc = !asc;
-		}
-		else {
-			asc = true;
-		}
+	void sort_column(Column col) {
+		// clicking the same column again flips direction, manager keeps rows in this order on further updates
+		bool asc = m_mgr.sort_column() == col ? !m_mgr.sort_ascending() : true;
 
 		m_mgr.sort(col, asc);
-		insert_items();
-
-		prev_clicked_column = col;
+		show(m_mgr.view());
 	}
 
 	void resize() {
@@ -240,7 +205,7 @@ public:
 			break;
 		case PopupMenu::SelectedMenuItem::Properties:
 		{
-			const auto& proc_path = m_mgr[row]->proc().m_path;
+			const auto& proc_path = m_view->entry(row)->proc().m_path;
 			// start windows' 'properites' window
 			MShell::Properties(m_lv, proc_path.c_str());
 		}
@@ -252,25 +217,101 @@ public:
 		ShowWindow(m_find_dlg, SW_SHOW);
 	}
 
+	// Text is a query (see Query.hpp), or if it does not start with a field name, a prefix of request's column.
+	// Rows are checked on the shown view's snapshot, cells are not read back from the list.
+	// Find Next selects next match after selected row, Find All shows only matching rows until it is pressed with empty text.
+	// While plain text (not a query) is typed, rows are narrowed to those whose text columns contain it
+	void find(HWND hFind, const FindRequest& request) {
+		if (request.action == FindAction::Narrow) {
+			narrow(request.text);
+			return;
+		}
+
+		std::shared_ptr<const Query> query;
+
+		if (!request.text.empty()) {
+			try {
+				query = std::make_shared<const Query>(Query::Compile(request.text));
+			}
+			catch (const QueryError& e) {
+				if (e.position()) {
+					MessageBoxA(hFind, e.what(), "Find", MB_OK | MB_ICONWARNING);
+					return;
+				}
+				query = std::make_shared<const Query>(Query::ColumnPrefix(request.column, request.text));
+			}
+		}
+
+		if (request.action == FindAction::All) {
+			m_mgr.set_query(std::move(query));
+			update();
+			return;
+		}
+
+		int selected = get_selected_row();
+
+		auto found = query->find_next(*m_view, selected == -1 ? Query::npos : (size_t)selected, request.search_downwards);
+		if (!found && selected != -1) {
+			// wrap around
+			found = query->find_next(*m_view, Query::npos, request.search_downwards);
+		}
+
+		if (!found) {
+			return;
+		}
+
+		// clear selected rows if any
+		ListView_SetItemState(m_lv, -1, 0, LVIS_SELECTED);
+
+		ListView_SetItemState(m_lv, (int)*found, LVIS_SELECTED, LVIS_SELECTED);
+		ListView_EnsureVisible(m_lv, (int)*found, TRUE); // scroll list view
+	}
+
+	// Domains are resolved on resolver's threads, addresses are labelled on UI thread by set_resolved_domain()
 	void resolve_addresses() {
-		for (int i = 0; i < m_mgr.size(); i++) {
-			auto& row = m_mgr[i];
+		SortView::Ptr view = m_view;
+
+		for (int i = 0; i < view->size(); i++) {
+			auto& row = view->entry(i);
 			if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
 				m_dr.resolve_domain(
-					((ConnectionEntryTCP*)row.get())->remote_addr(),
+					row->remote_addr(),
 					row->address_family(),
 					// lambda will run inside thread, capture needed data here
-					[this, i](std::wstring& resolved_domain) {
-						if (resolved_domain.size()) {
-							ListView_SetItemText(m_lv, i, (int)Column::RemoteAddress, (LPWSTR)resolved_domain.c_str());
+					[this, remote = row->remote_addr_str()](std::wstring& resolved_domain) {
+						if (resolved_domain.empty()) return;
+
+						// find-as-you-type matches domains too
+						m_mgr.set_remote_domain(remote, resolved_domain);
+
+						auto resolved = std::make_unique<ResolvedDomain>(ResolvedDomain{ remote, resolved_domain });
+						if (PostMessage(m_parent, WM_DOMAIN_RESOLVED, 0, (LPARAM)resolved.get())) {
+							resolved.release();
 						}
 					});
 			}
 		}
 	}
 
+	// Remote address posted by resolve_addresses() is shown as its domain by every row that has it,
+	// in this and further views, so labels are not tied to item positions
+	void set_resolved_domain(LPARAM lParam) {
+		std::unique_ptr<ResolvedDomain> resolved((ResolvedDomain*)lParam);
+
+		m_domains[resolved->remote] = std::move(resolved->domain);
+		InvalidateRect(m_lv, NULL, FALSE);
+	}
+
+	// view the list shows, kept alive by the caller as long as it is used
+	SortView::Ptr view() const { return m_view; }
+
 	HWND get_find_dlg() const { return m_find_dlg; }
 private:
+	struct ResolvedDomain {
+		std::wstring remote;
+		std::wstring domain;
+	};
+
 	void init_image_list() {
 		m_image_list = ImageList_Create(
 			GetSystemMetrics(SM_CXSMICON),
@@ -280,34 +321,64 @@ private:
 		ListView_SetImageList(m_lv, m_image_list, LVSIL_SMALL);
 	}
 
-	void insert_items() {
-		ListView_DeleteAllItems(m_lv);
-		ImageList_RemoveAll(m_image_list);
+	// Find-as-you-type, query text is searched only by Find Next and Find All.
+	// Typing on narrows the shown rows, list only gets the new item count
+	void narrow(const std::wstring& text) {
+		m_mgr.set_search(Query::StartsWithField(text) ? std::wstring() : text);
+		update();
+	}
 
-		if (!m_mgr.size()) return;
+	// List is virtual (LVS_OWNERDATA), items are drawn from m_view, so showing another view only sets item count.
+	// Scroll position is kept, and selected row stays selected wherever the view moved it
+	void show(SortView::Ptr view) {
+		int selected = get_selected_row();
+		std::optional<ConnectionKey> selected_key;
+		if (selected != -1 && selected < (int)m_view->size()) {
+			// row whose state changed is another entry, so it is found by key
+			selected_key = MakeConnectionKey(*m_view->entry(selected));
+		}
 
-		LVITEM item{};
-		item.pszText = LPSTR_TEXTCALLBACK;
-		item.mask = LVIF_TEXT | LVIF_IMAGE;
+		// rows of another snapshot may have other processes, icons that are shown are added again on demand
+		if (view->snapshot_ptr() != m_view->snapshot_ptr()) {
+			ImageList_RemoveAll(m_image_list);
+			m_icon_images.clear();
+		}
 
-		for (int i = 0; i < m_mgr.size(); i++) {
-			auto& row = m_mgr.get()[i];
-			if (row->icon() == nullptr) {
-				HICON default_icon = LoadIcon(NULL, MAKEINTRESOURCE(IDI_APPLICATION));
-				ImageList_AddIcon(m_image_list, default_icon);
-				DestroyIcon(default_icon);
-			}
-			else {
-				ImageList_AddIcon(m_image_list, row->icon());
-			}
+		// items are drawn from this view until next show, whatever manager publishes meanwhile
+		m_view = std::move(view);
 
-			item.iItem = i;
-			item.iImage = i;
+		ListView_SetItemCountEx(m_lv, (int)m_view->size(), LVSICF_NOSCROLL);
 
-			if (ListView_InsertItem(m_lv, &item) == -1) {
-				return;
+		ListView_SetItemState(m_lv, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+		if (selected_key) {
+			for (size_t k = 0; k < m_view->size(); k++) {
+				if (MakeConnectionKey(*m_view->entry(k)) == *selected_key) {
+					ListView_SetItemState(m_lv, (int)k, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
+					break;
+				}
 			}
 		}
+
+		InvalidateRect(m_lv, NULL, FALSE);
+	}
+
+	// rows of one process share its icon, so image list gets every icon once
+	int icon_image(HICON icon) {
+		auto it = m_icon_images.find(icon);
+		if (it != m_icon_images.end()) return it->second;
+
+		int image;
+		if (icon == nullptr) {
+			HICON default_icon = LoadIcon(NULL, MAKEINTRESOURCE(IDI_APPLICATION));
+			image = ImageList_AddIcon(m_image_list, default_icon);
+			DestroyIcon(default_icon);
+		}
+		else {
+			image = ImageList_AddIcon(m_image_list, icon);
+		}
+
+		m_icon_images.emplace(icon, image);
+		return image;
 	}
 
 	int get_selected_row() const {
@@ -332,18 +403,21 @@ private:
 	}
 
 	int m_columns{ -1 };
-	const int m_first_column_len = 180;
-	const int m_column_len = 100;
 
 	HWND m_parent;
 	HWND m_lv;
 	HWND m_find_dlg;
-	DWORD m_style{ WS_TABSTOP | WS_CHILD | WS_BORDER | WS_VISIBLE | LVS_AUTOARRANGE | LVS_REPORT | LVS_SHOWSELALWAYS | LVS_SINGLESEL };
+	DWORD m_style{ WS_TABSTOP | WS_CHILD | WS_BORDER | WS_VISIBLE | LVS_AUTOARRANGE | LVS_REPORT | LVS_SHOWSELALWAYS | LVS_SINGLESEL | LVS_OWNERDATA };
 	HIMAGELIST m_image_list;
+	// image of every icon added since snapshot was shown
+	std::unordered_map<HICON, int> m_icon_images;
 	HWND m_tooltip;
 
 	StatusBar::pointer m_status_bar;
 	ConnectionsTableManager& m_mgr;
+	SortView::Ptr m_view{ std::make_shared<const SortView>() };
+	// domain of every resolved remote address
+	std::unordered_map<std::wstring, std::wstring> m_domains;
 	DomainResolver m_dr;
 };
 
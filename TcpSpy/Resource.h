@@ -18,6 +18,7 @@
 #define IDC_RADIO2                      1002
 #define IDFINDNEXT                      1003
 #define IDC_SEARCHBY                    1005
+#define IDFINDALL                       1007
 #define ID_VIEW_REFRESH                 32771
 #define ID_VIEW_TCP                     32772
 #define ID_TCP_LISTENER                 32773
@@ -33,6 +34,7 @@
 #define ID_VIEW_SHOWDOMAIN              32786
 #define ID_CONNECTIONS_RESOLVEREMOTES   32787
 #define ID_FILE_SAVE                    32788
+#define ID_VIEW_WATCH                   32789
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -41,8 +43,8 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        133
-#define _APS_NEXT_COMMAND_VALUE         32789
-#define _APS_NEXT_CONTROL_VALUE         1007
+#define _APS_NEXT_COMMAND_VALUE         32790
+#define _APS_NEXT_CONTROL_VALUE         1008
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
 #endif
@@ -48,46 +48,17 @@ public:
 		resize();
 	}
 
-	void update(ConnectionsTableManager &ctm) {
-		enum {
-			ALL_COUNT,
-			INET_COUNT,
-			INET6_COUNT,
-			TCP_COUNT,
-			UDP_COUNT,
-			COUNT, 
-		};
-		
-		int counter[COUNT]{};
-
-		counter[ALL_COUNT] = ctm.size();
-
-		for (auto& row : ctm) {
-			switch (row->address_family()) {
-			case ProtocolFamily::INET:
-				counter[INET_COUNT]++;
-				break;
-			case ProtocolFamily::INET6:
-				counter[INET6_COUNT]++;
-				break;
-			}
-
-			switch (row->protocol()) {
-			case ConnectionProtocol::PROTO_TCP:
-				counter[TCP_COUNT]++;
-				break;
-			case ConnectionProtocol::PROTO_UDP:
-				counter[UDP_COUNT]++;
-				break;
-			}
-		}
+	// counters are of all acquired rows, `shown` is how many of them pass filters.
+	// Counts are cardinalities of manager's row indexes, nothing is scanned or kept here
+	void show(size_t shown, ConnectionsTableManager& mgr) {
+		size_t all = mgr.count();
 
 		set_items({
-			std::format(L"ALL: {}", counter[ALL_COUNT]),
-			std::format(L"TCP: {}", counter[TCP_COUNT]),
-			std::format(L"UDP: {}", counter[UDP_COUNT]),
-			std::format(L"IPv4: {}", counter[INET_COUNT]),
-			std::format(L"IPv6: {}", counter[INET6_COUNT]),
+			shown == all ? std::format(L"ALL: {}", all) : std::format(L"ALL: {} (shown: {})", all, shown),
+			std::format(L"TCP: {}", mgr.count({ .protocol = ConnectionProtocol::PROTO_TCP })),
+			std::format(L"UDP: {}", mgr.count({ .protocol = ConnectionProtocol::PROTO_UDP })),
+			std::format(L"IPv4: {}", mgr.count({ .family = ProtocolFamily::INET })),
+			std::format(L"IPv6: {}", mgr.count({ .family = ProtocolFamily::INET6 })),
 		});
 	}
 
@@ -2,9 +2,13 @@
 #include "TcpSpy.h"
 
 #include <fstream>
+#include <format>
 
 #include "libTcpSpy/Utils.hpp"
 #include "libTcpSpy/ConnectionsTableManager.hpp"
+#include "libTcpSpy/ConnectionsRefresher.hpp"
+#include "libTcpSpy/RefreshScheduler.hpp"
+#include "libTcpSpy/ConnectionsWatcher.hpp"
 
 #include "Consts.hpp"
 #include "FindDlg.hpp"
@@ -13,12 +17,20 @@
 
 #define MAX_LOADSTRING 100
 
+// posted by RefreshScheduler when it starts or stops throttling, wParam is TRUE while throttling, lParam is interval in ms
+#define WM_REFRESH_THROTTLED (WM_APP + 1)
+// posted by ConnectionsRefresher when new view is published, wParam is TRUE if refresh failed
+#define WM_CONNECTIONS_REFRESHED (WM_APP + 2)
+
 HINSTANCE hInst;                                // current instance
 WCHAR szTitle[MAX_LOADSTRING];                  // The title bar text
 WCHAR szWindowClass[MAX_LOADSTRING];            // the main window class name
 
 ListView::pointer listView;
 ConnectionsTableManager connectionsManager;
+std::unique_ptr<ConnectionsWatcher> connectionsWatcher;
+std::unique_ptr<RefreshScheduler> refreshScheduler;
+std::unique_ptr<ConnectionsRefresher> connectionsRefresher;
 HMENU Menu;
 
 // key is ID of menu item, std::pair is filter with bool value turned on/off filter
@@ -45,6 +57,7 @@ static void ModFilter(ConnectionsTableManager::Filters filter, bool value);
 static void InitListView(HWND hWnd);
 //static bool SaveConnectionsToCSV(LPCWSTR filePath, ConnectionsTableManager& mgr);
 static void ChangeFilter(int id);
+static void ToggleWatchMode(HWND hWnd);
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	_In_opt_ HINSTANCE hPrevInstance,
@@ -148,7 +161,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			break;
 		case ID_VIEW_REFRESH:
 		case ID_REFRESHF5:
-			listView->update();
+			connectionsRefresher->request();
+			break;
+		case ID_VIEW_WATCH:
+			ToggleWatchMode(hWnd);
 			break;
 		// Process filters
 		case ID_TCP_LISTENER:
@@ -157,7 +173,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		case ID_IPVERSION_IPV6:
 		case ID_VIEW_UDP:
 			ChangeFilter(wmId);
-			listView->update(); // refresh items after applied filters
+			listView->update(); // filters are applied to already acquired rows, nothing is re-queried
 			break;
 		case ID_FILE_SAVE:
 		{
@@ -165,7 +181,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			WCHAR lpFilePathBuf[filePathBufLen] = L"connections.csv";
 			if (MShell::GetSaveFilePath(hWnd, lpFilePathBuf, filePathBufLen)) {
 				FileSaverCSV saver = FileSaverCSV(lpFilePathBuf);
-				saver.save(connectionsManager);
+				saver.save(*listView->view());
 			}
 		}
 			break;
@@ -184,10 +200,32 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 	case WM_NOTIFY:
 		HandleWM_NOTIFY(lParam);
 		break;
+	case WM_REFRESH_THROTTLED:
+		if (wParam) {
+			std::wstring title = std::format(L"{} - watch mode throttled, refreshing every {} ms", szTitle, lParam);
+			SetWindowText(hWnd, title.c_str());
+		}
+		else {
+			SetWindowText(hWnd, szTitle);
+		}
+		break;
+	case WM_DOMAIN_RESOLVED:
+		listView->set_resolved_domain(lParam);
+		break;
+	case WM_CONNECTIONS_REFRESHED:
+		if (wParam) {
+			MessageBox(hWnd, L"Failed to obtain connections", L"Error", MB_OK | MB_ICONERROR);
+			break;
+		}
+		listView->update();
+		break;
 	case WM_SIZE:
 		listView->resize();
 		break;
 	case WM_DESTROY:
+		connectionsWatcher.reset(); // stop watcher, scheduler and refresher before window is gone
+		refreshScheduler.reset();
+		connectionsRefresher.reset();
 		PostQuitMessage(0);
 		break;
 	default:
@@ -231,13 +269,45 @@ static void ChangeFilter(int id) {
 	ModFilter(MenuFilters[id].first, flag);
 }
 
+static void ToggleWatchMode(HWND hWnd) {
+	if (refreshScheduler) {
+		connectionsWatcher.reset();
+		refreshScheduler.reset();
+		SetWindowText(hWnd, szTitle);
+		CheckUncheckMenuItem(ID_VIEW_WATCH, false);
+		return;
+	}
+
+	// interval adapts to churn, monitor spends at most 2% of a core
+	refreshScheduler = std::make_unique<RefreshScheduler>(*connectionsRefresher, RefreshScheduler::Options{},
+		[hWnd](bool throttling, std::chrono::milliseconds interval) {
+			PostMessage(hWnd, WM_REFRESH_THROTTLED, throttling, (LPARAM)interval.count());
+		});
+	refreshScheduler->start();
+
+	// connection events refresh right away, scheduler's interval stays as reconciliation for what has no events
+	connectionsWatcher = std::make_unique<ConnectionsWatcher>([]() { refreshScheduler->wake(); });
+	if (!connectionsWatcher->start()) {
+		connectionsWatcher.reset();
+		std::wstring title = std::format(L"{} - watch mode polling only, connection events need administrator rights", szTitle);
+		SetWindowText(hWnd, title.c_str());
+	}
+
+	CheckUncheckMenuItem(ID_VIEW_WATCH, true);
+}
+
 static void HandleWM_NOTIFY(LPARAM lParam) {
 	switch (((NMHDR*)lParam)->code)
 	{
 	case LVN_GETDISPINFO:
 	{
 		NMLVDISPINFO* plvdi = (NMLVDISPINFO*)lParam;
-		plvdi->item.pszText = listView->draw_cell(plvdi->item.iItem, (Column)plvdi->item.iSubItem);
+		if (plvdi->item.mask & LVIF_TEXT) {
+			plvdi->item.pszText = listView->draw_cell(plvdi->item.iItem, (Column)plvdi->item.iSubItem);
+		}
+		if (plvdi->item.mask & LVIF_IMAGE) {
+			plvdi->item.iImage = listView->item_image(plvdi->item.iItem);
+		}
 	}
 		break;
 	case LVN_COLUMNCLICK:
@@ -245,7 +315,7 @@ static void HandleWM_NOTIFY(LPARAM lParam) {
 		LPNMLISTVIEW pnmv = (LPNMLISTVIEW)lParam;
 		Column col = (Column)pnmv->iSubItem;
 
-		if (col >= Column::ProcessName && col <= Column::State) {
+		if (col >= Column::ProcessName && col < Column::Count) {
 			listView->sort_column(col);
 		}
 	}
@@ -281,7 +351,7 @@ LRESULT CALLBACK ListViewSubclassProc(
 			break;
 		case ID_VIEW_REFRESH:
 		case ID_REFRESHF5:
-			listView->update();
+			connectionsRefresher->request();
 			break;
 		case ID_QUICKEXIT:
 			DestroyWindow(GetParent(hWnd)); // send exit to main window
@@ -318,5 +388,10 @@ static void InitListView(HWND hWnd) {
 
 	listView->init_list(COLUMNS);
 
-	listView->update();
+	connectionsRefresher = std::make_unique<ConnectionsRefresher>(connectionsManager, [hWnd](SortView::Ptr view, std::exception_ptr error) {
+		PostMessage(hWnd, WM_CONNECTIONS_REFRESHED, error ? TRUE : FALSE, 0);
+		});
+	connectionsRefresher->start();
+
+	connectionsRefresher->request();
 }
\ No newline at end of file
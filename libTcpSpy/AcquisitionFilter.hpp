@@ -0,0 +1,188 @@
+#ifndef ACQUISITION_FILTER_HPP
+#define ACQUISITION_FILTER_HPP
+
+#include <vector>
+#include <string>
+#include <optional>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cwctype>
+
+#include "ConnectionEntry.hpp"
+
+struct PortRange {
+	USHORT first{ 0 };
+	USHORT last{ 0xffff };
+
+	bool contains(USHORT port) const { return first <= port && port <= last; }
+};
+
+/*
+ * Address with prefix length, e.g. 10.0.0.0/8 or fe80::/10.
+ * Like every IPAddress, IPv4 prefix is IPv4-mapped, so its bits count from the start of the 16 bytes (10.0.0.0/8 has 104)
+ */
+struct AddressPrefix {
+	ProtocolFamily af{ ProtocolFamily::INET };
+	// with bits past the prefix zeroed
+	IPAddress addr{};
+	IPAddress mask{};
+	UCHAR bits{ 0 };
+
+	bool contains(ProtocolFamily row_af, const IPAddress& row_addr) const {
+		return row_af == af && row_addr.in_prefix(addr, mask);
+	}
+
+	// "addr" or "addr/bits", nothing if string is not an IPv4 or IPv6 address
+	static std::optional<AddressPrefix> Parse(const std::wstring& str) {
+		AddressPrefix prefix;
+
+		size_t slash = str.find(L'/');
+		std::wstring addr_str = str.substr(0, slash);
+
+		UCHAR parsed[IPAddress::Size]{};
+		int max_bits;
+		if (InetPtonW(AF_INET, addr_str.c_str(), parsed) == 1) {
+			DWORD a;
+			memcpy(&a, parsed, sizeof(a));
+			prefix.af = ProtocolFamily::INET;
+			prefix.addr = IPAddress::FromIPv4(a);
+			max_bits = 32;
+		}
+		else if (InetPtonW(AF_INET6, addr_str.c_str(), parsed) == 1) {
+			prefix.af = ProtocolFamily::INET6;
+			prefix.addr = IPAddress::FromIPv6(parsed);
+			max_bits = 128;
+		}
+		else {
+			return std::nullopt;
+		}
+
+		int bits = max_bits;
+		if (slash != std::wstring::npos) {
+			// one or more digits and nothing else, so that a typo is not read as /0 and does not match everything
+			const wchar_t* digits = str.c_str() + slash + 1;
+			if (!iswdigit(*digits)) return std::nullopt;
+
+			wchar_t* end;
+			unsigned long parsed_bits = wcstoul(digits, &end, 10);
+			if (*end != L'\0' || parsed_bits > (unsigned long)max_bits) return std::nullopt;
+			bits = (int)parsed_bits;
+		}
+
+		prefix.bits = (UCHAR)(bits + 128 - max_bits);
+		prefix.mask = IPAddress::PrefixMask(prefix.bits);
+		prefix.addr = prefix.addr & prefix.mask;
+
+		return prefix;
+	}
+};
+
+/*
+ * AcquisitionFilter narrows which connections ConnectionsTableManager acquires at all.
+ * IP Helper API has no server-side predicates, the only OS-side pushdown is TCP table class (listeners, connections or all),
+ * and tables of disabled protocols and families are not requested. Everything else is checked on raw MIB rows,
+ * before keys are built and processes opened, so rejected rows cost a few comparisons.
+ * UDP tables are requested unless udp is false or remote ports or addresses are set: "listeners on :443" alone
+ * (tcp_states = StateBit(MIB_TCP_STATE_LISTEN), local_ports = {443}) fetches both listener tables and both UDP tables,
+ * only with udp = false are the listener tables the only ones fetched.
+ * Unlike view filters, narrowing it removes rows from the manager, so they are re-acquired when filter is widened.
+ * TcpSpy does not set it, it acquires everything, so that its menu filters and Find work without re-querying
+ */
+struct AcquisitionFilter {
+	// bit (1 << MIB_TCP_STATE_*) for every TCP state to keep
+	static constexpr uint32_t AllTcpStates = 0xffffffff;
+	static constexpr uint32_t StateBit(DWORD state) { return 1u << state; }
+
+	bool tcp{ true };
+	bool udp{ true };
+	bool ipv4{ true };
+	bool ipv6{ true };
+
+	uint32_t tcp_states{ AllTcpStates };
+
+	// empty means any
+	std::vector<PortRange> local_ports;
+	std::vector<PortRange> remote_ports;
+	std::vector<AddressPrefix> local_addrs;
+	std::vector<AddressPrefix> remote_addrs;
+
+	bool accepts_table(ConnectionProtocol proto, ProtocolFamily af) const {
+		bool by_proto = proto == ConnectionProtocol::PROTO_TCP ? tcp && tcp_states != 0 : udp && remote_ports.empty() && remote_addrs.empty();
+		bool by_af = af == ProtocolFamily::INET ? ipv4 : ipv6;
+
+		return by_proto && by_af;
+	}
+
+	TCP_TABLE_CLASS tcp_table_class() const {
+		const uint32_t listen = StateBit(MIB_TCP_STATE_LISTEN);
+
+		if (tcp_states == listen) {
+			return TCP_TABLE_OWNER_PID_LISTENER;
+		}
+		if (!(tcp_states & listen)) {
+			return TCP_TABLE_OWNER_PID_CONNECTIONS;
+		}
+		return TCP_TABLE_OWNER_PID_ALL;
+	}
+
+	// filter keeps everything, rows need no checks
+	bool keeps_all() const {
+		return tcp_states == AllTcpStates
+			&& local_ports.empty() && remote_ports.empty()
+			&& local_addrs.empty() && remote_addrs.empty();
+	}
+
+	bool matches(const MIB_TCPROW_OWNER_PID& row) const {
+		return matches_tcp(row.dwState)
+			&& matches_local(ProtocolFamily::INET, IPAddress::FromIPv4(row.dwLocalAddr), row.dwLocalPort)
+			&& matches_remote(ProtocolFamily::INET, IPAddress::FromIPv4(row.dwRemoteAddr), row.dwRemotePort);
+	}
+
+	bool matches(const MIB_TCP6ROW_OWNER_PID& row) const {
+		return matches_tcp(row.dwState)
+			&& matches_local(ProtocolFamily::INET6, IPAddress::FromIPv6(row.ucLocalAddr), row.dwLocalPort)
+			&& matches_remote(ProtocolFamily::INET6, IPAddress::FromIPv6(row.ucRemoteAddr), row.dwRemotePort);
+	}
+
+	bool matches(const MIB_UDPROW_OWNER_PID& row) const {
+		return matches_local(ProtocolFamily::INET, IPAddress::FromIPv4(row.dwLocalAddr), row.dwLocalPort);
+	}
+
+	bool matches(const MIB_UDP6ROW_OWNER_PID& row) const {
+		return matches_local(ProtocolFamily::INET6, IPAddress::FromIPv6(row.ucLocalAddr), row.dwLocalPort);
+	}
+private:
+	bool matches_tcp(DWORD state) const {
+		return state < 32 && (tcp_states & StateBit(state));
+	}
+
+	bool matches_local(ProtocolFamily af, const IPAddress& addr, DWORD port) const {
+		return matches_port(local_ports, port) && matches_addr(local_addrs, af, addr);
+	}
+
+	bool matches_remote(ProtocolFamily af, const IPAddress& addr, DWORD port) const {
+		return matches_port(remote_ports, port) && matches_addr(remote_addrs, af, addr);
+	}
+
+	static bool matches_port(const std::vector<PortRange>& ranges, DWORD port) {
+		if (ranges.empty()) return true;
+
+		USHORT p = ntohs((USHORT)port);
+		for (const auto& range : ranges) {
+			if (range.contains(p)) return true;
+		}
+		return false;
+	}
+
+	static bool matches_addr(const std::vector<AddressPrefix>& prefixes, ProtocolFamily af, const IPAddress& addr) {
+		if (prefixes.empty()) return true;
+
+		for (const auto& prefix : prefixes) {
+			if (prefix.contains(af, addr)) return true;
+		}
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef BITMAP_HPP
+#define BITMAP_HPP
+
+#include <vector>
+#include <cstdint>
+#include <bit>
+
+/*
+ * Dense bitmap, bit i for row (or string) i. Results of whole-table scans are bitmaps,
+ * so that several of them combine with word-wide AND / OR and are counted with popcount
+ */
+class Bitmap {
+public:
+	Bitmap() {}
+
+	explicit Bitmap(size_t size)
+		: m_words((size + 63) / 64), m_size(size)
+	{
+	}
+
+	size_t size() const { return m_size; }
+
+	bool test(size_t i) const { return (m_words[i >> 6] >> (i & 63)) & 1; }
+
+	void set(size_t i) { m_words[i >> 6] |= 1ull << (i & 63); }
+
+	void reset(size_t i) { m_words[i >> 6] &= ~(1ull << (i & 63)); }
+
+	Bitmap& operator|=(const Bitmap& other) {
+		for (size_t w = 0; w < m_words.size(); w++) m_words[w] |= other.m_words[w];
+		return *this;
+	}
+
+	Bitmap& operator&=(const Bitmap& other) {
+		for (size_t w = 0; w < m_words.size(); w++) m_words[w] &= other.m_words[w];
+		return *this;
+	}
+
+	// complement, bits from size on stay clear
+	void flip() {
+		for (auto& word : m_words) word = ~word;
+		if (m_size & 63) m_words.back() &= (1ull << (m_size & 63)) - 1;
+	}
+
+	size_t count() const {
+		size_t n = 0;
+		for (uint64_t word : m_words) n += std::popcount(word);
+		return n;
+	}
+
+	bool any() const {
+		for (uint64_t word : m_words) {
+			if (word) return true;
+		}
+		return false;
+	}
+
+	// calls f with index of every set bit, in increasing order
+	template<typename Func>
+	void for_each(Func f) const {
+		for (size_t w = 0; w < m_words.size(); w++) {
+			for (uint64_t word = m_words[w]; word; word &= word - 1) {
+				f((uint32_t)(w * 64 + std::countr_zero(word)));
+			}
+		}
+	}
+
+	std::vector<uint32_t> indices() const {
+		std::vector<uint32_t> out;
+		out.reserve(count());
+		for_each([&out](uint32_t i) { out.push_back(i); });
+		return out;
+	}
+
+	std::vector<uint64_t>& words() { return m_words; }
+
+	const std::vector<uint64_t>& words() const { return m_words; }
+private:
+	std::vector<uint64_t> m_words;
+	size_t m_size{ 0 };
+};
+
+#endif
@@ -25,6 +25,12 @@ public:
 
 		return m_cache.find(key) != m_cache.end() ? m_cache[key] : std::optional<Value>();
 	}
+
+	void erase(Key key) {
+		std::scoped_lock<std::mutex> lck(m_mut);
+
+		m_cache.erase(key);
+	}
 private:
 	std::unordered_map<Key, Value> m_cache{};
 	std::mutex m_mut;
@@ -0,0 +1,236 @@
+#ifndef COLUMN_SCAN_HPP
+#define COLUMN_SCAN_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <bit>
+
+#include "ConnectionEntry.hpp"
+#include "Bitmap.hpp"
+#include "Cpu.hpp"
+
+/*
+ * Predicates over numeric columns of ConnectionsSnapshot (ports, states, protocols, families, pids, addresses)
+ * for conditions that no index covers. Each one scans the whole contiguous column and returns a bitmap of matching rows.
+ * AVX2 kernels check 64 rows per bitmap word: 16 ports, 8 states or 2 addresses per instruction;
+ * without AVX2 the same word is filled by a scalar loop. Rows of the last incomplete word are always checked by scalar code
+ */
+namespace ColumnScan {
+	namespace detail {
+		// Fills hits with 64 rows at a time, block(i) returns bits of rows i..i+63, pred(i) checks the tail row by row
+		template<typename Block, typename Pred>
+		void Fill(Bitmap& hits, size_t n, Block block, Pred pred) {
+			auto& words = hits.words();
+			const size_t full = n / 64;
+
+			for (size_t w = 0; w < full; w++) {
+				words[w] = block(w * 64);
+			}
+			for (size_t i = full * 64; i < n; i++) {
+				if (pred(i)) hits.set(i);
+			}
+		}
+
+		template<typename Pred>
+		uint64_t ScalarBlock(size_t first, Pred pred) {
+			uint64_t bits = 0;
+			for (size_t k = 0; k < 64; k++) {
+				bits |= (uint64_t)(pred(first + k) ? 1 : 0) << k;
+			}
+			return bits;
+		}
+
+#ifdef TCPSPY_X86
+		// first <= x <= last is (x - first) <= (last - first) unsigned, tested as min(d, span) == d
+
+		inline uint64_t Avx2RangeBlock16(const USHORT* p, USHORT first, USHORT last) {
+			const __m256i lo = _mm256_set1_epi16((short)first);
+			const __m256i span = _mm256_set1_epi16((short)(last - first));
+
+			uint64_t bits = 0;
+			for (size_t k = 0; k < 2; k++) {
+				__m256i a = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(p + k * 32)), lo);
+				__m256i b = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(p + k * 32 + 16)), lo);
+				__m256i in_a = _mm256_cmpeq_epi16(_mm256_min_epu16(a, span), a);
+				__m256i in_b = _mm256_cmpeq_epi16(_mm256_min_epu16(b, span), b);
+				// packs interleaves 128-bit lanes of a and b, permute puts the 32 results back in row order
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(in_a, in_b), 0xD8);
+				bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(packed) << (k * 32);
+			}
+			return bits;
+		}
+
+		inline uint64_t Avx2RangeBlock32(const uint32_t* p, uint32_t first, uint32_t last) {
+			const __m256i lo = _mm256_set1_epi32((int)first);
+			const __m256i span = _mm256_set1_epi32((int)(last - first));
+
+			uint64_t bits = 0;
+			for (size_t k = 0; k < 8; k++) {
+				__m256i d = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(p + k * 8)), lo);
+				__m256i in = _mm256_cmpeq_epi32(_mm256_min_epu32(d, span), d);
+				bits |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(in)) << (k * 8);
+			}
+			return bits;
+		}
+
+		// variable shift gives 0 for values from 32 on, so they never match
+		inline uint64_t Avx2MaskBlock32(const uint32_t* p, uint32_t mask) {
+			const __m256i one = _mm256_set1_epi32(1);
+			const __m256i accepted = _mm256_set1_epi32((int)mask);
+			const __m256i zero = _mm256_setzero_si256();
+
+			uint64_t bits = 0;
+			for (size_t k = 0; k < 8; k++) {
+				__m256i bit = _mm256_sllv_epi32(one, _mm256_loadu_si256((const __m256i*)(p + k * 8)));
+				__m256i out = _mm256_cmpeq_epi32(_mm256_and_si256(bit, accepted), zero);
+				bits |= (uint64_t)(~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff) << (k * 8);
+			}
+			return bits;
+		}
+
+		inline uint64_t Avx2PrefixBlock(const IPAddress* p, const IPAddress& net, const IPAddress& mask) {
+			const __m256i n = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)net.data()));
+			const __m256i m = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)mask.data()));
+
+			uint64_t bits = 0;
+			for (size_t k = 0; k < 32; k++) {
+				__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(p + k * 2)), m);
+				uint32_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, n));
+				bits |= (uint64_t)((eq & 0xffff) == 0xffff) << (k * 2);
+				bits |= (uint64_t)((eq >> 16) == 0xffff) << (k * 2 + 1);
+			}
+			return bits;
+		}
+#endif
+
+		template<typename T>
+		const uint32_t* Words32(const std::vector<T>& column) {
+			static_assert(sizeof(T) == 4, "column of 32-bit values");
+			return reinterpret_cast<const uint32_t*>(column.data());
+		}
+	}
+
+	// Bit i is set if first <= column[i] <= last
+	inline Bitmap InRange(const std::vector<USHORT>& column, USHORT first, USHORT last) {
+		Bitmap hits(column.size());
+		if (first > last) return hits;
+
+		const USHORT* p = column.data();
+		auto pred = [p, first, last](size_t i) { return first <= p[i] && p[i] <= last; };
+
+#ifdef TCPSPY_X86
+		if (Cpu::HasAvx2()) {
+			detail::Fill(hits, column.size(), [p, first, last](size_t i) { return detail::Avx2RangeBlock16(p + i, first, last); }, pred);
+			return hits;
+		}
+#endif
+		detail::Fill(hits, column.size(), [&pred](size_t i) { return detail::ScalarBlock(i, pred); }, pred);
+		return hits;
+	}
+
+	// Same for 32-bit columns: pid, state
+	inline Bitmap InRange(const std::vector<DWORD>& column, DWORD first, DWORD last) {
+		Bitmap hits(column.size());
+		if (first > last) return hits;
+
+		const uint32_t* p = detail::Words32(column);
+		auto pred = [p, first, last](size_t i) { return first <= p[i] && p[i] <= last; };
+
+#ifdef TCPSPY_X86
+		if (Cpu::HasAvx2()) {
+			detail::Fill(hits, column.size(), [p, first, last](size_t i) { return detail::Avx2RangeBlock32(p + i, first, last); }, pred);
+			return hits;
+		}
+#endif
+		detail::Fill(hits, column.size(), [&pred](size_t i) { return detail::ScalarBlock(i, pred); }, pred);
+		return hits;
+	}
+
+	template<typename T>
+	Bitmap Equal(const std::vector<T>& column, T value) {
+		return InRange(column, value, value);
+	}
+
+	// Set membership for small values (states, protocols, families): bit i is set if column[i] < 32 and mask has bit column[i]
+	template<typename T>
+	Bitmap InMask(const std::vector<T>& column, uint32_t mask) {
+		Bitmap hits(column.size());
+		if (!mask) return hits;
+
+		const uint32_t* p = detail::Words32(column);
+		auto pred = [p, mask](size_t i) { return p[i] < 32 && (mask & (1u << p[i])); };
+
+#ifdef TCPSPY_X86
+		if (Cpu::HasAvx2()) {
+			detail::Fill(hits, column.size(), [p, mask](size_t i) { return detail::Avx2MaskBlock32(p + i, mask); }, pred);
+			return hits;
+		}
+#endif
+		detail::Fill(hits, column.size(), [&pred](size_t i) { return detail::ScalarBlock(i, pred); }, pred);
+		return hits;
+	}
+
+	// Set membership for ports, set is 65536 bits. A set of a few ranges (rport in 80,443,8000-8080) is
+	// an OR of range kernels, any other one (lport~8) is looked up row by row in its 8 KB, which stays in L1
+	inline Bitmap InSet(const std::vector<USHORT>& column, const std::vector<uint64_t>& set) {
+		constexpr size_t MaxRanges = 8;
+
+		std::vector<std::pair<USHORT, USHORT>> ranges;
+		bool few = true;
+
+		for (DWORD port = 0; port < 65536 && few;) {
+			uint64_t word = set[port >> 6] >> (port & 63);
+			if (!word) {
+				port = (port | 63) + 1;
+				continue;
+			}
+			port += std::countr_zero(word);
+
+			DWORD last = port;
+			while (last + 1 < 65536 && ((set[(last + 1) >> 6] >> ((last + 1) & 63)) & 1)) last++;
+
+			few = ranges.size() < MaxRanges;
+			if (few) ranges.emplace_back((USHORT)port, (USHORT)last);
+			port = last + 1;
+		}
+
+		if (few) {
+			Bitmap hits(column.size());
+			for (const auto& [first, last] : ranges) {
+				hits |= InRange(column, first, last);
+			}
+			return hits;
+		}
+
+		Bitmap hits(column.size());
+		const USHORT* p = column.data();
+		const uint64_t* s = set.data();
+		auto pred = [p, s](size_t i) { return (s[p[i] >> 6] >> (p[i] & 63)) & 1; };
+		detail::Fill(hits, column.size(), [&pred](size_t i) { return detail::ScalarBlock(i, pred); }, pred);
+		return hits;
+	}
+
+	// CIDR: bit i is set if the first `bits` bits of column[i] equal those of addr
+	inline Bitmap InPrefix(const std::vector<IPAddress>& column, const IPAddress& addr, UCHAR bits) {
+		Bitmap hits(column.size());
+
+		const IPAddress mask = IPAddress::PrefixMask(bits);
+		const IPAddress net = addr & mask;
+
+		const IPAddress* p = column.data();
+		auto pred = [p, &net, &mask](size_t i) { return p[i].in_prefix(net, mask); };
+
+#ifdef TCPSPY_X86
+		if (Cpu::HasAvx2()) {
+			detail::Fill(hits, column.size(), [p, &net, &mask](size_t i) { return detail::Avx2PrefixBlock(p + i, net, mask); }, pred);
+			return hits;
+		}
+#endif
+		detail::Fill(hits, column.size(), [&pred](size_t i) { return detail::ScalarBlock(i, pred); }, pred);
+		return hits;
+	}
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef COLUMNS_HPP
+#define COLUMNS_HPP
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <compare>
+
+#include "Column.hpp"
+#include "ConnectionsSnapshot.hpp"
+
+/*
+ * Compile-time table of list columns. Descriptor<C> holds everything that depends on column C: header text,
+ * width hint, query field that Find searches it by, sort key of a snapshot row (whose order is the comparator)
+ * and text of a snapshot row. Sorting, list view, export and Find are instantiated from descriptors,
+ * with Visit() for a column chosen at run time and ForEach() for all columns in order,
+ * so every column gets its own inlined code, and a new column is a Column value plus its Descriptor
+ */
+namespace Columns {
+	constexpr size_t Count = (size_t)Column::Count;
+
+	// Address sort key: TCP flag (see Defaults::Key), then address as two big-endian 64-bit halves,
+	// so that 10.0.0.2 goes before 10.0.0.10
+	struct AddressKey {
+		uint64_t tcp;
+		uint64_t hi;
+		uint64_t lo;
+
+		// key of the reverse order
+		AddressKey inverted() const { return { ~tcp, ~hi, ~lo }; }
+
+		auto operator<=>(const AddressKey&) const = default;
+	};
+
+	inline AddressKey MakeAddressKey(const IPAddress& addr, bool tcp) {
+		return { tcp ? 1ULL : 0ULL, addr.hi(), addr.lo() };
+	}
+
+	// Columns that UDP rows do not have are TcpOnly: they are empty for UDP rows, and their integer keys get a leading TCP flag,
+	// so that UDP rows are always at the beginning in ascending order and at the end in descending order
+	inline uint64_t TcpFlag(const ConnectionsSnapshot& snap, size_t i) {
+		return snap.protocol[i] == ConnectionProtocol::PROTO_TCP ? 1ULL << 32 : 0;
+	}
+
+	struct Defaults {
+		static constexpr int Width = 100;
+		static constexpr bool TcpOnly = false;
+		// key is rank of process name (see SortKeys::ProcessNameRanks)
+		static constexpr bool ByName = false;
+		// key changes with TCP state, so rows with a new state have to be sorted again
+		static constexpr bool ByState = false;
+		// uint64_t keys are radix sorted, others are compared
+		using KeyT = uint64_t;
+	};
+
+	template<Column C>
+	struct Descriptor;
+
+	template<>
+	struct Descriptor<Column::ProcessName> : Defaults {
+		static constexpr const wchar_t* Name = L"Process name";
+		static constexpr const wchar_t* QueryField = L"proc";
+		static constexpr int Width = 180;
+		static constexpr bool ByName = true;
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>& name_ranks, size_t i) { return name_ranks[snap.process[i]]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return snap.process_name(i); }
+	};
+
+	template<>
+	struct Descriptor<Column::PID> : Defaults {
+		static constexpr const wchar_t* Name = L"PID";
+		static constexpr const wchar_t* QueryField = L"pid";
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return snap.pid[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return Utils::ConvertFrom<DWORD>(snap.pid[i]); }
+	};
+
+	template<>
+	struct Descriptor<Column::Protocol> : Defaults {
+		static constexpr const wchar_t* Name = L"Protocol";
+		static constexpr const wchar_t* QueryField = L"proto";
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return (uint64_t)snap.protocol[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return ProtocolToStr(snap.protocol[i]); }
+	};
+
+	template<>
+	struct Descriptor<Column::INET> : Defaults {
+		static constexpr const wchar_t* Name = L"IP version";
+		static constexpr const wchar_t* QueryField = L"af";
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return (uint64_t)snap.family[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return ProtocolFamilyToStr(snap.family[i]); }
+	};
+
+	template<>
+	struct Descriptor<Column::LocalAddress> : Defaults {
+		static constexpr const wchar_t* Name = L"Local Address";
+		static constexpr const wchar_t* QueryField = L"laddr";
+		using KeyT = AddressKey;
+
+		static AddressKey Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return MakeAddressKey(snap.local_addr[i], false); }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return snap.local_addr_str(i); }
+	};
+
+	template<>
+	struct Descriptor<Column::LocalPort> : Defaults {
+		static constexpr const wchar_t* Name = L"Local Port";
+		static constexpr const wchar_t* QueryField = L"lport";
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return snap.local_port[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return Net::ConvertPortToStr(snap.local_port[i]); }
+	};
+
+	template<>
+	struct Descriptor<Column::RemoteAddress> : Defaults {
+		static constexpr const wchar_t* Name = L"Remote Address";
+		static constexpr const wchar_t* QueryField = L"raddr";
+		static constexpr bool TcpOnly = true;
+		using KeyT = AddressKey;
+
+		static AddressKey Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) {
+			return MakeAddressKey(snap.remote_addr[i], snap.protocol[i] == ConnectionProtocol::PROTO_TCP);
+		}
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return snap.remote_addr_str(i); }
+	};
+
+	template<>
+	struct Descriptor<Column::RemotePort> : Defaults {
+		static constexpr const wchar_t* Name = L"Remote Port";
+		static constexpr const wchar_t* QueryField = L"rport";
+		static constexpr bool TcpOnly = true;
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return TcpFlag(snap, i) | snap.remote_port[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return Net::ConvertPortToService(snap.remote_port[i], "tcp"); }
+	};
+
+	template<>
+	struct Descriptor<Column::State> : Defaults {
+		static constexpr const wchar_t* Name = L"State";
+		static constexpr const wchar_t* QueryField = L"state";
+		static constexpr bool TcpOnly = true;
+		static constexpr bool ByState = true;
+
+		static uint64_t Key(const ConnectionsSnapshot& snap, const std::vector<uint32_t>&, size_t i) { return TcpFlag(snap, i) | snap.state[i]; }
+		static std::wstring Format(const ConnectionsSnapshot& snap, size_t i) { return TcpStateToStr(snap.state[i]); }
+	};
+
+	namespace detail {
+		template<typename Func, size_t... I>
+		decltype(auto) Visit(Column col, Func& f, std::index_sequence<I...>) {
+			using R = decltype(f(Descriptor<(Column)0>{}));
+			static constexpr R(*table[])(Func&) = { [](Func& f) -> R { return f(Descriptor<(Column)I>{}); }... };
+			return table[(size_t)col](f);
+		}
+
+		template<typename Func, size_t... I>
+		void ForEach(Func& f, std::index_sequence<I...>) {
+			(f(Descriptor<(Column)I>{}), ...);
+		}
+	}
+
+	// f(Descriptor<col>{}), col must be less than Column::Count
+	template<typename Func>
+	decltype(auto) Visit(Column col, Func&& f) {
+		return detail::Visit(col, f, std::make_index_sequence<Count>{});
+	}
+
+	// f(Descriptor<C>{}) for every column, in order
+	template<typename Func>
+	void ForEach(Func&& f) {
+		detail::ForEach(f, std::make_index_sequence<Count>{});
+	}
+
+	inline const wchar_t* Name(Column col) {
+		return Visit(col, [](auto column) { return decltype(column)::Name; });
+	}
+
+	inline int Width(Column col) {
+		return Visit(col, [](auto column) { return decltype(column)::Width; });
+	}
+
+	inline const wchar_t* QueryField(Column col) {
+		return Visit(col, [](auto column) { return decltype(column)::QueryField; });
+	}
+
+	inline bool ByState(Column col) {
+		return Visit(col, [](auto column) { return decltype(column)::ByState; });
+	}
+
+	inline std::array<std::wstring, Count> Names() {
+		std::array<std::wstring, Count> names;
+		size_t c = 0;
+		ForEach([&names, &c](auto column) { names[c++] = decltype(column)::Name; });
+		return names;
+	}
+
+	// row i of snapshot has a value in column, TcpOnly columns of UDP rows are empty
+	template<typename D>
+	bool Has(const ConnectionsSnapshot& snap, size_t i) {
+		return !D::TcpOnly || snap.protocol[i] == ConnectionProtocol::PROTO_TCP;
+	}
+
+	inline bool Has(Column col, const ConnectionsSnapshot& snap, size_t i) {
+		return Visit(col, [&snap, i](auto column) { return Has<decltype(column)>(snap, i); });
+	}
+
+	// text of row i in column, as list view shows it and export writes it
+	inline std::wstring Text(Column col, const ConnectionsSnapshot& snap, size_t i) {
+		return Visit(col, [&snap, i](auto column) {
+			using D = decltype(column);
+			return Has<D>(snap, i) ? D::Format(snap, i) : std::wstring();
+			});
+	}
+}
+
+#endif
@@ -10,15 +10,16 @@
 #include <psapi.h>
 
 #include <string>
-#include <variant>
 #include <array>
 #include <algorithm>
 #include <iostream>
 #include <cassert>
 #include <utility>
 #include <vector>
+#include <cstdint>
 
 #include "Net.hpp"
+#include "IPAddress.hpp"
 #include "Process.hpp"
 
 enum class ConnectionProtocol {
@@ -33,155 +34,150 @@ enum class ProtocolFamily {
 	INET6 = AF_INET6,
 };
 
-constexpr size_t IP6AddressLen = 16;
+inline std::wstring ProtocolFamilyToStr(ProtocolFamily af) {
+	switch (af) {
+	case ProtocolFamily::INET:
+		return L"IPv4";
+	case ProtocolFamily::INET6:
+		return L"IPv6";
+	default:
+		assert(false);
+	}
+	return L"";
+}
 
-using IP4Address = DWORD;
-using IP6Address = std::array<UCHAR, IP6AddressLen>;
+// IPv4 rows are formatted as dotted quad, IPv6 rows as IPv6 even when their address is IPv4-mapped
+inline std::wstring AddressToStr(const IPAddress& addr, ProtocolFamily af) {
+	return af == ProtocolFamily::INET ? Net::ConvertAddrToStr(addr.ipv4()) : Net::ConvertAddrToStr(addr.data());
+}
 
-using IPAddress = std::variant<IP4Address, IP6Address>;
+inline std::wstring ProtocolToStr(ConnectionProtocol proto) {
+	switch (proto) {
+	case ConnectionProtocol::PROTO_TCP:
+		return L"TCP";
+	case ConnectionProtocol::PROTO_UDP:
+		return L"UDP";
+	default:
+		assert(false);
+	}
+	return L"";
+}
 
-inline IPAddress makeIP6Address(const UCHAR* addr) {
-	IP6Address _addr{};
-	std::copy(addr, addr + IP6AddressLen, _addr.begin());
-	return _addr;
+inline std::wstring TcpStateToStr(DWORD state) {
+	switch (state) {
+	case MIB_TCP_STATE_CLOSED:     return L"CLOSED";
+	case MIB_TCP_STATE_LISTEN:     return L"LISTEN";
+	case MIB_TCP_STATE_SYN_SENT:   return L"SYN_SENT";
+	case MIB_TCP_STATE_SYN_RCVD:   return L"SYN_RCVD";
+	case MIB_TCP_STATE_ESTAB:      return L"ESTAB";
+	case MIB_TCP_STATE_FIN_WAIT1:  return L"FIN_WAIT1";
+	case MIB_TCP_STATE_FIN_WAIT2:  return L"FIN_WAIT2";
+	case MIB_TCP_STATE_CLOSE_WAIT: return L"CLOSE_WAIT";
+	case MIB_TCP_STATE_CLOSING:    return L"CLOSING";
+	case MIB_TCP_STATE_LAST_ACK:   return L"LAST_ACK";
+	case MIB_TCP_STATE_TIME_WAIT:  return L"TIME_WAIT";
+	case MIB_TCP_STATE_DELETE_TCB: return L"DELETE_TCB";
+	}
+	return L"";
 }
 
-class ConnectionEntry
-{
+// Protocol and family of rows of every MIB table, ConnectionEntry built from a row is chosen by them at compile time
+template<typename Row>
+struct RowTraits;
+
+template<>
+struct RowTraits<MIB_TCPROW_OWNER_PID> {
+	static constexpr ConnectionProtocol protocol = ConnectionProtocol::PROTO_TCP;
+	static constexpr ProtocolFamily family = ProtocolFamily::INET;
+};
+
+template<>
+struct RowTraits<MIB_TCP6ROW_OWNER_PID> {
+	static constexpr ConnectionProtocol protocol = ConnectionProtocol::PROTO_TCP;
+	static constexpr ProtocolFamily family = ProtocolFamily::INET6;
+};
+
+template<>
+struct RowTraits<MIB_UDPROW_OWNER_PID> {
+	static constexpr ConnectionProtocol protocol = ConnectionProtocol::PROTO_UDP;
+	static constexpr ProtocolFamily family = ProtocolFamily::INET;
+};
+
+template<>
+struct RowTraits<MIB_UDP6ROW_OWNER_PID> {
+	static constexpr ConnectionProtocol protocol = ConnectionProtocol::PROTO_UDP;
+	static constexpr ProtocolFamily family = ProtocolFamily::INET6;
+};
+
+/*
+ * Connection of any of the four tables. Kinds of rows are a closed set (TCP or UDP over IPv4 or IPv6),
+ * so it is a single class tagged by protocol() and address_family() instead of a class hierarchy:
+ * every column is a plain, inlinable member read, and TCP-only columns are guarded by a protocol() check.
+ * UDP rows have zeroed remote address, remote port and state. Scope ids are 0 for IPv4 rows
+ */
+class ConnectionEntry {
 public:
 	ConnectionEntry()
 	{
 	}
 
-	ConnectionEntry(
-		IPAddress local_addr,
-		DWORD local_port,
-		ConnectionProtocol proto,
-		ProtocolFamily af,
-		ProcessPtr proc
-	)
-		: m_local_addr(local_addr)
-		, m_local_port(ntohs(local_port))
-		, m_proto(proto)
-		, m_af(af)
-		, m_proc(proc)
+	template<typename Row>
+	ConnectionEntry(const Row& row, ProcessPtr proc)
+		: m_proc(proc)
+		, m_proto(RowTraits<Row>::protocol)
+		, m_af(RowTraits<Row>::family)
+		, m_local_port(ntohs((USHORT)row.dwLocalPort))
 	{
+		constexpr bool tcp = RowTraits<Row>::protocol == ConnectionProtocol::PROTO_TCP;
+
+		if constexpr (RowTraits<Row>::family == ProtocolFamily::INET) {
+			m_local_addr = IPAddress::FromIPv4(row.dwLocalAddr);
+			if constexpr (tcp) m_remote_addr = IPAddress::FromIPv4(row.dwRemoteAddr);
+		}
+		else {
+			m_local_addr = IPAddress::FromIPv6(row.ucLocalAddr);
+			m_local_scope_id = row.dwLocalScopeId;
+			if constexpr (tcp) {
+				m_remote_addr = IPAddress::FromIPv6(row.ucRemoteAddr);
+				m_remote_scope_id = row.dwRemoteScopeId;
+			}
+		}
+
+		if constexpr (tcp) {
+			m_remote_port = ntohs((USHORT)row.dwRemotePort);
+			m_state = row.dwState;
+		}
 	}
 
-	IPAddress local_addr() const { return m_local_addr; }
+	const IPAddress& local_addr() const { return m_local_addr; }
 
 	DWORD local_port() const { return m_local_port; }
 
 	ProtocolFamily address_family() const { return m_af; }
 
 	std::wstring address_family_str() const {
-		switch (m_af) {
-		case ProtocolFamily::INET:
-			return L"IPv4";
-		case ProtocolFamily::INET6:
-			return L"IPv6";
-		default:
-			assert(false);
-		}
+		return ::ProtocolFamilyToStr(m_af);
 	}
 
 	ConnectionProtocol protocol() const { return m_proto; }
 
 	const std::wstring local_addr_str() const {
-		return _get_addr_str(m_local_addr);
+		return ::AddressToStr(m_local_addr, m_af);
 	}
 
 	const std::wstring local_port_str() const {
 		return Net::ConvertPortToStr(m_local_port);
 	}
 
-	const std::wstring& get_process_name() const {
-		return m_proc->m_name;
-	}
-
-	std::wstring pid_str() const {
-		return Utils::ConvertFrom<DWORD>(m_proc->m_pid);
-	}
-
-	std::wstring proto_str() const {
-		switch (m_proto) {
-		case ConnectionProtocol::PROTO_TCP:
-			return L"TCP";
-		case ConnectionProtocol::PROTO_UDP:
-			return L"UDP";
-		default:
-			assert(false);
-		}
-	}
-
-	HICON icon() const { return m_proc->m_icon; }
-
-	DWORD pid() const { return m_proc->m_pid; }
-
-	Process& proc() const { return *m_proc; }
-
-	virtual ~ConnectionEntry() = default;
-protected:
-	const std::wstring _get_addr_str(IPAddress addr) const {
-		switch (m_af) {
-		case ProtocolFamily::INET:
-			return Net::ConvertAddrToStr(std::get<IP4Address>(addr));
-		case ProtocolFamily::INET6:
-			return Net::ConvertAddrToStr(std::get<IP6Address>(addr).data());
-		default:
-			break;
-		}
-		assert(false); // should be unreachable in normal conditions
-	}
-	ProcessPtr m_proc;
-
-	ConnectionProtocol m_proto{ ConnectionProtocol::UNSET };
-	ProtocolFamily m_af{ ProtocolFamily::UNSET };
-
-	IPAddress m_local_addr{ (DWORD)-1 };
-	DWORD m_local_port{ (DWORD)-1 };
-};
-
-/*
- * ConnectionEntryTCP used for TCP classes
- * With additional members like remote port, addr etc.
- */
-class ConnectionEntryTCP : public ConnectionEntry {
-public:
-	ConnectionEntryTCP(
-		const MIB_TCPROW_OWNER_PID& row,
-		ConnectionProtocol proto,
-		ProtocolFamily af,
-		ProcessPtr proc
-	)
-		: ConnectionEntry(row.dwLocalAddr, row.dwLocalPort, proto, af, proc)
-		, m_remote_addr(row.dwRemoteAddr), m_remote_port(ntohs(row.dwRemotePort)), m_state(row.dwState)
-	{
-	}
-
-	ConnectionEntryTCP(
-		const MIB_TCP6ROW_OWNER_PID& row,
-		ConnectionProtocol proto,
-		ProtocolFamily af,
-		ProcessPtr proc
-	)
-		: ConnectionEntry(::makeIP6Address(row.ucLocalAddr), row.dwLocalPort, proto, af, proc)
-		, m_remote_addr(::makeIP6Address(row.ucRemoteAddr)), m_remote_port(ntohs(row.dwRemotePort)), m_state(row.dwState)
-	{
-	}
-
-	IPAddress remote_addr() const { return m_remote_addr; }
+	// TCP only
+	const IPAddress& remote_addr() const { return m_remote_addr; }
 
 	DWORD remote_port() const { return m_remote_port; }
 
 	DWORD state() const { return m_state; }
 
 	const std::wstring remote_addr_str() const {
-		return _get_addr_str(m_remote_addr);
-	}
-
-	const std::wstring& remote_domain_str() const {
-		return m_remote_domain;
+		return ::AddressToStr(m_remote_addr, m_af);
 	}
 
 	const std::wstring remote_port_str() const {
@@ -189,116 +185,59 @@ public:
 	}
 
 	std::wstring state_str() const {
-		switch (m_state) {
-		case MIB_TCP_STATE_CLOSED:     return L"CLOSED";
-		case MIB_TCP_STATE_LISTEN:     return L"LISTEN";
-		case MIB_TCP_STATE_SYN_SENT:   return L"SYN_SENT";
-		case MIB_TCP_STATE_SYN_RCVD:   return L"SYN_RCVD";
-		case MIB_TCP_STATE_ESTAB:      return L"ESTAB";
-		case MIB_TCP_STATE_FIN_WAIT1:  return L"FIN_WAIT1";
-		case MIB_TCP_STATE_FIN_WAIT2:  return L"FIN_WAIT2";
-		case MIB_TCP_STATE_CLOSE_WAIT: return L"CLOSE_WAIT";
-		case MIB_TCP_STATE_CLOSING:    return L"CLOSING";
-		case MIB_TCP_STATE_LAST_ACK:   return L"LAST_ACK";
-		case MIB_TCP_STATE_TIME_WAIT:  return L"TIME_WAIT";
-		case MIB_TCP_STATE_DELETE_TCB: return L"DELETE_TCB";
-		}
-		return L"";
+		return ::TcpStateToStr(m_state);
 	}
 
-	void resolve_remote_domain(std::wstring &&str) {
-		m_remote_domain = std::move(str);
-	}
+	// only for rows that were not published yet, published rows are replaced by a copy instead
+	void set_state(DWORD state) { m_state = state; }
 
-	virtual ~ConnectionEntryTCP() = default;
-protected:
-	IPAddress m_remote_addr{ (DWORD)-1 };
-	DWORD m_remote_port{ (DWORD)-1 };
-	DWORD m_state{ (DWORD)-1 };
-private:
-	std::wstring m_remote_domain{ L"Not resolved yet" };
-};
+	DWORD local_scope_id() const { return m_local_scope_id; }
 
-class ConnectionEntry4TCP : public ConnectionEntryTCP {
-public:
-	using parent = ConnectionEntryTCP;
-
-	ConnectionEntry4TCP(const MIB_TCPROW_OWNER_PID& row, ProcessPtr proc)
-		: ConnectionEntryTCP(
-			row,
-			ConnectionProtocol::PROTO_TCP,
-			ProtocolFamily::INET,
-			proc)
-	{
+	DWORD remote_scope_id() const { return m_remote_scope_id; }
+
+	const std::wstring& get_process_name() const {
+		return m_proc->m_name;
 	}
-};
 
-class ConnectionEntry4UDP : public ConnectionEntry {
-public:
-	using parent = ConnectionEntry;
-	
-	ConnectionEntry4UDP(const MIB_UDPROW_OWNER_PID& row, ProcessPtr proc)
-		: ConnectionEntry(
-			row.dwLocalAddr,
-			row.dwLocalPort,
-			ConnectionProtocol::PROTO_UDP,
-			ProtocolFamily::INET,
-			proc)
-	{
+	std::wstring pid_str() const {
+		return Utils::ConvertFrom<DWORD>(m_proc->m_pid);
 	}
-};
 
-class ConnectionEntry6 {
-public:
-	ConnectionEntry6(DWORD local_scope_id)
-		: m_local_scope_id(local_scope_id)
-	{
+	std::wstring proto_str() const {
+		return ::ProtocolToStr(m_proto);
 	}
 
-	DWORD local_scope_id() const { return m_local_scope_id; }
+	HICON icon() const { return m_proc->m_icon; }
 
-	virtual ~ConnectionEntry6() = default;
-private:
-	DWORD m_local_scope_id{ (DWORD)-1 };
-};
+	DWORD pid() const { return m_proc->m_pid; }
 
-class ConnectionEntry6TCP : public ConnectionEntry6, public ConnectionEntryTCP {
-public:
-	using parent = ConnectionEntryTCP;
-
-	ConnectionEntry6TCP(const MIB_TCP6ROW_OWNER_PID& row, ProcessPtr proc)
-		: ConnectionEntry6(row.dwLocalScopeId)
-		, ConnectionEntryTCP(
-			row,
-			ConnectionProtocol::PROTO_TCP,
-			ProtocolFamily::INET6,
-			proc)
-		, m_remote_scope_id(row.dwRemoteScopeId)
-	{
-	}
+	Process& proc() const { return *m_proc; }
 
-	DWORD remote_scope_id() const { return m_remote_scope_id; }
+	// id given by ConnectionsTableManager, unique among its rows and kept by copies of the row (see RowIndexes.hpp)
+	uint32_t row_id() const { return m_row_id; }
+
+	void set_row_id(uint32_t id) { m_row_id = id; }
 private:
-	DWORD m_remote_scope_id{ (DWORD)-1 };
-};
+	ProcessPtr m_proc;
 
-class ConnectionEntry6UDP : public ConnectionEntry6, public ConnectionEntry {
-public:
-	using parent = ConnectionEntry;
-
-	ConnectionEntry6UDP(const MIB_UDP6ROW_OWNER_PID& row, ProcessPtr proc)
-		: ConnectionEntry6(row.dwLocalScopeId)
-		, ConnectionEntry(
-			::makeIP6Address(row.ucLocalAddr),
-			row.dwLocalPort,
-			ConnectionProtocol::PROTO_UDP,
-			ProtocolFamily::INET6,
-			proc)
-	{
-	}
+	ConnectionProtocol m_proto{ ConnectionProtocol::UNSET };
+	ProtocolFamily m_af{ ProtocolFamily::UNSET };
+
+	IPAddress m_local_addr{};
+	DWORD m_local_port{ (DWORD)-1 };
+
+	IPAddress m_remote_addr{};
+	DWORD m_remote_port{ 0 };
+	DWORD m_state{ 0 };
+
+	DWORD m_local_scope_id{ 0 };
+	DWORD m_remote_scope_id{ 0 };
+
+	uint32_t m_row_id{ (uint32_t)-1 };
 };
 
-using ConnectionEntryPtr = std::unique_ptr<ConnectionEntry>;
+// shared, so that snapshots which are still in use keep their rows alive after rows are removed from manager
+using ConnectionEntryPtr = std::shared_ptr<ConnectionEntry>;
 using ConnectionEntryPtrs = std::vector<ConnectionEntryPtr>;
 
 #endif
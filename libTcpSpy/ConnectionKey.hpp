@@ -0,0 +1,105 @@
+#ifndef CONNECTION_KEY_HPP
+#define CONNECTION_KEY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <bit>
+
+#include "ConnectionEntry.hpp"
+
+/*
+ * ConnectionKey identifies a connection across refreshes: 5-tuple plus owning PID.
+ * TCP state is deliberately not a part of the key, so that state transitions are reported as changes, not as remove + add
+ */
+struct ConnectionKey {
+	IPAddress local_addr{};
+	IPAddress remote_addr{};
+	DWORD local_port{ 0 };
+	DWORD remote_port{ 0 };
+	DWORD pid{ 0 };
+	ConnectionProtocol proto{ ConnectionProtocol::UNSET };
+	ProtocolFamily af{ ProtocolFamily::UNSET };
+
+	bool operator==(const ConnectionKey& other) const = default;
+};
+
+struct ConnectionKeyHash {
+	size_t operator()(const ConnectionKey& k) const {
+		uint64_t h = mix(k.local_port | ((uint64_t)k.remote_port << 16) | ((uint64_t)k.proto << 32) | ((uint64_t)k.af << 40));
+		h = mix(h ^ k.pid);
+		h = mix(h ^ k.local_addr.hash() ^ std::rotl(k.remote_addr.hash(), 17));
+
+		return (size_t)h;
+	}
+private:
+	static uint64_t mix(uint64_t x) {
+		// splitmix64 finalizer
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+};
+
+// Keys are built straight from MIB rows, so that rows that are already known do not have to be turned into ConnectionEntry
+inline ConnectionKey MakeConnectionKey(const MIB_TCPROW_OWNER_PID& row) {
+	ConnectionKey key{};
+	key.local_addr = IPAddress::FromIPv4(row.dwLocalAddr);
+	key.remote_addr = IPAddress::FromIPv4(row.dwRemoteAddr);
+	key.local_port = ntohs((USHORT)row.dwLocalPort);
+	key.remote_port = ntohs((USHORT)row.dwRemotePort);
+	key.pid = row.dwOwningPid;
+	key.proto = ConnectionProtocol::PROTO_TCP;
+	key.af = ProtocolFamily::INET;
+	return key;
+}
+
+inline ConnectionKey MakeConnectionKey(const MIB_TCP6ROW_OWNER_PID& row) {
+	ConnectionKey key{};
+	key.local_addr = IPAddress::FromIPv6(row.ucLocalAddr);
+	key.remote_addr = IPAddress::FromIPv6(row.ucRemoteAddr);
+	key.local_port = ntohs((USHORT)row.dwLocalPort);
+	key.remote_port = ntohs((USHORT)row.dwRemotePort);
+	key.pid = row.dwOwningPid;
+	key.proto = ConnectionProtocol::PROTO_TCP;
+	key.af = ProtocolFamily::INET6;
+	return key;
+}
+
+inline ConnectionKey MakeConnectionKey(const MIB_UDPROW_OWNER_PID& row) {
+	ConnectionKey key{};
+	key.local_addr = IPAddress::FromIPv4(row.dwLocalAddr);
+	key.local_port = ntohs((USHORT)row.dwLocalPort);
+	key.pid = row.dwOwningPid;
+	key.proto = ConnectionProtocol::PROTO_UDP;
+	key.af = ProtocolFamily::INET;
+	return key;
+}
+
+inline ConnectionKey MakeConnectionKey(const MIB_UDP6ROW_OWNER_PID& row) {
+	ConnectionKey key{};
+	key.local_addr = IPAddress::FromIPv6(row.ucLocalAddr);
+	key.local_port = ntohs((USHORT)row.dwLocalPort);
+	key.pid = row.dwOwningPid;
+	key.proto = ConnectionProtocol::PROTO_UDP;
+	key.af = ProtocolFamily::INET6;
+	return key;
+}
+
+// Key of a row that is already a ConnectionEntry, the same as key of MIB row it was built from
+inline ConnectionKey MakeConnectionKey(const ConnectionEntry& row) {
+	ConnectionKey key{};
+	key.local_addr = row.local_addr();
+	key.local_port = row.local_port();
+	key.pid = row.pid();
+	key.proto = row.protocol();
+	key.af = row.address_family();
+
+	if (row.protocol() == ConnectionProtocol::PROTO_TCP) {
+		key.remote_addr = row.remote_addr();
+		key.remote_port = row.remote_port();
+	}
+	return key;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef CONNECTIONS_REFRESHER_HPP
+#define CONNECTIONS_REFRESHER_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <chrono>
+
+#include "ConnectionsTableManager.hpp"
+
+/*
+ * ConnectionsRefresher runs ConnectionsTableManager::update() on its own thread, so that caller never waits
+ * for tables acquisition and processes opening. request() only marks that refresh is wanted and returns.
+ * Requests that come while refresh is pending are coalesced into one. Request that comes while refresh is running
+ * cancels it (its result would be stale anyway) and another refresh starts right after. To not starve when requests
+ * come faster than refresh takes, refresh that follows a cancelled one is never cancelled.
+ * Callback is called on refresher's thread with published view, or with error if update failed
+ */
+class ConnectionsRefresher {
+public:
+	using ReadyCallback = std::function<void(SortView::Ptr view, std::exception_ptr error)>;
+
+	// cost and outcome of the last completed refresh
+	struct Stats {
+		size_t completed{ 0 };
+		std::chrono::microseconds wall{ 0 };
+		// CPU time of refresher's thread and manager's workers while refresh ran, not of UI or other threads
+		std::chrono::microseconds cpu{ 0 };
+		size_t churn{ 0 };
+	};
+
+	ConnectionsRefresher(ConnectionsTableManager& mgr, ReadyCallback on_ready)
+		: m_mgr(mgr), m_on_ready(std::move(on_ready))
+	{
+	}
+
+	ConnectionsRefresher(const ConnectionsRefresher&) = delete;
+	ConnectionsRefresher(ConnectionsRefresher&&) = delete;
+
+	void start() {
+		if (m_thread.joinable()) return;
+
+		m_thread = std::jthread([this](std::stop_token st) {
+			refresh_loop(st);
+			});
+	}
+
+	// running refresh is cancelled, callback is not called for it
+	void stop() {
+		if (!m_thread.joinable()) return;
+
+		{
+			std::lock_guard<std::mutex> lck(m_mutex);
+			m_running.request_stop();
+		}
+		m_thread.request_stop();
+		m_thread.join();
+	}
+
+	void request() {
+		std::lock_guard<std::mutex> lck(m_mutex);
+
+		m_pending = true;
+
+		if (m_cancellable) {
+			m_running.request_stop();
+		}
+
+		m_cv.notify_one();
+	}
+
+	// nothing is requested or running
+	bool idle() {
+		std::lock_guard<std::mutex> lck(m_mutex);
+		return !m_pending && !m_busy;
+	}
+
+	Stats stats() {
+		std::lock_guard<std::mutex> lck(m_mutex);
+		return m_stats;
+	}
+
+	size_t completed() const { return m_completed; }
+
+	size_t cancelled() const { return m_cancelled; }
+
+	~ConnectionsRefresher() { stop(); }
+private:
+	void refresh_loop(std::stop_token st) {
+		bool was_cancelled = false;
+
+		while (true) {
+			std::stop_source running;
+			{
+				std::unique_lock<std::mutex> lck(m_mutex);
+
+				// wait returns early when stop is requested
+				if (!m_cv.wait(lck, st, [this]() { return m_pending; })) {
+					return;
+				}
+
+				m_pending = false;
+				m_busy = true;
+				m_running = running;
+				m_cancellable = !was_cancelled;
+			}
+
+			SortView::Ptr view;
+			std::exception_ptr error;
+			bool done = false;
+
+			auto wall_beg = std::chrono::steady_clock::now();
+			auto cpu_beg = refresh_cpu_time();
+
+			try {
+				done = m_mgr.update(running.get_token());
+				view = m_mgr.view();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lck(m_mutex);
+				m_cancellable = false;
+				m_busy = false;
+
+				if (done) {
+					m_stats.completed++;
+					m_stats.wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wall_beg);
+					m_stats.cpu = refresh_cpu_time() - cpu_beg;
+					m_stats.churn = m_mgr.churn();
+				}
+			}
+
+			if (st.stop_requested()) {
+				return;
+			}
+
+			was_cancelled = !done && !error;
+			if (was_cancelled) {
+				m_cancelled++;
+				continue;
+			}
+
+			m_completed++;
+			m_on_ready(std::move(view), error);
+		}
+	}
+
+	// Update runs on this thread and on manager's workers. Workers may also run a sort asked for by UI meanwhile,
+	// it is counted too, but time of UI thread itself, domain resolution and other threads is not
+	std::chrono::microseconds refresh_cpu_time() {
+		return ThreadCpuTime(GetCurrentThread()) + m_mgr.workers_cpu_time();
+	}
+
+	ConnectionsTableManager& m_mgr;
+	ReadyCallback m_on_ready;
+	Stats m_stats;
+
+	std::mutex m_mutex;
+	std::condition_variable_any m_cv;
+	bool m_pending{ false };
+	bool m_cancellable{ false };
+	bool m_busy{ false };
+	std::stop_source m_running{ std::nostopstate };
+
+	std::atomic<size_t> m_completed{ 0 };
+	std::atomic<size_t> m_cancelled{ 0 };
+
+	std::jthread m_thread;
+};
+
+#endif
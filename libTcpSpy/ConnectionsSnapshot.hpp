@@ -0,0 +1,123 @@
+#ifndef CONNECTIONS_SNAPSHOT_HPP
+#define CONNECTIONS_SNAPSHOT_HPP
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include "ConnectionEntry.hpp"
+
+/*
+ * Column-oriented copy of connection rows: every column is a contiguous array, row i is i-th element of every array.
+ * Sorting, filtering, counting and export can scan only the columns they need instead of chasing ConnectionEntry pointers.
+ * Addresses of both families are IPAddress, 16 bytes with IPv4 ones mapped, so address columns are scanned and compared the same way.
+ * UDP rows have zeroed remote address, remote port and state
+ */
+struct ConnectionsSnapshot {
+	ConnectionsSnapshot() {}
+
+	explicit ConnectionsSnapshot(const ConnectionEntryPtrs& rows) {
+		build(rows);
+	}
+
+	void build(const ConnectionEntryPtrs& rows) {
+		clear();
+		reserve(rows.size());
+
+		std::unordered_map<const Process*, uint32_t> proc_index;
+
+		for (const auto& row : rows) {
+			family.push_back(row->address_family());
+			protocol.push_back(row->protocol());
+			local_port.push_back((USHORT)row->local_port());
+			local_addr.push_back(row->local_addr());
+			remote_addr.push_back(row->remote_addr());
+
+			if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
+				state.push_back(row->state());
+				remote_port.push_back((USHORT)row->remote_port());
+			}
+			else {
+				state.push_back(0);
+				remote_port.push_back(0);
+			}
+
+			auto [it, inserted] = proc_index.try_emplace(&row->proc(), (uint32_t)processes.size());
+			if (inserted) {
+				processes.push_back(&row->proc());
+			}
+			process.push_back(it->second);
+			pid.push_back(row->pid());
+			row_id.push_back(row->row_id());
+
+			entries.push_back(row);
+		}
+	}
+
+	void clear() {
+		family.clear();
+		protocol.clear();
+		state.clear();
+		local_port.clear();
+		remote_port.clear();
+		local_addr.clear();
+		remote_addr.clear();
+		pid.clear();
+		row_id.clear();
+		process.clear();
+		processes.clear();
+		entries.clear();
+	}
+
+	size_t size() const { return entries.size(); }
+
+	template<typename Pred>
+	size_t count_if(Pred pred) const {
+		size_t n = 0;
+		for (size_t i = 0; i < size(); i++) {
+			n += pred(i) ? 1 : 0;
+		}
+		return n;
+	}
+
+	const std::wstring& process_name(size_t i) const { return processes[process[i]]->m_name; }
+
+	std::wstring local_addr_str(size_t i) const { return AddressToStr(local_addr[i], family[i]); }
+
+	std::wstring remote_addr_str(size_t i) const { return AddressToStr(remote_addr[i], family[i]); }
+
+	std::vector<ProtocolFamily> family;
+	std::vector<ConnectionProtocol> protocol;
+	std::vector<DWORD> state;
+	std::vector<USHORT> local_port;
+	std::vector<USHORT> remote_port;
+	std::vector<IPAddress> local_addr;
+	std::vector<IPAddress> remote_addr;
+	std::vector<DWORD> pid;
+	// ConnectionEntry::row_id, id of row in manager's secondary indexes
+	std::vector<uint32_t> row_id;
+	// index into processes, every process is stored only once
+	std::vector<uint32_t> process;
+	std::vector<const Process*> processes;
+	// row i of snapshot was built from entries[i], snapshot keeps them alive
+	ConnectionEntryPtrs entries;
+
+private:
+	void reserve(size_t n) {
+		family.reserve(n);
+		protocol.reserve(n);
+		state.reserve(n);
+		local_port.reserve(n);
+		remote_port.reserve(n);
+		local_addr.reserve(n);
+		remote_addr.reserve(n);
+		pid.reserve(n);
+		row_id.reserve(n);
+		process.reserve(n);
+		entries.reserve(n);
+	}
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef CONNECTIONS_TABLE_HPP
+#define CONNECTIONS_TABLE_HPP
+
 #include <stddef.h>
 #include <stdlib.h>
 #include <new>
@@ -9,6 +12,10 @@
 
 #include "ConnectionEntry.hpp"
 
+// Stand-in for GetExtendedTcpTable / GetExtendedUdpTable with their contract: fills table, or stores the required size
+// and fails with ERROR_INSUFFICIENT_BUFFER. Called with the table class of the update, lets tests feed made-up rows
+using TableFetch = std::function<DWORD(PVOID table, PDWORD size, ULONG tableClass)>;
+
 template<typename T, typename R>
 class ConnectionsTable {
 public:
@@ -62,41 +69,35 @@ public:
 		pointer m_ptr;
 	};
 
-	// Type for suitable ConnectionEntry type
-	using ConnectionEntryT = std::conditional_t<
-		std::is_same_v<T, MIB_TCPTABLE_OWNER_PID>,
-		ConnectionEntry4TCP,
-		std::conditional_t<
-		std::is_same_v<T, MIB_TCP6TABLE_OWNER_PID>,
-		ConnectionEntry6TCP,
-		std::conditional_t<
-		std::is_same_v<T, MIB_UDPTABLE_OWNER_PID>,
-		ConnectionEntry4UDP,
-		ConnectionEntry6UDP
-		>
-		>
-	>;
+	// MIB row of table, RowTraits<RowT> tells which kind of ConnectionEntry it becomes
+	using RowT = R;
 
 	ConnectionsTable()
 	{
 	}
 
 	ConnectionsTable(ConnectionsTable&& ct) noexcept
-		: m_table(ct.m_table), m_size(ct.m_size)
+		: m_table(ct.m_table), m_capacity(ct.m_capacity), m_fetch(std::move(ct.m_fetch))
 	{
 		ct.m_table = nullptr;
-		ct.m_size = sizeof(T);
+		ct.m_capacity = m_initial_capacity;
 	}
 
 	template<typename T>
 	DWORD update(T tableClass);
 
+	// rows come from fetch instead of the system, empty fetch restores the system call
+	void set_fetch(TableFetch fetch) { m_fetch = std::move(fetch); }
+
 	void clear() {
+		// rows past dwNumEntries are never read, so there is no need to wipe the whole buffer
 		if (m_table != nullptr) {
-			memset(m_table, 0, m_size);
+			m_table->dwNumEntries = 0;
 		}
 	}
 
+	size_t size() const { return m_table ? m_table->dwNumEntries : 0; }
+
 	~ConnectionsTable() { free_table(); }
 
 	Iterator begin() { return m_table ? Iterator(&m_table->table[0]) : nullptr; }
@@ -110,37 +111,46 @@ private:
 		ULONG AddressFamily = AF_INET)
 	{
 		if (m_table == nullptr) {
-			alloc_table();
+			alloc_table(m_capacity);
 		}
 
-		// m_size will be overwritten on call
-		m_size = m_initial_size;
-
-		DWORD dwRes = getExtendedTable(m_table, &m_size, TRUE, AddressFamily, tableClass, 0);
+		DWORD dwRes = ERROR_INSUFFICIENT_BUFFER;
 
-		if (dwRes == ERROR_INSUFFICIENT_BUFFER) {
-			free_table();
-			alloc_table();
+		// The table can grow between the size query and the next call, so retry a few times.
+		// Buffer is kept between calls and only ever grows, so steady-state refreshes do not allocate at all
+		for (int attempt = 0; attempt < m_max_attempts && dwRes == ERROR_INSUFFICIENT_BUFFER; attempt++) {
+			// size will be overwritten on call with required size, if buffer is too small
+			DWORD size = m_capacity;
 
-			dwRes = getExtendedTable(m_table, &m_size, TRUE, AddressFamily, tableClass, 0);
+			dwRes = m_fetch
+				? m_fetch(m_table, &size, (ULONG)tableClass)
+				: getExtendedTable(m_table, &size, TRUE, AddressFamily, tableClass, 0);
 
-			if (dwRes != NO_ERROR) {
+			// after the last attempt there is no call to grow the buffer for, next update grows it if still needed
+			if (dwRes == ERROR_INSUFFICIENT_BUFFER && attempt + 1 < m_max_attempts) {
+				// reserve headroom, so that a few new sockets do not cause another reallocation on next refresh.
+				// Contents are going to be overwritten anyway, so no need for realloc's copying
 				free_table();
-				return dwRes;
+				alloc_table(size + size / 4);
 			}
+		}
 
-			// if new size of table is more than initial size, that was allocated on creation, store this size for further calls
-			m_initial_size = m_size;
+		if (dwRes != NO_ERROR) {
+			// keep buffer for further calls, but make sure stale or partial rows are not iterated
+			clear();
 		}
 
 		return dwRes;
 	}
 
-	void alloc_table() {
-		m_table = (T*)malloc(m_size);
+	void alloc_table(DWORD size) {
+		m_table = (T*)malloc(size);
 		if (!m_table) {
+			m_capacity = m_initial_capacity;
 			throw std::bad_alloc();
 		}
+		m_capacity = size;
+		m_table->dwNumEntries = 0;
 	}
 
 	void free_table() {
@@ -150,10 +160,14 @@ private:
 		}
 	}
 
+	static constexpr int m_max_attempts{ 4 };
+	static constexpr DWORD m_initial_capacity{ 4096 };
+
 	T* m_table{ nullptr };
 	// Pre-allocate page, so no need to re-allocate if not enough memory -> the less allocations the better
-	DWORD m_initial_size{ 4096 };
-	DWORD m_size{ m_initial_size };
+	DWORD m_capacity{ m_initial_capacity };
+
+	TableFetch m_fetch;
 };
 
 template<>
@@ -191,4 +205,6 @@ DWORD ConnectionsTable<MIB_UDP6TABLE_OWNER_PID, MIB_UDP6ROW_OWNER_PID>::update(T
 using TcpTable4 = ConnectionsTable<MIB_TCPTABLE_OWNER_PID, MIB_TCPROW_OWNER_PID>;
 using TcpTable6 = ConnectionsTable<MIB_TCP6TABLE_OWNER_PID, MIB_TCP6ROW_OWNER_PID>;
 using UdpTable4 = ConnectionsTable<MIB_UDPTABLE_OWNER_PID, MIB_UDPROW_OWNER_PID>;
-using UdpTable6 = ConnectionsTable<MIB_UDP6TABLE_OWNER_PID, MIB_UDP6ROW_OWNER_PID>;
\ No newline at end of file
+using UdpTable6 = ConnectionsTable<MIB_UDP6TABLE_OWNER_PID, MIB_UDP6ROW_OWNER_PID>;
+
+#endif
@@ -5,13 +5,60 @@
 #include <unordered_map>
 #include <optional>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <stop_token>
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <vector>
+#include <array>
+#include <latch>
+#include <thread>
+#include <exception>
 
 #include "ConnectionsTable.hpp"
+#include "ConnectionKey.hpp"
+#include "AcquisitionFilter.hpp"
+#include "Query.hpp"
+#include "TrigramIndex.hpp"
+#include "RowIndexes.hpp"
+#include "ConnectionsSnapshot.hpp"
+#include "SortKeys.hpp"
+#include "SortView.hpp"
 #include "Cache.hpp"
 #include "Column.hpp"
+#include "Columns.hpp"
+#include "ThreadPool.hpp"
+
+/*
+ * Changes between two consecutive refreshes.
+ * Pointers in `added` and `state_changed` are owned by ConnectionsTableManager and stay valid until next update.
+ * Row whose state changed is a new copy of the old row, the old one stays in snapshots that were published before
+ * Rows in `removed` are moved out of the manager, they are released after all subscribers are notified,
+ * unless some snapshot still holds them
+ */
+struct ConnectionsDelta {
+	std::vector<const ConnectionEntry*> added;
+	std::vector<const ConnectionEntry*> state_changed;
+	ConnectionEntryPtrs removed;
+
+	bool empty() const {
+		return added.empty() && state_changed.empty() && removed.empty();
+	}
+};
 
+/*
+ * Every refresh is published as an immutable SortView through an atomically swapped handle,
+ * so view() may be called from any thread: reader keeps what it loaded for as long as it needs,
+ * and old snapshot (with its rows) is freed when the last reader releases it.
+ * Published rows are never modified.
+ * Rows of all tables are acquired (within acquisition filter), view filters and query only choose which of them
+ * are in published views, so toggling a view filter is a scan over the current snapshot, not a new enumeration.
+ * Rows matching view filters and counts come from secondary indexes (see RowIndexes.hpp), kept up to date by updates.
+ * update() may run on a background thread (see ConnectionsRefresher.hpp), other methods are short
+ * and only wait for its final merge, not for tables acquisition
+ */
 class ConnectionsTableManager {
 public:
 	enum class Filters {
@@ -22,6 +69,11 @@ public:
 		TCP_LISTENING,
 	};
 
+	static constexpr uint32_t FilterBit(Filters filter) { return 1u << (uint32_t)filter; }
+
+	// TCP_LISTENING is the last filter
+	static constexpr uint32_t AllFilters = (1u << ((uint32_t)Filters::TCP_LISTENING + 1)) - 1;
+
 	ConnectionsTableManager()
 	{
 	}
@@ -29,230 +81,671 @@ public:
 	ConnectionsTableManager(const ConnectionsTableManager& ctr) = delete;
 	ConnectionsTableManager(ConnectionsTableManager&& ctr) = delete;
 
-	void update() {
-		m_tcp_table4.clear();
-		m_tcp_table6.clear();
-		m_udp_table4.clear();
-		m_udp_table6.clear();
+	using DeltaCallback = std::function<void(const ConnectionsDelta&)>;
 
-		if (m_rows.size()) m_rows.clear();
+	~ConnectionsTableManager() {
+		m_pool.stop();
+		m_sort_pool.stop();
+	}
+
+	// Rows that did not change since previous update are kept in place (together with their resolved domains),
+	// only new rows are constructed, and rows that disappeared are removed.
+	// Stages: acquire tables and open processes of new rows (all four tables concurrently, each on its own worker),
+	// merge into rows, sort, publish, notify subscribers.
+	// Cancellation is checked while acquiring, cancelled update leaves rows as they were and returns false.
+	// Rows of a table that could not be fetched are kept as they were too.
+	// Once merge starts update runs to the end
+	bool update(std::stop_token cancel = {}) {
+		std::lock_guard<std::mutex> update_lock(m_update_mutex);
 
-		if (m_filters.contains(Filters::IPv4)) {
-			update_tcp_table(m_tcp_table4);
+		ConnectionsDelta delta;
 
-			update_udp_table(m_udp_table4);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_active_acquisition_filter = m_acquisition_filter;
 		}
 
-		if (m_filters.contains(Filters::IPv6)) {
-			update_tcp_table(m_tcp_table6);
+		m_generation++;
 
-			update_udp_table(m_udp_table6);
+		std::array<AcquiredRows, TablesCount> acquired;
+
+		std::latch done(TablesCount);
+
+		const auto& filter = m_active_acquisition_filter;
+
+		acquire_async(done, acquired[TCP4], [this, cancel, &filter](AcquiredRows& out) {
+			if (filter.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET)) update_tcp_table(m_tcp_table4, out, cancel);
+			});
+		acquire_async(done, acquired[UDP4], [this, cancel, &filter](AcquiredRows& out) {
+			if (filter.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET)) update_udp_table(m_udp_table4, out, cancel);
+			});
+		acquire_async(done, acquired[TCP6], [this, cancel, &filter](AcquiredRows& out) {
+			if (filter.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET6)) update_tcp_table(m_tcp_table6, out, cancel);
+			});
+		acquire_async(done, acquired[UDP6], [this, cancel, &filter](AcquiredRows& out) {
+			if (filter.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET6)) update_udp_table(m_udp_table6, out, cancel);
+			});
+
+		done.wait();
+
+		for (const auto& a : acquired) {
+			if (a.error) {
+				std::rethrow_exception(a.error);
+			}
 		}
 
-		sort(SortBy::ProcessName);
+		// rows were only stamped with this generation so far, next update stamps them again
+		if (cancel.stop_requested()) {
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			std::vector<uint32_t> remap = remove_stale_rows(delta);
+
+			// removed first, so that ids of removed rows may be given to added ones
+			for (const auto& row : delta.removed) {
+				m_row_indexes.remove(*row);
+			}
+
+			merge_rows(acquired, delta);
+			forget_processes(delta);
+
+			for (const auto row : delta.state_changed) {
+				m_row_indexes.change_state(*row);
+			}
+
+			if (m_text_indexed) {
+				update_text_index(delta);
+			}
+
+			if (!delta.empty()) {
+				m_snapshot = std::make_shared<const ConnectionsSnapshot>(m_rows);
+				map_row_docs();
+				m_order = merge_changed_rows(delta, remap);
+				publish(filtered_view(m_view->sort_by(), m_view->ascending()));
+			}
+		}
+
+		m_churn = delta.added.size() + delta.removed.size() + delta.state_changed.size();
+
+		for (const auto& callback : m_subscribers) {
+			callback(delta);
+		}
+
+		return true;
 	}
 
-	const ConnectionEntryPtrs& get() {
-		return m_rows;
+	// callback is called on every update (on the thread that called update) with rows that were added, removed or changed their state
+	void subscribe(DeltaCallback callback) {
+		m_subscribers.push_back(std::move(callback));
 	}
 
-	size_t size() const {
-		return m_rows.size();
+	// rows added, removed or changed by the last completed update
+	size_t churn() const { return m_churn; }
+
+	// Latest published ordering, together with the snapshot it orders. Safe to call from any thread
+	SortView::Ptr view() const {
+		return m_published.load(std::memory_order_acquire);
 	}
 
-	ConnectionEntryPtrs::iterator begin() {
-		return m_rows.begin();
+	// Immutable column-oriented copy of rows, in storage order, of the latest published view
+	SortView::SnapshotPtr snapshot() const {
+		return view()->snapshot_ptr();
 	}
 
-	ConnectionEntryPtrs::iterator end() {
-		return m_rows.end();
+	// Independent ordering of current snapshot, e.g. for export, unaffected by further sorts and updates
+	SortView make_view(SortBy sort_by, bool asc_order = true) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return make_view_locked(sort_by, asc_order);
 	}
 
-	ConnectionEntryPtrs::const_iterator begin() const {
-		return m_rows.cbegin();
+	// Rows [first, last) of filtered rows as if they were sorted by sort_by, without sorting all of them.
+	// Ordered prefix is cached and extended on demand, until next update or filter change
+	ConnectionEntryPtrs window(size_t first, size_t last, SortBy sort_by, bool asc_order = true) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		const auto& snap = *m_snapshot;
+
+		if (!m_window || !m_window->sorted_by(sort_by, asc_order)) {
+			m_window.emplace(snap, m_view->order(), sort_by, asc_order);
+		}
+
+		last = std::min(last, m_window->order().size());
+		first = std::min(first, last);
+
+		m_window->extend(last);
+
+		ConnectionEntryPtrs rows;
+		rows.reserve(last - first);
+		for (size_t k = first; k < last; k++) {
+			rows.push_back(snap.entries[m_window->order()[k]]);
+		}
+
+		return rows;
 	}
 
-	ConnectionEntryPtrs::const_iterator end() const {
-		return m_rows.cend();
+	// filter is applied to the current snapshot at once, new view is published
+	void add_filter(Filters filter) {
+		set_filters(m_filters | FilterBit(filter));
 	}
 
-	ConnectionEntryPtrs::value_type& operator[](int i) {
-		return m_rows[i];
+	bool remove_filter(Filters filter) {
+		if (!(m_filters & FilterBit(filter))) {
+			return false;
+		}
+		set_filters(m_filters & ~FilterBit(filter));
+		return true;
 	}
 
-	const ConnectionEntryPtrs::value_type& operator[](int i) const {
-		return m_rows[i];
+	void set_filters(uint32_t filters) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (filters == m_filters) return;
+
+		m_filters = filters;
+		publish(filtered_view(m_view->sort_by(), m_view->ascending()));
 	}
 
-	void add_filter(Filters filter) {
-		m_filters.insert(filter);
+	uint32_t filters() const { return m_filters; }
+
+	// Number of acquired rows that match selection, regardless of view filters and query.
+	// Popcount of indexed bitmaps, rows are not scanned
+	size_t count(const RowIndexes::Selection& selection = {}) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_row_indexes.count(selection);
 	}
 
-	bool remove_filter(Filters filter) {
-		if (m_filters.find(filter) != m_filters.end()) {
-			m_filters.erase(filter);
-			return true;
+	// Ids (ConnectionEntry::row_id) of acquired rows that match selection
+	RoaringBitmap select(const RowIndexes::Selection& selection) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_row_indexes.select(selection);
+	}
+
+	// Published views show only rows that also match query (see Query.hpp), null shows all rows
+	void set_query(std::shared_ptr<const Query> query) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_query = std::move(query);
+		publish(filtered_view(m_view->sort_by(), m_view->ascending()));
+	}
+
+	std::shared_ptr<const Query> query() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_query;
+	}
+
+	// Find-as-you-type: published views show only rows whose process name, path, local or remote address
+	// or resolved domain contain text, ignoring case. Empty text shows all rows. Meant to be called on every keystroke,
+	// text that extends the previous one only rechecks previous matches (see TrigramIndex.hpp), and only rows
+	// of the current view are filtered again, so the new view is a subsequence of the current one.
+	// Index is built on the first call and from then on updated with every refresh delta, search is kept by updates
+	void set_search(const std::wstring& text) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_text_indexed) {
+			if (text.empty()) return;
+			build_text_index();
+		}
+
+		if (m_search.search(m_text_index, text) && m_view_searched) {
+			publish(narrowed_view());
+			return;
+		}
+		publish(filtered_view(m_view->sort_by(), m_view->ascending()));
+	}
+
+	// Domain resolved for remote address (as formatted), so that search finds rows by it.
+	// Shown rows are not narrowed again until next keystroke or update
+	void set_remote_domain(const std::wstring& remote, const std::wstring& domain) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		TrigramIndex::Changes changes;
+		m_text_index.set_domain(remote, domain, changes);
+		m_search.update(m_text_index, changes);
+
+		// rows found by domain are not in the view, next keystroke filters from all rows
+		if (!changes.added.empty()) m_view_searched = false;
+	}
+
+	// Narrows what the next update acquires (see AcquisitionFilter.hpp), rows it rejects are removed by that update
+	void set_acquisition_filter(AcquisitionFilter filter) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_acquisition_filter = std::move(filter);
+	}
+
+	AcquisitionFilter acquisition_filter() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		return m_acquisition_filter;
+	}
+
+	// Table of protocol and family is filled by fetch instead of GetExtendedTcpTable / GetExtendedUdpTable from the next
+	// update on (see TableFetch in ConnectionsTable.hpp), empty fetch goes back to the system
+	void set_table_fetch(ConnectionProtocol protocol, ProtocolFamily family, TableFetch fetch) {
+		std::lock_guard<std::mutex> update_lock(m_update_mutex);
+
+		const bool tcp = protocol == ConnectionProtocol::PROTO_TCP;
+		if (family == ProtocolFamily::INET) {
+			tcp ? m_tcp_table4.set_fetch(std::move(fetch)) : m_udp_table4.set_fetch(std::move(fetch));
+		}
+		else {
+			tcp ? m_tcp_table6.set_fetch(std::move(fetch)) : m_udp_table6.set_fetch(std::move(fetch));
 		}
-		return false;
 	}
 
+	// Rows are ordered by precomputed numeric keys (see SortKeys.hpp), no strings are formatted while sorting.
+	// Sort is stable, UDP rows go first in ascending and last in descending order for columns they do not have.
+	// Only view's permutation changes, rows stay where they are. Column and direction are kept by further updates
 	void sort(SortBy sort_by, bool asc_order = true) {
-		auto beg = m_rows.begin();
-		
-		switch (sort_by) {
-		case SortBy::RemoteAddress:
-		case SortBy::RemotePort:
-		case SortBy::State:
-		{
-			// Move UDP entries to the beginning or the end, depending on sorting.
-			// UDP entries do not have remote address, remote port and state
-			// so that they will be always in the beginning, or the end
-			auto it = std::partition(beg, m_rows.end(), [asc_order](const ConnectionEntryPtr& r) {
-				if (r->protocol() == ConnectionProtocol::PROTO_UDP) {
-					return asc_order;
-				}
-				else {
-					return !asc_order;
-				}
-				});
-			
-			if (asc_order) {
-				beg = it;
+		if (sort_by < SortBy::ProcessName || sort_by >= SortBy::Count) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_order = SortKeys::MakeSortOrder(*m_snapshot, sort_by, asc_order, sort_pool());
+		publish(filtered_view(sort_by, asc_order));
+	}
+
+	// CPU time of acquisition and sort workers since they started, updates spend it besides the thread they run on
+	std::chrono::microseconds workers_cpu_time() {
+		return m_pool.cpu_time() + m_sort_pool.cpu_time();
+	}
+
+	SortBy sort_column() const { return view()->sort_by(); }
+
+	bool sort_ascending() const { return view()->ascending(); }
+private:
+	struct IndexSlot {
+		ConnectionEntry* entry;
+		// generation of the last update that has seen this row
+		uint64_t generation;
+	};
+
+	// Rows produced by a single table on a worker thread, merged into m_rows on the calling thread
+	struct AcquiredRows {
+		ConnectionEntryPtrs added;
+		std::vector<ConnectionKey> added_keys;
+		std::vector<const ConnectionEntry*> state_changed;
+		// published row that is superseded by its copy with new state, slot is switched to the copy by merge
+		struct Replaced {
+			IndexSlot* slot;
+			ConnectionEntryPtr row;
+		};
+		std::vector<Replaced> replaced;
+		std::exception_ptr error;
+	};
+
+	enum { TCP4, UDP4, TCP6, UDP6, TablesCount };
+
+	template<typename Func>
+	void acquire_async(std::latch& done, AcquiredRows& out, Func acquire) {
+		m_pool.submit([&done, &out, acquire]() {
+			try {
+				acquire(out);
+			}
+			catch (...) {
+				out.error = std::current_exception();
+			}
+			done.count_down();
+			});
+	}
+
+	void merge_rows(std::array<AcquiredRows, TablesCount>& acquired, ConnectionsDelta& delta) {
+		size_t added = 0;
+		for (const auto& a : acquired) {
+			added += a.added.size();
+		}
+
+		m_rows.reserve(m_rows.size() + added);
+		delta.added.reserve(added);
+
+		for (auto& a : acquired) {
+			for (size_t i = 0; i < a.added.size(); i++) {
+				m_row_indexes.add(*a.added[i]);
+				m_index.emplace(a.added_keys[i], IndexSlot{ a.added[i].get(), m_generation });
+				delta.added.push_back(a.added[i].get());
+				m_rows.push_back(std::move(a.added[i]));
 			}
+			delta.state_changed.insert(delta.state_changed.end(), a.state_changed.begin(), a.state_changed.end());
 		}
-			break;
+
+		replace_rows(acquired);
+	}
+
+	// Swaps copies with new state into place of the rows they supersede
+	void replace_rows(std::array<AcquiredRows, TablesCount>& acquired) {
+		std::unordered_map<const ConnectionEntry*, ConnectionEntryPtr> replaced;
+		for (auto& a : acquired) {
+			for (auto& r : a.replaced) {
+				auto [it, _] = replaced.emplace(r.slot->entry, std::move(r.row));
+				r.slot->entry = it->second.get();
+			}
 		}
 
-		auto cmpFun = [asc_order]<typename T>(T a, T b) {
-			if (asc_order) return a < b;
-			else           return a > b;
-			};
+		if (replaced.empty()) return;
 
-		auto bothTcp = [](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-			return a->protocol() == ConnectionProtocol::PROTO_TCP &&
-				b->protocol() == ConnectionProtocol::PROTO_TCP;
-			};
+		for (auto& row : m_rows) {
+			if (auto it = replaced.find(row.get()); it != replaced.end()) {
+				row = std::move(it->second);
+			}
+		}
+	}
 
-		switch (sort_by)
-		{
-		case SortBy::ProcessName:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun(a->get_process_name(), b->get_process_name());
-				});
-			break;
-		case SortBy::PID:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun(a->pid(), b->pid());
-				});
-			break;
-		case SortBy::Protocol:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun((int)a->protocol(), (int)b->protocol());
-				});
-			break;
-		case SortBy::INET:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun((int)a->address_family(), (int)b->address_family());
-				});
-			break;
-		case SortBy::LocalAddress:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun(a->local_addr_str(), b->local_addr_str());
-				});
-			break;
-		case SortBy::LocalPort:
-			std::sort(m_rows.begin(), m_rows.end(), [&cmpFun](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				return cmpFun(a->local_port(), b->local_port());
-				});
-			break;
-		// TCP rows can be compared, while UDP rows do not have remote addr, remote port, state
-		case SortBy::RemoteAddress:
-			std::sort(beg, m_rows.end(), [&cmpFun, &bothTcp](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				if (bothTcp(a, b))
-					return cmpFun(
-						dynamic_cast<ConnectionEntryTCP*>(a.get())->remote_addr_str(),
-						dynamic_cast<ConnectionEntryTCP*>(b.get())->remote_addr_str()
-					);
-				return false;
-				});
-			break;
-		case SortBy::RemotePort:
-			std::sort(beg, m_rows.end(), [&cmpFun, &bothTcp](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				if (bothTcp(a, b)) 
-					return cmpFun(
-						dynamic_cast<ConnectionEntryTCP*>(a.get())->remote_port(),
-						dynamic_cast<ConnectionEntryTCP*>(b.get())->remote_port()
-					);
-				return false;
-				});
-			break;
-		case SortBy::State:
-			std::sort(beg, m_rows.end(), [&cmpFun, &bothTcp](const ConnectionEntryPtr& a, const ConnectionEntryPtr& b) {
-				if (bothTcp(a, b))
-					return cmpFun(
-						dynamic_cast<ConnectionEntryTCP*>(a.get())->state(),
-						dynamic_cast<ConnectionEntryTCP*>(b.get())->state()
-					);
-				return false;
-				});
-			break;
-		default:
-			break;
+	// sorts run on their own pool, so they use every core and never queue behind tables acquisition
+	ThreadPool* sort_pool() {
+		return &m_sort_pool;
+	}
+
+	static int SortWorkers() {
+		return std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	SortView make_view_locked(SortBy sort_by, bool asc_order) {
+		auto order = SortKeys::MakeSortOrder(*m_snapshot, sort_by, asc_order, sort_pool());
+		auto match = query_matcher();
+		const Bitmap shown = filtered_rows(m_filters);
+		const auto& row_id = m_snapshot->row_id;
+		std::erase_if(order, [this, &match, &shown, &row_id](uint32_t i) {
+			return !shown.test(row_id[i]) || (match && !(*match)(i)) || !searched(i);
+			});
+
+		return SortView(m_snapshot, std::move(order), sort_by, asc_order);
+	}
+
+	// Ids of rows that pass filters: rows of a shown address family that are UDP, TCP listening or TCP connections
+	// as filters allow. Bitmap is indexed by row id
+	Bitmap filtered_rows(uint32_t filters) const {
+		const auto& idx = m_row_indexes;
+
+		RoaringBitmap families;
+		if (filters & FilterBit(Filters::IPv4)) families |= idx.family(ProtocolFamily::INET);
+		if (filters & FilterBit(Filters::IPv6)) families |= idx.family(ProtocolFamily::INET6);
+
+		RoaringBitmap kinds;
+		if (filters & FilterBit(Filters::UDP)) kinds |= idx.protocol(ConnectionProtocol::PROTO_UDP);
+		if (filters & FilterBit(Filters::TCP_LISTENING)) kinds |= idx.state(MIB_TCP_STATE_LISTEN);
+		if (filters & FilterBit(Filters::TCP_CONNECTIONS)) {
+			kinds |= RoaringBitmap::AndNot(idx.protocol(ConnectionProtocol::PROTO_TCP), idx.state(MIB_TCP_STATE_LISTEN));
 		}
 
+		return RoaringBitmap::And(families, kinds).to_bitmap(idx.capacity());
 	}
-private:
+
+	std::optional<Query::Matcher> query_matcher() const {
+		if (!m_query || m_query->empty()) return std::nullopt;
+		return m_query->bind(*m_snapshot, true);
+	}
+
+	// Rows of m_order that pass filters and query, order is kept
+	SortView filtered_view(SortBy sort_by, bool asc_order) {
+		const auto& snap = *m_snapshot;
+		const uint32_t filters = m_filters;
+		auto match = query_matcher();
+
+		std::vector<uint32_t> rows;
+		if (filters == AllFilters && !match && !m_search.active()) {
+			rows = m_order;
+		}
+		else {
+			const Bitmap shown = filtered_rows(filters);
+
+			rows.reserve(m_order.size());
+			for (uint32_t i : m_order) {
+				if (shown.test(snap.row_id[i]) && (!match || (*match)(i)) && searched(i)) rows.push_back(i);
+			}
+		}
+
+		return SortView(m_snapshot, std::move(rows), sort_by, asc_order);
+	}
+
+	// Rows of the current view that still match find-as-you-type text, filters and query already passed
+	SortView narrowed_view() const {
+		std::vector<uint32_t> rows;
+		rows.reserve(m_view->size());
+		for (uint32_t i : m_view->order()) {
+			if (searched(i)) rows.push_back(i);
+		}
+		return SortView(m_snapshot, std::move(rows), m_view->sort_by(), m_view->ascending());
+	}
+
+	// row i of m_snapshot matches find-as-you-type text
+	bool searched(uint32_t i) const {
+		return !m_search.active() || m_search.matches(m_row_docs[i]);
+	}
+
+	void build_text_index() {
+		TrigramIndex::Changes changes;
+		for (const auto& row : m_rows) {
+			m_text_index.add(*row, changes);
+		}
+		m_text_indexed = true;
+		map_row_docs();
+	}
+
+	// documents are removed first, so that their ids may be reused by added rows
+	void update_text_index(const ConnectionsDelta& delta) {
+		TrigramIndex::Changes changes;
+		for (const auto& row : delta.removed) {
+			m_text_index.remove(*row, changes);
+		}
+		for (const auto row : delta.added) {
+			m_text_index.add(*row, changes);
+		}
+		m_search.update(m_text_index, changes);
+	}
+
+	void map_row_docs() {
+		if (!m_text_indexed) return;
+
+		const auto& snap = *m_snapshot;
+		m_row_docs.resize(snap.size());
+		for (size_t i = 0; i < snap.size(); i++) {
+			m_row_docs[i] = m_text_index.doc_of(MakeConnectionKey(*snap.entries[i]));
+		}
+	}
+
+	void publish(SortView view) {
+		m_view = std::make_shared<const SortView>(std::move(view));
+		m_published.store(m_view, std::memory_order_release);
+		m_window.reset();
+		m_view_searched = true;
+	}
+
+	// Runs concurrently for different tables. Rows of different tables never share a key,
+	// so every worker only touches its own slots, and m_index itself is not modified until merge_rows.
+	// Nothing but generation of slots is changed here, so that cancelled update may simply drop `out`
 	template<typename T>
-	void add_rows(T& table) {
+	void add_rows(T& table, AcquiredRows& out, const std::stop_token& cancel) {
+		using RowT = typename T::RowT;
+
+		const auto& filter = m_active_acquisition_filter;
+		const bool check_rows = !filter.keeps_all();
+
 		for (const auto& row : table) {
+			if (cancel.stop_requested()) return;
+
+			// rejected rows are not even keyed, as if table did not have them
+			if (check_rows && !filter.matches(row)) continue;
+
+			ConnectionKey key = MakeConnectionKey(row);
+
+			// the same key may legitimately appear several times (e.g. reused UDP ports),
+			// so claim the first slot that was not yet seen during this update
+			auto [beg, end] = m_index.equal_range(key);
+			auto slot = std::find_if(beg, end, [this](const auto& kv) { return kv.second.generation != m_generation; });
+
+			if (slot != end) {
+				slot->second.generation = m_generation;
+
+				if constexpr (RowTraits<RowT>::protocol == ConnectionProtocol::PROTO_TCP) {
+					auto entry = slot->second.entry;
+					if (entry->state() != row.dwState) {
+						// copy on write, readers may still look at the published row
+						auto copy = std::make_shared<ConnectionEntry>(*entry);
+						copy->set_state(row.dwState);
+
+						out.state_changed.push_back(copy.get());
+						out.replaced.push_back({ &slot->second, std::move(copy) });
+					}
+				}
+				continue;
+			}
+
 			DWORD pid = row.dwOwningPid;
-			std::optional<ProcessPtr> proc_ptr;
-			if (!(proc_ptr = m_proc_cache.get(pid))) {
+			std::optional<CachedProcess> cached = m_proc_cache.get(pid);
+
+			// failure is remembered only for a few updates, PID may be reused by a process that can be opened
+			if (cached && !cached->proc && m_generation - cached->generation >= RetryFailedOpenAfter) {
+				m_proc_cache.erase(pid);
+				cached.reset();
+			}
+
+			if (!cached) {
 				// not in cache
 				ProcessPtr tmp = std::make_shared<Process>(pid);
 				if (!tmp->open()) {
+					// remember failure as well, so that process is not re-opened on every update
+					m_proc_cache.set(pid, CachedProcess{ nullptr, m_generation });
 					continue; // do not store processes and thus ConnectionEntry
 				}
-				m_proc_cache.set(pid, tmp);
-				proc_ptr = tmp;
+				// other worker may have opened the same process meanwhile, use whichever got into cache first
+				cached = m_proc_cache.set(pid, CachedProcess{ tmp, m_generation });
 			}
 
-			m_rows.push_back(std::make_unique<typename T::ConnectionEntryT>(row, *proc_ptr));
+			if (!cached->proc) {
+				continue; // process is known to be inaccessible
+			}
+
+			out.added.push_back(std::make_shared<ConnectionEntry>(row, cached->proc));
+			out.added_keys.push_back(key);
 		}
 	}
 
-	template<typename Table>
-	void update_tcp_table(Table &table) {
-		bool table_updated = false;
-		TCP_TABLE_CLASS tcp_class;
+	// PID whose last row went away may be reused by another process, so it is opened again when it shows up
+	void forget_processes(const ConnectionsDelta& delta) {
+		for (const auto& row : delta.removed) {
+			if (m_row_indexes.pid(row->pid()).empty()) {
+				m_proc_cache.erase(row->pid());
+			}
+		}
+	}
+
+	// Builds order of all rows of the new snapshot from the previous one. Rows that were kept are already in order,
+	// remap translates their old indices to new ones. Only added rows, and rows whose sort key changed, are sorted,
+	// and then merged into already sorted rows. std::merge prefers the first range on equal keys,
+	// so existing rows keep their relative order
+	std::vector<uint32_t> merge_changed_rows(const ConnectionsDelta& delta, const std::vector<uint32_t>& remap) {
+		const auto& snap = *m_snapshot;
+		const SortBy sort_by = m_view->sort_by();
+		const bool asc_order = m_view->ascending();
+
+		std::unordered_set<const ConnectionEntry*> changed;
+		if (Columns::ByState(sort_by)) {
+			changed.insert(delta.state_changed.begin(), delta.state_changed.end());
+		}
+
+		const uint32_t n = (uint32_t)m_rows.size();
+		const uint32_t kept = n - (uint32_t)delta.added.size();
 
-		// if both filters present, use TCP_TABLE_OWNER_PID_ALL
-		if (m_filters.contains(Filters::TCP_CONNECTIONS) &&
-			m_filters.contains(Filters::TCP_LISTENING)) {
-			tcp_class = TCP_TABLE_OWNER_PID_ALL;
-			table_updated = true;
+		std::vector<uint32_t> sorted, unsorted;
+		sorted.reserve(kept);
+		unsorted.reserve(n - kept + changed.size());
+
+		for (uint32_t old_index : m_order) {
+			uint32_t i = remap.empty() ? old_index : remap[old_index];
+			if (i == RemovedRow) continue;
+
+			(changed.contains(m_rows[i].get()) ? unsorted : sorted).push_back(i);
+		}
+		for (uint32_t i = kept; i < n; i++) {
+			unsorted.push_back(i);
 		}
-		else if (m_filters.contains(Filters::TCP_CONNECTIONS)) {
-			tcp_class = TCP_TABLE_OWNER_PID_CONNECTIONS;
-			table_updated = true;
+
+		if (unsorted.empty()) {
+			return sorted;
 		}
-		else if (m_filters.contains(Filters::TCP_LISTENING)) {
-			tcp_class = TCP_TABLE_OWNER_PID_LISTENER;
-			table_updated = true;
+
+		SortKeys::RowKeys keys(snap, sort_by, asc_order);
+
+		keys.sort(unsorted, sort_pool());
+
+		std::vector<uint32_t> order;
+		order.reserve(n);
+		std::merge(sorted.begin(), sorted.end(), unsorted.begin(), unsorted.end(), std::back_inserter(order),
+			[&keys](uint32_t a, uint32_t b) { return keys.less(a, b); });
+
+		return order;
+	}
+
+	static constexpr uint32_t RemovedRow = (uint32_t)-1;
+
+	// Removes rows that were not seen by this update. Returns new index of every old row (RemovedRow if it was removed),
+	// or nothing if no row was removed
+	std::vector<uint32_t> remove_stale_rows(ConnectionsDelta& delta) {
+		std::unordered_set<const ConnectionEntry*> stale;
+
+		std::erase_if(m_index, [this, &stale](const auto& kv) {
+			if (kv.second.generation != m_generation) {
+				stale.insert(kv.second.entry);
+				return true;
+			}
+			return false;
+			});
+
+		if (stale.empty()) return {};
+
+		std::vector<uint32_t> remap(m_rows.size());
+		uint32_t next = 0;
+		for (size_t i = 0; i < m_rows.size(); i++) {
+			remap[i] = stale.contains(m_rows[i].get()) ? RemovedRow : next++;
 		}
 
-		if (table_updated) {
-			table.update(tcp_class);
-			add_rows(table);
+		// stable, so that remaining rows keep their relative order
+		auto it = std::stable_partition(m_rows.begin(), m_rows.end(), [&stale](const ConnectionEntryPtr& r) {
+			return !stale.contains(r.get());
+			});
+
+		std::move(it, m_rows.end(), std::back_inserter(delta.removed));
+		m_rows.erase(it, m_rows.end());
+
+		return remap;
+	}
+
+	template<typename Table>
+	void update_tcp_table(Table &table, AcquiredRows& out, const std::stop_token& cancel) {
+		if (table.update(m_active_acquisition_filter.tcp_table_class()) != NO_ERROR) {
+			keep_table_rows<typename Table::RowT>();
+			return;
 		}
+		add_rows(table, out, cancel);
 	}
 
 	template<typename Table>
-	void update_udp_table(Table& table) {
-		// UDP only have single UDP_TABLE_CLASS that interests
-		if (m_filters.contains(Filters::UDP)) {
-			table.update(UDP_TABLE_OWNER_PID);
-			add_rows(table);
+	void update_udp_table(Table& table, AcquiredRows& out, const std::stop_token& cancel) {
+		if (table.update(UDP_TABLE_OWNER_PID) != NO_ERROR) {
+			keep_table_rows<typename Table::RowT>();
+			return;
+		}
+		add_rows(table, out, cancel);
+	}
+
+	// Table that failed to be fetched is empty, its rows would be removed and then added again by the next update,
+	// with new ids and without processes and domains. They are stamped as seen instead, and stay as they were.
+	// Like add_rows, it only writes generation of slots of its own table
+	template<typename RowT>
+	void keep_table_rows() {
+		for (auto& [key, slot] : m_index) {
+			if (slot.entry->protocol() == RowTraits<RowT>::protocol && slot.entry->address_family() == RowTraits<RowT>::family) {
+				slot.generation = m_generation;
+			}
 		}
 	}
 
@@ -263,11 +756,60 @@ private:
 
 	ConnectionEntryPtrs m_rows;
 
-	std::unordered_set<Filters> m_filters{ 
-		Filters::IPv4, Filters::IPv6, Filters::TCP_CONNECTIONS,	Filters::TCP_LISTENING, Filters::UDP
+	std::unordered_multimap<ConnectionKey, IndexSlot, ConnectionKeyHash> m_index;
+	uint64_t m_generation{ 0 };
+
+	std::vector<DeltaCallback> m_subscribers;
+
+	SortView::SnapshotPtr m_snapshot{ std::make_shared<const ConnectionsSnapshot>() };
+	// m_view is what refresh side works with, m_published is the same view as seen by readers
+	SortView::Ptr m_view{ std::make_shared<const SortView>() };
+	std::atomic<SortView::Ptr> m_published{ m_view };
+	std::optional<SortKeys::PartialOrder> m_window;
+
+	// all rows of m_snapshot in sort order, published view is this order filtered
+	std::vector<uint32_t> m_order;
+
+	// bits of FilterBit(), row is shown if all bits it needs are set
+	std::atomic<uint32_t> m_filters{ AllFilters };
+
+	// view filter in addition to m_filters, kept by updates
+	std::shared_ptr<const Query> m_query;
+
+	// secondary indexes of m_rows, by row id
+	RowIndexes m_row_indexes;
+
+	// find-as-you-type, index is maintained only after the first search
+	TrigramIndex m_text_index;
+	IncrementalSearch m_search;
+	bool m_text_indexed{ false };
+	// document of every row of m_snapshot
+	std::vector<TrigramIndex::DocId> m_row_docs;
+	// m_view shows all rows that match current search, so a narrower search may filter only m_view
+	bool m_view_searched{ true };
+
+	AcquisitionFilter m_acquisition_filter;
+	// copy taken by update, so that acquisition does not race with filter changes
+	AcquisitionFilter m_active_acquisition_filter;
+
+	// m_update_mutex serializes updates, m_mutex guards rows, snapshot, orders and views
+	std::mutex m_update_mutex;
+	std::mutex m_mutex;
+	std::atomic<size_t> m_churn{ 0 };
+
+	// process of every PID that has rows, and PIDs whose process could not be opened
+	struct CachedProcess {
+		// null if process could not be opened
+		ProcessPtr proc;
+		// update that opened it or failed to
+		uint64_t generation;
 	};
+	static constexpr uint64_t RetryFailedOpenAfter = 8;
+	Cache<DWORD, CachedProcess> m_proc_cache{};
 
-	Cache<DWORD, ProcessPtr> m_proc_cache{};
+	ThreadPool m_pool{ TablesCount };
+	// a worker per core, sorting is CPU bound
+	ThreadPool m_sort_pool{ SortWorkers() };
 };
 
 #endif
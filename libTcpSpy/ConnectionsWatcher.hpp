@@ -0,0 +1,193 @@
+#ifndef CONNECTIONS_WATCHER_HPP
+#define CONNECTIONS_WATCHER_HPP
+
+#include <winsock2.h>
+#include <evntrace.h>
+#include <evntcons.h>
+
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <string>
+
+/*
+ * ConnectionsWatcher calls back when TCP connections are opened or closed, as reported by
+ * Microsoft-Windows-Kernel-Network through a real-time ETW session (connect, accept, reconnect and disconnect
+ * of IPv4 and IPv6 TCP connections). Events are only a trigger to refresh, rows still come from the tables,
+ * so a connection that is closed before the refresh runs is not seen as a row.
+ * Listeners, UDP endpoints and other TCP state changes have no events here, they are caught by a periodic refresh.
+ * Starting the session needs administrator rights or membership in Performance Log Users, start() fails otherwise.
+ * Session name is system-wide, so it carries PID: every running TcpSpy has its own session, and only one watcher
+ * per process can run at a time.
+ * Callback is called on the watcher's thread, once per event
+ */
+class ConnectionsWatcher {
+public:
+	using ChangeCallback = std::function<void()>;
+
+	explicit ConnectionsWatcher(ChangeCallback on_change)
+		: m_on_change(std::move(on_change)), m_name(SessionName + std::to_wstring(GetCurrentProcessId()))
+	{
+	}
+
+	ConnectionsWatcher(const ConnectionsWatcher&) = delete;
+	ConnectionsWatcher(ConnectionsWatcher&&) = delete;
+
+	bool start() {
+		if (m_thread.joinable()) return true;
+
+		// the other watcher of this process owns the session
+		if (ProcessHasWatcher.exchange(true)) return false;
+
+		if (!start_session()) {
+			ProcessHasWatcher = false;
+			return false;
+		}
+
+		EVENT_TRACE_LOGFILEW log{};
+		log.LoggerName = const_cast<LPWSTR>(m_name.c_str());
+		log.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+		log.EventRecordCallback = OnEvent;
+		log.Context = this;
+
+		m_consumer = OpenTraceW(&log);
+		if (m_consumer == INVALID_PROCESSTRACE_HANDLE) {
+			stop_session();
+			ProcessHasWatcher = false;
+			return false;
+		}
+
+		// returns when session is stopped
+		m_thread = std::thread([this]() {
+			ProcessTrace(&m_consumer, 1, nullptr, nullptr);
+			});
+
+		return true;
+	}
+
+	void stop() {
+		if (!m_thread.joinable()) return;
+
+		stop_session();
+		m_thread.join();
+		CloseTrace(m_consumer);
+		m_consumer = INVALID_PROCESSTRACE_HANDLE;
+		ProcessHasWatcher = false;
+	}
+
+	bool running() const { return m_thread.joinable(); }
+
+	size_t events() const { return m_events; }
+
+	~ConnectionsWatcher() { stop(); }
+private:
+	struct Properties {
+		EVENT_TRACE_PROPERTIES props;
+		wchar_t name[64];
+	};
+
+	// followed by PID
+	static constexpr const wchar_t* SessionName = L"TcpSpy Connections Watcher ";
+
+	static inline std::atomic<bool> ProcessHasWatcher{ false };
+
+	// {7DD42A49-5329-4832-8DFD-43D979153A88}
+	static constexpr GUID KernelNetwork{ 0x7dd42a49, 0x5329, 0x4832, { 0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88 } };
+	static constexpr ULONGLONG KeywordIPv4 = 0x10;
+	static constexpr ULONGLONG KeywordIPv6 = 0x20;
+
+	// TCP connect, disconnect, accept and reconnect, IPv4 then IPv6
+	static constexpr USHORT TcpEvents[]{ 12, 13, 15, 16, 28, 29, 31, 32 };
+
+	static void InitProperties(Properties& p) {
+		memset(&p, 0, sizeof(p));
+		p.props.Wnode.BufferSize = sizeof(p);
+		p.props.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+		p.props.Wnode.ClientContext = 1;
+		p.props.LogFileMode = EVENT_TRACE_REAL_TIME_MODE | EVENT_TRACE_USE_MS_FLUSH_TIMER;
+		// events are delivered at most this late (ms)
+		p.props.FlushTimer = 50;
+		p.props.LoggerNameOffset = offsetof(Properties, name);
+	}
+
+	bool start_session() {
+		Properties p;
+		InitProperties(p);
+		ULONG res = StartTraceW(&m_session, m_name.c_str(), &p.props);
+
+		// PID is ours and this process has no other watcher, so session was left by a dead instance that had the same PID
+		if (res == ERROR_ALREADY_EXISTS) {
+			InitProperties(p);
+			ControlTraceW(0, m_name.c_str(), &p.props, EVENT_TRACE_CONTROL_STOP);
+			InitProperties(p);
+			res = StartTraceW(&m_session, m_name.c_str(), &p.props);
+		}
+		if (res != ERROR_SUCCESS) return false;
+
+		if (!enable_provider()) {
+			stop_session();
+			return false;
+		}
+		return true;
+	}
+
+	// provider filtered down to TCP events, or all its IPv4/IPv6 events if the filter is not supported
+	bool enable_provider() {
+		std::vector<BYTE> ids(offsetof(EVENT_FILTER_EVENT_ID, Events) + sizeof(TcpEvents));
+		auto filter = reinterpret_cast<EVENT_FILTER_EVENT_ID*>(ids.data());
+		filter->FilterIn = TRUE;
+		filter->Count = (USHORT)std::size(TcpEvents);
+		memcpy(filter->Events, TcpEvents, sizeof(TcpEvents));
+
+		EVENT_FILTER_DESCRIPTOR desc{};
+		desc.Ptr = (ULONGLONG)ids.data();
+		desc.Size = (ULONG)ids.size();
+		desc.Type = EVENT_FILTER_TYPE_EVENT_ID;
+
+		ENABLE_TRACE_PARAMETERS params{};
+		params.Version = ENABLE_TRACE_PARAMETERS_VERSION_2;
+		params.EnableFilterDesc = &desc;
+		params.FilterDescCount = 1;
+
+		ULONGLONG keywords = KeywordIPv4 | KeywordIPv6;
+		if (EnableTraceEx2(m_session, &KernelNetwork, EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION, keywords, 0, 0, &params) == ERROR_SUCCESS) {
+			return true;
+		}
+		return EnableTraceEx2(m_session, &KernelNetwork, EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION, keywords, 0, 0, nullptr) == ERROR_SUCCESS;
+	}
+
+	void stop_session() {
+		Properties p;
+		InitProperties(p);
+		ControlTraceW(m_session, nullptr, &p.props, EVENT_TRACE_CONTROL_STOP);
+		m_session = 0;
+	}
+
+	static void WINAPI OnEvent(PEVENT_RECORD rec) {
+		auto self = static_cast<ConnectionsWatcher*>(rec->UserContext);
+		if (!IsEqualGUID(rec->EventHeader.ProviderId, KernelNetwork)) return;
+
+		// without the filter, UDP send/receive and TCP data events come too
+		USHORT id = rec->EventHeader.EventDescriptor.Id;
+		if (std::find(std::begin(TcpEvents), std::end(TcpEvents), id) == std::end(TcpEvents)) return;
+
+		self->m_events++;
+		if (self->m_on_change) self->m_on_change();
+	}
+
+	ChangeCallback m_on_change;
+	std::wstring m_name;
+
+	TRACEHANDLE m_session{ 0 };
+	TRACEHANDLE m_consumer{ INVALID_PROCESSTRACE_HANDLE };
+	std::atomic<size_t> m_events{ 0 };
+
+	std::thread m_thread;
+};
+
+#endif
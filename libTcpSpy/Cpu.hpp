@@ -0,0 +1,44 @@
+#ifndef CPU_HPP
+#define CPU_HPP
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define TCPSPY_X86 1
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/*
+ * Runtime CPU dispatch. Kernels with AVX2 intrinsics are compiled without /arch:AVX2,
+ * so they may only be called when HasAvx2() is true, otherwise SSE2 (which every x86 target of the project has)
+ * or scalar code is used
+ */
+namespace Cpu {
+	inline bool DetectAvx2() {
+#ifdef TCPSPY_X86
+		int info[4];
+
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+
+		__cpuid(info, 1);
+		const bool osxsave = info[2] & (1 << 27);
+		const bool avx = info[2] & (1 << 28);
+		if (!osxsave || !avx) return false;
+
+		// OS saves XMM and YMM registers on context switch
+		if ((_xgetbv(0) & 6) != 6) return false;
+
+		__cpuidex(info, 7, 0);
+		return info[1] & (1 << 5);
+#else
+		return false;
+#endif
+	}
+
+	inline bool HasAvx2() {
+		static const bool avx2 = DetectAvx2();
+		return avx2;
+	}
+}
+
+#endif
@@ -12,34 +12,18 @@
 class DomainResolver {
 public:
 	std::optional<std::wstring> resolve_domain(
-		IPAddress addr,
+		const IPAddress& addr,
 		ProtocolFamily af,
 		std::function<void(std::wstring &)> func)
 	{
-		std::wstring addr_str;
-		switch (af) {
-		case ProtocolFamily::INET: 
-			addr_str = Net::ConvertAddrToStr(std::get<IP4Address>(addr));
-			break;
-		case ProtocolFamily::INET6:
-			addr_str = Net::ConvertAddrToStr(std::get<IP6Address>(addr).data());
-			break;
-		}
-
-		auto cached_domain = m_domain_cache.get(addr_str);
+		auto cached_domain = m_domain_cache.get(addr);
 		if (!cached_domain) {
 			// capture by value because thread will obviously outlive stack variables
-			m_thread_pool.submit([this, addr, addr_str, af, func]() {
-				std::wstring domain;
-				switch (af) {
-				case ProtocolFamily::INET:
-					domain = Net::ResolveAddrToDomainName(std::get<IP4Address>(addr));
-					break;
-				case ProtocolFamily::INET6:
-					domain = Net::ResolveAddrToDomainName(std::get<IP6Address>(addr).data());
-					break;
-				}
-				this->m_domain_cache.set(addr_str, domain);
+			m_thread_pool.submit([this, addr, af, func]() {
+				std::wstring domain = af == ProtocolFamily::INET
+					? Net::ResolveAddrToDomainName(addr.ipv4())
+					: Net::ResolveAddrToDomainName(addr.data());
+				this->m_domain_cache.set(addr, domain);
 				func(domain); // call callback with resolved domain
 				});
 			return std::nullopt;
@@ -55,7 +39,8 @@ public:
 	}
 
 private:
-	Cache<std::wstring, std::wstring> m_domain_cache{};
+	// keyed by address, so that cached rows are looked up without formatting their address
+	Cache<IPAddress, std::wstring> m_domain_cache{};
 	ThreadPool m_thread_pool{ 5 };
 };
 
@@ -0,0 +1,157 @@
+#ifndef IP_ADDRESS_HPP
+#define IP_ADDRESS_HPP
+
+#include <winsock2.h>
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <compare>
+#include <functional>
+#include <type_traits>
+#include <bit>
+
+#include "Cpu.hpp"
+
+/*
+ * Address of either family as 16 bytes in network order, IPv4 address a.b.c.d is stored IPv4-mapped (::ffff:a.b.c.d).
+ * It is a trivially copyable value, so that IPv4 and IPv6 rows are compared, sorted, hashed and scanned the same way,
+ * without dispatch on address family. Family is still kept by rows, only for formatting and name resolution.
+ * Equality and ordering compare all 16 bytes with one SSE2 instruction, order is numeric (the same as byte-wise)
+ */
+struct IPAddress {
+	static constexpr size_t Size = 16;
+
+	UCHAR bytes[Size];
+
+	// addr is in network order, as it comes in MIB rows
+	static IPAddress FromIPv4(DWORD addr) {
+		IPAddress out{};
+		out.bytes[10] = 0xff;
+		out.bytes[11] = 0xff;
+		memcpy(out.bytes + 12, &addr, sizeof(addr));
+		return out;
+	}
+
+	static IPAddress FromIPv6(const UCHAR* addr) {
+		IPAddress out;
+		memcpy(out.bytes, addr, Size);
+		return out;
+	}
+
+	// first `bits` bits set
+	static IPAddress PrefixMask(UCHAR bits) {
+		IPAddress out{};
+		for (size_t b = 0; b < Size && bits > b * 8; b++) {
+			size_t ones = bits - b * 8;
+			out.bytes[b] = ones >= 8 ? 0xff : (UCHAR)(0xff << (8 - ones));
+		}
+		return out;
+	}
+
+	bool is_v4_mapped() const {
+		static constexpr UCHAR prefix[12]{ 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+		return memcmp(bytes, prefix, sizeof(prefix)) == 0;
+	}
+
+	// last 4 bytes in network order, the IPv4 address of a mapped one
+	DWORD ipv4() const {
+		DWORD a;
+		memcpy(&a, bytes + 12, sizeof(a));
+		return a;
+	}
+
+	const UCHAR* data() const { return bytes; }
+	UCHAR* data() { return bytes; }
+
+	UCHAR operator[](size_t i) const { return bytes[i]; }
+	UCHAR& operator[](size_t i) { return bytes[i]; }
+
+	// numeric value as two halves, hi() is the first 8 bytes
+	uint64_t hi() const { return LoadBigEndian64(bytes); }
+	uint64_t lo() const { return LoadBigEndian64(bytes + 8); }
+
+	IPAddress operator&(const IPAddress& mask) const {
+		uint64_t a[2], m[2];
+		memcpy(a, bytes, sizeof(a));
+		memcpy(m, mask.bytes, sizeof(m));
+		a[0] &= m[0];
+		a[1] &= m[1];
+
+		IPAddress out;
+		memcpy(out.bytes, a, sizeof(a));
+		return out;
+	}
+
+	// first `bits` bits equal those of net, which has the rest zeroed
+	bool in_prefix(const IPAddress& net, const IPAddress& mask) const { return (*this & mask) == net; }
+
+	bool operator==(const IPAddress& other) const {
+#ifdef TCPSPY_X86
+		return Equal16(bytes, other.bytes) == 0xffff;
+#else
+		uint64_t a[2], b[2];
+		memcpy(a, bytes, sizeof(a));
+		memcpy(b, other.bytes, sizeof(b));
+		return ((a[0] ^ b[0]) | (a[1] ^ b[1])) == 0;
+#endif
+	}
+
+	// first differing byte decides, it is found from the mask of equal bytes without a loop
+	std::strong_ordering operator<=>(const IPAddress& other) const {
+#ifdef TCPSPY_X86
+		uint32_t diff = ~Equal16(bytes, other.bytes) & 0xffff;
+		if (!diff) return std::strong_ordering::equal;
+		size_t i = std::countr_zero(diff);
+		return bytes[i] <=> other.bytes[i];
+#else
+		uint64_t a = hi(), b = other.hi();
+		return a != b ? a <=> b : lo() <=> other.lo();
+#endif
+	}
+
+	// 64-bit hash of all 16 bytes: two multiplies, a rotate and a final avalanche round
+	uint64_t hash() const {
+		uint64_t w[2];
+		memcpy(w, bytes, sizeof(w));
+
+		uint64_t h = (w[0] * 0x9e3779b97f4a7c15ULL) ^ std::rotl(w[1] * 0xc2b2ae3d27d4eb4fULL, 31);
+		h ^= h >> 32;
+		h *= 0xd6e8feb86659fd93ULL;
+		return h ^ (h >> 32);
+	}
+private:
+	static uint64_t LoadBigEndian64(const UCHAR* p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		if constexpr (std::endian::native == std::endian::little) {
+#ifdef _MSC_VER
+			v = _byteswap_uint64(v);
+#else
+			v = __builtin_bswap64(v);
+#endif
+		}
+		return v;
+	}
+
+#ifdef TCPSPY_X86
+	// bit i is set if byte i of a and b is equal
+	static uint32_t Equal16(const UCHAR* a, const UCHAR* b) {
+		__m128i x = _mm_loadu_si128((const __m128i*)a);
+		__m128i y = _mm_loadu_si128((const __m128i*)b);
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+	}
+#endif
+};
+
+static_assert(sizeof(IPAddress) == IPAddress::Size && std::is_trivially_copyable_v<IPAddress>, "addresses are copied and scanned as 16 raw bytes");
+
+struct IPAddressHash {
+	size_t operator()(const IPAddress& addr) const { return (size_t)addr.hash(); }
+};
+
+template<>
+struct std::hash<IPAddress> : IPAddressHash {};
+
+#endif
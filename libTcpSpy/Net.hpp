@@ -48,11 +48,20 @@ namespace Net {
 	}
 
 	inline std::wstring ConvertAddrToStr(DWORD a) {
-		sockaddr_in sin{};
-		sin.sin_family = AF_INET;
-		sin.sin_addr.s_addr = a;
+		// dotted quad is formatted directly, WSAAddressToStringW round trip through sockaddr is not needed for IPv4
+		const UCHAR* octets = (const UCHAR*)&a;
+		WCHAR buf[16];
+		WCHAR* p = buf;
+
+		for (int i = 0; i < 4; i++) {
+			UCHAR o = octets[i];
+			if (o >= 100) { *p++ = L'0' + o / 100; }
+			if (o >= 10)  { *p++ = L'0' + o / 10 % 10; }
+			*p++ = L'0' + o % 10;
+			if (i != 3)   { *p++ = L'.'; }
+		}
 
-		return ::_SockaddrToWString((SOCKADDR*)&sin, sizeof(sin));
+		return std::wstring(buf, p);
 	}
 
 	inline std::wstring ConvertAddrToStr(const UCHAR a[]) {
@@ -0,0 +1,920 @@
+#ifndef QUERY_HPP
+#define QUERY_HPP
+
+#include <vector>
+#include <string>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <cwctype>
+#include <utility>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+
+#include "ConnectionsSnapshot.hpp"
+#include "SortView.hpp"
+#include "AcquisitionFilter.hpp"
+#include "Column.hpp"
+#include "Columns.hpp"
+#include "TextSearch.hpp"
+#include "Bitmap.hpp"
+#include "ColumnScan.hpp"
+
+class QueryError : public std::runtime_error {
+public:
+	QueryError(const std::string& what, size_t pos)
+		: std::runtime_error(what + " at position " + std::to_string(pos + 1)), m_pos(pos)
+	{
+	}
+
+	// offset in query text where parsing failed, 0 if text does not start with a field name
+	size_t position() const { return m_pos; }
+private:
+	size_t m_pos;
+};
+
+/*
+ * Query is a filter expression compiled into a predicate program over ConnectionsSnapshot columns, e.g.
+ *   proc~nginx and rport in 80,443 and state=ESTAB and raddr in 10.0.0.0/8
+ * Fields: proc, path, pid, proto, af, laddr, lport, raddr, rport, state; port and addr mean local or remote one.
+ * Operators: = != (list of values is "any of"), in, ~ (substring), ^ (prefix), < <= > >= for pid and ports.
+ * Values: port and pid ranges a-b, address prefixes a.b.c.d/n, state name prefixes. Text compares ignore case,
+ * quote values with spaces or operator characters. Conditions combine with and, or, not and parentheses.
+ * Everything that does not depend on rows is done once: ports become a 64K bitmap, protocol, family and state
+ * a bitmask of accepted values, process tests are evaluated once per process of snapshot by bind().
+ * So row check is a few array lookups, only text search in addresses formats them. Remote port text is the service
+ * name the list shows (https, not 443), it is matched once per distinct remote port of snapshot by bind().
+ * Text is searched with TextSearch kernels: process names and paths once per bind(), addresses of all rows
+ * in one pass when the whole table is scanned (see bind()). Whole table matcher also checks ports, states,
+ * protocols, families and address prefixes with ColumnScan kernels, a column at a time, and runs the program
+ * on the resulting bitmaps once, so that checking a row is a bit test
+ * Remote fields and state are never matched by UDP rows, != on them neither: state!=LISTEN is TCP rows in other states.
+ * `not` negates a whole condition, so not state=LISTEN is also every UDP row
+ */
+class Query {
+public:
+	Query() {}
+
+	static Query Compile(const std::wstring& text) {
+		Query query;
+		Parser(query, text).parse();
+		query.m_text = text;
+		return query;
+	}
+
+	// Case-insensitive prefix of column's text, as Find dialog searched before queries.
+	// Column is searched by its query field (Columns::Descriptor::QueryField)
+	static Query ColumnPrefix(Column column, const std::wstring& text) {
+		Query query;
+		query.m_text = text;
+
+		if (column >= Column::Count) throw QueryError("unknown column", 0);
+
+		auto fields = FieldsNamed(Columns::QueryField(column));
+		if (fields.size() != 1) throw QueryError("unknown column", 0);
+
+		query.emit_test(query.text_test(fields[0], TextMode::Prefix, { Lower(text) }));
+		return query;
+	}
+
+	// Text is meant as a query rather than plain text: it starts with a field name, `not` or `(`.
+	// Nothing is compiled, so it is cheap enough to be called on every keystroke
+	static bool StartsWithField(const std::wstring& text) {
+		size_t pos = 0;
+		while (pos < text.size() && std::iswspace(text[pos])) pos++;
+		if (pos == text.size()) return false;
+		if (text[pos] == L'(') return true;
+
+		std::wstring word;
+		while (pos < text.size() && !std::iswspace(text[pos]) && !Parser::IsSpecial(text[pos])) {
+			word += text[pos++];
+		}
+		word = Lower(word);
+		return word == L"not" || (!word.empty() && !FieldsNamed(word).empty());
+	}
+
+	const std::wstring& text() const { return m_text; }
+
+	// query without conditions matches every row
+	bool empty() const { return m_program.empty(); }
+
+	// Query bound to a snapshot, checks its rows. Query and snapshot must outlive it
+	class Matcher {
+	public:
+		bool operator()(uint32_t row) const {
+			if (m_scanned) return m_hits.test(row);
+
+			// stack of results, top is the lowest bit
+			uint64_t stack = 1;
+
+			const auto& program = m_query->m_program;
+			for (size_t pc = 0; pc < program.size(); pc++) {
+				const auto& instr = program[pc];
+				switch (instr.op) {
+				case Op::Test:
+					stack = (stack << 1) | (test(instr.arg, row) ? 1 : 0);
+					break;
+				case Op::Not:
+					stack ^= 1;
+					break;
+				case Op::AndJump:
+					// false left operand is the result, right one is not evaluated
+					if (!(stack & 1)) pc = instr.arg - 1;
+					else stack >>= 1;
+					break;
+				case Op::OrJump:
+					if (stack & 1) pc = instr.arg - 1;
+					else stack >>= 1;
+					break;
+				}
+			}
+
+			return stack & 1;
+		}
+	private:
+		friend class Query;
+
+		Matcher(const Query& query, const ConnectionsSnapshot& snap, bool whole_table)
+			: m_query(&query), m_snap(&snap), m_process_tables(query.m_tests.size()), m_port_sets(query.m_tests.size())
+			, m_row_hits(query.m_tests.size())
+		{
+			std::optional<TextSearch::TextColumn> names, paths, local_addrs, remote_addrs;
+
+			for (size_t t = 0; t < query.m_tests.size(); t++) {
+				const auto& test = query.m_tests[t];
+
+				if (test.kind == Kind::AddressText && whole_table) {
+					const bool local = test.field == Field::LocalAddr;
+					auto& column = local ? local_addrs : remote_addrs;
+					if (!column) {
+						column = TextSearch::TextColumn::Build(snap.size(), [&snap, local](size_t i) {
+							return local ? snap.local_addr_str(i) : snap.remote_addr_str(i);
+							});
+					}
+					m_row_hits[t] = TextSearch::FindAny(*column, test.needles, test.mode);
+					continue;
+				}
+
+				if (test.kind == Kind::ServiceText) {
+					m_port_sets[t] = service_ports(t);
+					continue;
+				}
+
+				if (test.kind != Kind::Process) continue;
+
+				auto& table = m_process_tables[t];
+				table.resize(snap.processes.size());
+
+				if (test.field == Field::Pid) {
+					for (size_t p = 0; p < snap.processes.size(); p++) {
+						table[p] = query.matches_pid(test, *snap.processes[p]);
+					}
+					continue;
+				}
+
+				const bool name = test.field == Field::Proc;
+				auto& column = name ? names : paths;
+				if (!column) {
+					column = TextSearch::TextColumn::Build(snap.processes.size(), [&snap, name](size_t p) {
+						return std::wstring_view(name ? snap.processes[p]->m_name : snap.processes[p]->m_path);
+						});
+				}
+				auto hits = TextSearch::FindAny(*column, test.needles, test.mode);
+				for (size_t p = 0; p < snap.processes.size(); p++) {
+					table[p] = hits.test(p);
+				}
+			}
+
+			if (whole_table) {
+				m_hits = scan();
+				m_scanned = true;
+			}
+		}
+
+		// remote ports of snapshot whose service text matches, every port is formatted once
+		std::vector<uint64_t> service_ports(uint32_t t) const {
+			const auto& test = m_query->m_tests[t];
+			const auto& snap = *m_snap;
+
+			std::vector<uint64_t> seen(65536 / 64, 0), ports(65536 / 64, 0);
+			for (size_t i = 0; i < snap.size(); i++) {
+				USHORT port = snap.remote_port[i];
+				uint64_t bit = 1ull << (port & 63);
+				if (seen[port >> 6] & bit) continue;
+				seen[port >> 6] |= bit;
+
+				if (MatchText(ServiceText(port), test.needles, test.mode)) ports[port >> 6] |= bit;
+			}
+			return ports;
+		}
+
+		// result of test for every row, with column kernels
+		Bitmap scan_test(uint32_t t) const {
+			const auto& test = m_query->m_tests[t];
+			const auto& snap = *m_snap;
+
+			Bitmap hits;
+			switch (test.kind) {
+			case Kind::Process: {
+				hits = Bitmap(snap.size());
+				const auto& table = m_process_tables[t];
+				for (size_t i = 0; i < snap.size(); i++) {
+					if (table[snap.process[i]]) hits.set(i);
+				}
+				break;
+			}
+			case Kind::Port:
+				hits = ColumnScan::InSet(test.field == Field::LocalPort ? snap.local_port : snap.remote_port, test.ports);
+				break;
+			case Kind::ServiceText:
+				hits = ColumnScan::InSet(snap.remote_port, m_port_sets[t]);
+				break;
+			case Kind::Value:
+				switch (test.field) {
+				case Field::Proto:  hits = ColumnScan::InMask(snap.protocol, test.values); break;
+				case Field::Family: hits = ColumnScan::InMask(snap.family, test.values); break;
+				default:            hits = ColumnScan::InMask(snap.state, test.values); break;
+				}
+				break;
+			case Kind::Address: {
+				const auto& column = test.field == Field::LocalAddr ? snap.local_addr : snap.remote_addr;
+				hits = Bitmap(snap.size());
+				for (const auto& prefix : test.prefixes) {
+					auto in = ColumnScan::InPrefix(column, prefix.addr, prefix.bits);
+					in &= ColumnScan::InMask(snap.family, 1u << (uint32_t)prefix.af);
+					hits |= in;
+				}
+				break;
+			}
+			case Kind::AddressText:
+				hits = m_row_hits[t];
+				break;
+			}
+
+			if (IsRemote(test.field)) {
+				hits &= ColumnScan::InMask(snap.protocol, 1u << (uint32_t)ConnectionProtocol::PROTO_TCP);
+			}
+			return hits;
+		}
+
+		// Program run on bitmaps of all rows. Both operands of and / or are evaluated, a jump is remembered
+		// with its left operand and combined with the right one when its target is reached
+		Bitmap scan() const {
+			const auto& program = m_query->m_program;
+
+			struct Pending {
+				uint32_t target;
+				Op op;
+				Bitmap left;
+			};
+
+			std::vector<Bitmap> stack;
+			std::vector<Pending> pending;
+
+			for (size_t pc = 0; pc <= program.size(); pc++) {
+				// nested jumps to the same target are combined innermost first
+				while (!pending.empty() && pending.back().target == pc) {
+					auto& left = pending.back().left;
+					if (pending.back().op == Op::AndJump) stack.back() &= left;
+					else stack.back() |= left;
+					pending.pop_back();
+				}
+
+				if (pc == program.size()) break;
+
+				const auto& instr = program[pc];
+				switch (instr.op) {
+				case Op::Test:
+					stack.push_back(scan_test(instr.arg));
+					break;
+				case Op::Not:
+					stack.back().flip();
+					break;
+				case Op::AndJump:
+				case Op::OrJump:
+					pending.push_back({ instr.arg, instr.op, std::move(stack.back()) });
+					stack.pop_back();
+					break;
+				}
+			}
+
+			if (stack.empty()) {
+				Bitmap all(m_snap->size());
+				all.flip();
+				return all;
+			}
+			return std::move(stack.back());
+		}
+
+		bool test(uint32_t t, uint32_t row) const {
+			const auto& test = m_query->m_tests[t];
+			const auto& snap = *m_snap;
+
+			if (IsRemote(test.field) && snap.protocol[row] != ConnectionProtocol::PROTO_TCP) {
+				return false;
+			}
+
+			switch (test.kind) {
+			case Kind::Process:
+				return m_process_tables[t][snap.process[row]];
+			case Kind::Port: {
+				USHORT port = test.field == Field::LocalPort ? snap.local_port[row] : snap.remote_port[row];
+				return (test.ports[port >> 6] >> (port & 63)) & 1;
+			}
+			case Kind::ServiceText: {
+				USHORT port = snap.remote_port[row];
+				return (m_port_sets[t][port >> 6] >> (port & 63)) & 1;
+			}
+			case Kind::Value: {
+				uint32_t value = ValueOf(snap, test.field, row);
+				return value < 32 && (test.values & (1u << value));
+			}
+			case Kind::Address: {
+				const auto& addr = test.field == Field::LocalAddr ? snap.local_addr[row] : snap.remote_addr[row];
+				for (const auto& prefix : test.prefixes) {
+					if (prefix.contains(snap.family[row], addr)) return true;
+				}
+				return false;
+			}
+			case Kind::AddressText: {
+				if (m_row_hits[t].size()) {
+					return m_row_hits[t].test(row);
+				}
+				const auto& addr = test.field == Field::LocalAddr ? snap.local_addr[row] : snap.remote_addr[row];
+				return MatchText(Lower(AddressToStr(addr, snap.family[row])), test.needles, test.mode);
+			}
+			}
+			return false;
+		}
+
+		const Query* m_query;
+		const ConnectionsSnapshot* m_snap;
+		// for process tests, result for every process of snapshot
+		std::vector<std::vector<uint8_t>> m_process_tables;
+		// for remote port text tests, bit for every matching port
+		std::vector<std::vector<uint64_t>> m_port_sets;
+		// for address text tests of whole table matcher, result for every row
+		std::vector<Bitmap> m_row_hits;
+		// whole table matcher: result for every row
+		Bitmap m_hits;
+		bool m_scanned{ false };
+	};
+
+	// Matcher that checks every row (whole_table) evaluates the query over all rows at once with column kernels,
+	// otherwise it checks rows it is asked about, which is cheaper when the first few rows decide
+	Matcher bind(const ConnectionsSnapshot& snap, bool whole_table = false) const {
+		return Matcher(*this, snap, whole_table);
+	}
+
+	// positions of view whose rows match, in view order
+	std::vector<uint32_t> find_all(const SortView& view) const {
+		// rows are checked when binding, column by column, so this only tests their bits in view's order
+		auto match = bind(view.snapshot(), true);
+
+		std::vector<uint32_t> found;
+		for (size_t k = 0; k < view.size(); k++) {
+			if (match(view[k])) found.push_back((uint32_t)k);
+		}
+		return found;
+	}
+
+	// first matching position after `from` (before it when searching up), from the start (end) if from is npos
+	std::optional<size_t> find_next(const SortView& view, size_t from, bool down) const {
+		auto match = bind(view.snapshot());
+		const size_t n = view.size();
+
+		if (down) {
+			for (size_t k = from == npos ? 0 : from + 1; k < n; k++) {
+				if (match(view[k])) return k;
+			}
+		}
+		else {
+			for (size_t k = from == npos || from > n ? n : from; k-- > 0;) {
+				if (match(view[k])) return k;
+			}
+		}
+		return std::nullopt;
+	}
+
+	static constexpr size_t npos = (size_t)-1;
+private:
+	enum class Field { Proc, Path, Pid, Proto, Family, LocalAddr, LocalPort, RemoteAddr, RemotePort, State };
+
+	// ServiceText is a text test on remote port, resolved by bind()
+	enum class Kind { Process, Port, Value, Address, AddressText, ServiceText };
+
+	using TextMode = TextSearch::Mode;
+
+	// AndJump and OrJump go to arg when top of stack decides the result, otherwise pop it
+	enum class Op : uint8_t { Test, Not, AndJump, OrJump };
+
+	struct Test {
+		Kind kind;
+		Field field;
+		TextMode mode{ TextMode::Equal };
+		// lowercased, any of them matches
+		std::vector<std::wstring> needles;
+		// pids of Process test, when it is not a text one
+		std::vector<std::pair<DWORD, DWORD>> pids;
+		// bit for every accepted port
+		std::vector<uint64_t> ports;
+		// bit for every accepted protocol, family or state
+		uint32_t values{ 0 };
+		// IPv4 prefixes are IPv4-mapped, as snapshot addresses
+		std::vector<AddressPrefix> prefixes;
+	};
+
+	struct Instr {
+		Op op;
+		// test index or jump target
+		uint32_t arg{ 0 };
+	};
+
+	// result stack of Matcher is a 64 bit word with a guard bit
+	static constexpr size_t MaxDepth = 62;
+
+	// fields of a query field name, none if name is unknown; port and addr are both local and remote one
+	static std::vector<Field> FieldsNamed(const std::wstring& name) {
+		if (name == L"proc" || name == L"process" || name == L"name") return { Field::Proc };
+		if (name == L"path") return { Field::Path };
+		if (name == L"pid") return { Field::Pid };
+		if (name == L"proto" || name == L"protocol") return { Field::Proto };
+		if (name == L"af" || name == L"ip" || name == L"family") return { Field::Family };
+		if (name == L"laddr") return { Field::LocalAddr };
+		if (name == L"raddr") return { Field::RemoteAddr };
+		if (name == L"addr") return { Field::LocalAddr, Field::RemoteAddr };
+		if (name == L"lport") return { Field::LocalPort };
+		if (name == L"rport") return { Field::RemotePort };
+		if (name == L"port") return { Field::LocalPort, Field::RemotePort };
+		if (name == L"state") return { Field::State };
+		return {};
+	}
+
+	static bool IsRemote(Field field) {
+		return field == Field::RemoteAddr || field == Field::RemotePort || field == Field::State;
+	}
+
+	static uint32_t ValueOf(const ConnectionsSnapshot& snap, Field field, size_t row) {
+		switch (field) {
+		case Field::Proto:  return (uint32_t)snap.protocol[row];
+		case Field::Family: return (uint32_t)snap.family[row];
+		default:            return snap.state[row];
+		}
+	}
+
+	// accepted values of protocol, family and state with their text, as list view shows them
+	static std::vector<std::pair<uint32_t, std::wstring>> ValueNames(Field field) {
+		std::vector<std::pair<uint32_t, std::wstring>> names;
+
+		switch (field) {
+		case Field::Proto:
+			for (auto proto : { ConnectionProtocol::PROTO_TCP, ConnectionProtocol::PROTO_UDP }) {
+				names.emplace_back((uint32_t)proto, Lower(ProtocolToStr(proto)));
+			}
+			break;
+		case Field::Family:
+			for (auto af : { ProtocolFamily::INET, ProtocolFamily::INET6 }) {
+				names.emplace_back((uint32_t)af, Lower(ProtocolFamilyToStr(af)));
+			}
+			break;
+		default:
+			for (DWORD state = MIB_TCP_STATE_CLOSED; state <= MIB_TCP_STATE_DELETE_TCB; state++) {
+				names.emplace_back(state, Lower(TcpStateToStr(state)));
+			}
+			break;
+		}
+
+		return names;
+	}
+
+	static std::wstring Lower(std::wstring str) {
+		return TextSearch::Lower(std::move(str));
+	}
+
+	static bool MatchText(const std::wstring& lower, const std::vector<std::wstring>& needles, TextMode mode) {
+		for (const auto& needle : needles) {
+			switch (mode) {
+			case TextMode::Equal:
+				if (lower == needle) return true;
+				break;
+			case TextMode::Prefix:
+				if (lower.compare(0, needle.size(), needle) == 0) return true;
+				break;
+			case TextMode::Substring:
+				if (lower.find(needle) != std::wstring::npos) return true;
+				break;
+			}
+		}
+		return false;
+	}
+
+	// lowercased remote port as list view shows it, service names are cached as they are looked up in services file
+	static const std::wstring& ServiceText(USHORT port) {
+		static std::mutex mut;
+		static std::unordered_map<USHORT, std::wstring> names;
+
+		std::scoped_lock<std::mutex> lck(mut);
+		auto it = names.find(port);
+		if (it == names.end()) {
+			it = names.emplace(port, Lower(Net::ConvertPortToService(port, "tcp"))).first;
+		}
+		return it->second;
+	}
+
+	static bool matches_pid(const Test& test, const Process& proc) {
+		if (!test.needles.empty()) {
+			return MatchText(Utils::ConvertFrom<DWORD>(proc.m_pid), test.needles, test.mode);
+		}
+		for (const auto& [first, last] : test.pids) {
+			if (first <= proc.m_pid && proc.m_pid <= last) return true;
+		}
+		return false;
+	}
+
+	// test on the text of field as list view shows it
+	static Test text_test(Field field, TextMode mode, std::vector<std::wstring> needles) {
+		Test test{};
+		test.field = field;
+
+		switch (field) {
+		case Field::Proc:
+		case Field::Path:
+		case Field::Pid:
+			test.kind = Kind::Process;
+			test.mode = mode;
+			test.needles = std::move(needles);
+			break;
+		case Field::LocalPort:
+			test.kind = Kind::Port;
+			test.ports.assign(65536 / 64, 0);
+			for (DWORD port = 0; port < 65536; port++) {
+				if (MatchText(Net::ConvertPortToStr(port), needles, mode)) {
+					test.ports[port >> 6] |= 1ull << (port & 63);
+				}
+			}
+			break;
+		case Field::RemotePort:
+			// service names are looked up only for ports that rows have
+			test.kind = Kind::ServiceText;
+			test.mode = mode;
+			test.needles = std::move(needles);
+			break;
+		case Field::LocalAddr:
+		case Field::RemoteAddr:
+			test.kind = Kind::AddressText;
+			test.mode = mode;
+			test.needles = std::move(needles);
+			break;
+		default:
+			test.kind = Kind::Value;
+			for (const auto& [value, name] : ValueNames(field)) {
+				if (MatchText(name, needles, mode)) test.values |= 1u << value;
+			}
+			break;
+		}
+
+		return test;
+	}
+
+	void emit_test(Test test) {
+		m_tests.push_back(std::move(test));
+		m_program.push_back({ Op::Test, (uint32_t)(m_tests.size() - 1) });
+	}
+
+	// position of instruction, to patch jump target later
+	size_t emit(Op op) {
+		m_program.push_back({ op });
+		return m_program.size() - 1;
+	}
+
+	void patch(size_t jump) {
+		m_program[jump].arg = (uint32_t)m_program.size();
+	}
+
+	class Parser {
+	public:
+		Parser(Query& query, const std::wstring& text)
+			: m_query(query), m_text(text)
+		{
+			next();
+		}
+
+		void parse() {
+			if (m_tok.type == TokType::End) {
+				throw QueryError("empty query", 0);
+			}
+
+			parse_or();
+
+			if (m_tok.type != TokType::End) {
+				fail("expected 'and', 'or' or ')'");
+			}
+		}
+		static bool IsSpecial(wchar_t c) {
+			return c == L'=' || c == L'!' || c == L'~' || c == L'^' || c == L'<' || c == L'>'
+				|| c == L',' || c == L'(' || c == L')' || c == L'"';
+		}
+	private:
+		enum class TokType { Word, String, Op, Comma, LParen, RParen, End };
+
+		struct Token {
+			TokType type{ TokType::End };
+			std::wstring text;
+			size_t pos{ 0 };
+		};
+
+		void next() {
+			while (m_pos < m_text.size() && std::iswspace(m_text[m_pos])) m_pos++;
+
+			m_tok = Token{};
+			m_tok.pos = m_pos;
+
+			if (m_pos == m_text.size()) return;
+
+			wchar_t c = m_text[m_pos];
+
+			if (c == L',') { m_tok.type = TokType::Comma; m_pos++; }
+			else if (c == L'(') { m_tok.type = TokType::LParen; m_pos++; }
+			else if (c == L')') { m_tok.type = TokType::RParen; m_pos++; }
+			else if (c == L'"') {
+				size_t end = m_text.find(L'"', m_pos + 1);
+				if (end == std::wstring::npos) fail("unterminated string");
+				m_tok.type = TokType::String;
+				m_tok.text = m_text.substr(m_pos + 1, end - m_pos - 1);
+				m_pos = end + 1;
+			}
+			else if (IsSpecial(c)) {
+				m_tok.type = TokType::Op;
+				m_tok.text = c;
+				m_pos++;
+				if (m_pos < m_text.size() && m_text[m_pos] == L'=' && (c == L'!' || c == L'<' || c == L'>')) {
+					m_tok.text += L'=';
+					m_pos++;
+				}
+			}
+			else {
+				m_tok.type = TokType::Word;
+				while (m_pos < m_text.size() && !std::iswspace(m_text[m_pos]) && !IsSpecial(m_text[m_pos])) {
+					m_tok.text += m_text[m_pos++];
+				}
+			}
+		}
+
+		bool keyword(const wchar_t* word) const {
+			return m_tok.type == TokType::Word && Lower(m_tok.text) == word;
+		}
+
+		[[noreturn]] void fail(const std::string& what) const {
+			throw QueryError(what, m_tok.pos);
+		}
+
+		void push() {
+			if (++m_depth > MaxDepth) fail("query is too complex");
+		}
+
+		void parse_or() {
+			parse_and();
+			while (keyword(L"or")) {
+				next();
+				size_t jump = m_query.emit(Op::OrJump);
+				m_depth--;
+				parse_and();
+				m_query.patch(jump);
+			}
+		}
+
+		void parse_and() {
+			parse_unary();
+			while (keyword(L"and")) {
+				next();
+				size_t jump = m_query.emit(Op::AndJump);
+				m_depth--;
+				parse_unary();
+				m_query.patch(jump);
+			}
+		}
+
+		void parse_unary() {
+			if (keyword(L"not")) {
+				next();
+				parse_unary();
+				m_query.emit(Op::Not);
+			}
+			else if (m_tok.type == TokType::LParen) {
+				next();
+				parse_or();
+				if (m_tok.type != TokType::RParen) fail("expected ')'");
+				next();
+			}
+			else {
+				parse_condition();
+			}
+		}
+
+		void parse_condition() {
+			if (m_tok.type != TokType::Word) fail("expected field name");
+
+			std::wstring name = Lower(m_tok.text);
+			size_t field_pos = m_tok.pos;
+			next();
+
+			std::vector<Field> fields = FieldsNamed(name);
+			if (fields.empty()) throw QueryError("unknown field", field_pos);
+
+			std::wstring op;
+			if (keyword(L"in")) op = L"in";
+			else if (m_tok.type == TokType::Op) op = m_tok.text;
+			else fail("expected operator");
+
+			size_t op_pos = m_tok.pos;
+			next();
+
+			std::vector<Token> values;
+			while (true) {
+				if (m_tok.type != TokType::Word && m_tok.type != TokType::String) fail("expected value");
+				values.push_back(m_tok);
+				next();
+
+				if (m_tok.type != TokType::Comma) break;
+				next();
+			}
+
+			bool negate = op == L"!=";
+			if (negate) op = L"=";
+
+			// port and addr test local field, then remote one
+			std::optional<size_t> jump;
+			for (size_t i = 0; i < fields.size(); i++) {
+				if (i) {
+					jump = m_query.emit(Op::OrJump);
+					m_depth--;
+				}
+				m_query.emit_test(make_test(fields[i], op, op_pos, values));
+				push();
+			}
+			if (jump) m_query.patch(*jump);
+
+			if (negate) {
+				m_query.emit(Op::Not);
+
+				// UDP rows have no remote fields, so they match neither the condition nor its negation
+				if (std::all_of(fields.begin(), fields.end(), IsRemote)) {
+					size_t tcp = m_query.emit(Op::AndJump);
+					m_depth--;
+					m_query.emit_test(TcpTest());
+					push();
+					m_query.patch(tcp);
+				}
+			}
+		}
+
+		static Test TcpTest() {
+			Test test{};
+			test.kind = Kind::Value;
+			test.field = Field::Proto;
+			test.values = 1u << (uint32_t)ConnectionProtocol::PROTO_TCP;
+			return test;
+		}
+
+		Test make_test(Field field, const std::wstring& op, size_t op_pos, const std::vector<Token>& values) const {
+			std::vector<std::wstring> needles;
+			for (const auto& v : values) needles.push_back(Lower(v.text));
+
+			if (op == L"~") return m_query.text_test(field, TextMode::Substring, std::move(needles));
+			if (op == L"^") return m_query.text_test(field, TextMode::Prefix, std::move(needles));
+
+			bool ordered = op == L"<" || op == L"<=" || op == L">" || op == L">=";
+			if (ordered && values.size() != 1) {
+				throw QueryError("expected single value", values[1].pos);
+			}
+			if (op != L"=" && op != L"in" && !ordered) {
+				throw QueryError("unknown operator", op_pos);
+			}
+
+			switch (field) {
+			case Field::Proc:
+			case Field::Path:
+				if (ordered) throw QueryError("operator does not apply to process name or path", op_pos);
+				return m_query.text_test(field, TextMode::Equal, std::move(needles));
+
+			case Field::Pid:
+			case Field::LocalPort:
+			case Field::RemotePort: {
+				const DWORD max = field == Field::Pid ? 0xffffffff : 0xffff;
+
+				std::vector<std::pair<DWORD, DWORD>> ranges;
+				for (const auto& v : values) {
+					if (ordered) ranges.push_back(ordered_range(op, number(v, max), max));
+					else ranges.push_back(range(v, max));
+				}
+
+				Test test{};
+				test.field = field;
+
+				if (field == Field::Pid) {
+					test.kind = Kind::Process;
+					test.pids = std::move(ranges);
+				}
+				else {
+					test.kind = Kind::Port;
+					test.ports.assign(65536 / 64, 0);
+					for (const auto& [first, last] : ranges) {
+						for (DWORD port = first; port <= last && port <= max; port++) {
+							test.ports[port >> 6] |= 1ull << (port & 63);
+						}
+					}
+				}
+				return test;
+			}
+
+			case Field::LocalAddr:
+			case Field::RemoteAddr: {
+				if (ordered) throw QueryError("operator does not apply to addresses", op_pos);
+
+				Test test{};
+				test.field = field;
+				test.kind = Kind::Address;
+				for (const auto& v : values) {
+					auto prefix = AddressPrefix::Parse(v.text);
+					if (!prefix) throw QueryError("expected address or address/bits", v.pos);
+					test.prefixes.push_back(*prefix);
+				}
+				return test;
+			}
+
+			default: {
+				if (ordered) throw QueryError("operator does not apply to this field", op_pos);
+
+				Test test{};
+				test.field = field;
+				test.kind = Kind::Value;
+
+				auto names = ValueNames(field);
+				for (size_t i = 0; i < values.size(); i++) {
+					std::wstring value = needles[i];
+					if (field == Field::Family && (value == L"4" || value == L"6")) value = L"ipv" + value;
+
+					uint32_t mask = 0;
+					for (const auto& [v, name] : names) {
+						// states are matched by prefix, e.g. state=time is TIME_WAIT
+						bool match = field == Field::State ? name.compare(0, value.size(), value) == 0 : name == value;
+						if (match) mask |= 1u << v;
+					}
+					if (!mask) throw QueryError("unknown value", values[i].pos);
+					test.values |= mask;
+				}
+				return test;
+			}
+			}
+		}
+
+		static DWORD number(const Token& tok, DWORD max) {
+			const auto& s = tok.text;
+			if (s.empty()) throw QueryError("expected number", tok.pos);
+
+			unsigned long long n = 0;
+			for (wchar_t c : s) {
+				if (c < L'0' || c > L'9') throw QueryError("expected number", tok.pos);
+				n = n * 10 + (c - L'0');
+				if (n > max) throw QueryError("number is too big", tok.pos);
+			}
+			return (DWORD)n;
+		}
+
+		// "n" or "first-last"
+		static std::pair<DWORD, DWORD> range(const Token& tok, DWORD max) {
+			size_t dash = tok.text.find(L'-');
+			if (dash == std::wstring::npos) {
+				DWORD n = number(tok, max);
+				return { n, n };
+			}
+
+			DWORD first = number(Token{ TokType::Word, tok.text.substr(0, dash), tok.pos }, max);
+			DWORD last = number(Token{ TokType::Word, tok.text.substr(dash + 1), tok.pos + dash + 1 }, max);
+			if (first > last) throw QueryError("empty range", tok.pos);
+			return { first, last };
+		}
+
+		// empty range is first > last
+		static std::pair<DWORD, DWORD> ordered_range(const std::wstring& op, DWORD n, DWORD max) {
+			if (op == L"<")  return n ? std::pair<DWORD, DWORD>{ 0, n - 1 } : std::pair<DWORD, DWORD>{ 1, 0 };
+			if (op == L"<=") return { 0, n };
+			if (op == L">")  return n < max ? std::pair<DWORD, DWORD>{ n + 1, max } : std::pair<DWORD, DWORD>{ 1, 0 };
+			return { n, max };
+		}
+
+		Query& m_query;
+		const std::wstring& m_text;
+		size_t m_pos{ 0 };
+		size_t m_depth{ 0 };
+		Token m_tok;
+	};
+
+	std::wstring m_text;
+	std::vector<Test> m_tests;
+	// postfix: tests push their result, Not and jumps work on the top
+	std::vector<Instr> m_program;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef REFRESH_SCHEDULER_HPP
+#define REFRESH_SCHEDULER_HPP
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+#include "ConnectionsRefresher.hpp"
+
+/*
+ * RefreshScheduler keeps connections refreshed continuously through ConnectionsRefresher,
+ * choosing the interval between refreshes on its own thread:
+ * - interval halves while refreshes find changes and grows by half while they find nothing (within min and max);
+ * - interval is never shorter than cost of refresh divided by CPU budget, e.g. refresh that takes 4ms of CPU
+ *   with 2% budget is not repeated sooner than every 200ms (but max interval is never exceeded).
+ *   Cost is CPU time of refresher's and manager's threads (see ConnectionsRefresher::Stats), smoothed over recent refreshes.
+ * When budget, not churn, decides the interval, scheduler is throttling: callback is called
+ * (on scheduler's thread) every time throttling starts or stops.
+ * wake() asks for a refresh before the interval ends (e.g. on a connection event), it still waits
+ * for the budget: wakes that come sooner than cost / budget after the last refresh are coalesced into one
+ */
+class RefreshScheduler {
+public:
+	using ThrottleCallback = std::function<void(bool throttling, std::chrono::milliseconds interval)>;
+
+	struct Options {
+		std::chrono::milliseconds min_interval{ 250 };
+		std::chrono::milliseconds max_interval{ std::chrono::seconds(10) };
+		// fraction of a single core
+		double cpu_budget{ 0.02 };
+	};
+
+	RefreshScheduler(ConnectionsRefresher& refresher, Options options, ThrottleCallback on_throttle)
+		: m_refresher(refresher), m_options(options), m_on_throttle(std::move(on_throttle))
+		, m_interval(options.min_interval), m_interval_ms(options.min_interval.count())
+	{
+	}
+
+	RefreshScheduler(const RefreshScheduler&) = delete;
+	RefreshScheduler(RefreshScheduler&&) = delete;
+
+	void start() {
+		if (m_thread.joinable()) return;
+
+		m_thread = std::jthread([this](std::stop_token st) {
+			schedule_loop(st);
+			});
+	}
+
+	void stop() {
+		if (!m_thread.joinable()) return;
+
+		m_thread.request_stop();
+		m_thread.join();
+	}
+
+	bool running() const { return m_thread.joinable(); }
+
+	// can be called from any thread
+	void wake() {
+		if (!m_woken.exchange(true)) {
+			std::scoped_lock<std::mutex> lck(m_mut);
+			m_cv.notify_one();
+		}
+	}
+
+	bool throttling() const { return m_throttling; }
+
+	std::chrono::milliseconds interval() const { return std::chrono::milliseconds(m_interval_ms.load()); }
+
+	~RefreshScheduler() { stop(); }
+private:
+	void schedule_loop(std::stop_token st) {
+		using namespace std::chrono;
+
+		std::unique_lock<std::mutex> lck(m_mut);
+
+		size_t last_completed = m_refresher.stats().completed;
+
+		m_refresher.request();
+		auto last_request = steady_clock::now();
+		// set while a refresh outlasts the interval, so that its passed deadline is not polled
+		auto busy_until = steady_clock::time_point::min();
+
+		while (!st.stop_requested()) {
+			// wait_until returns early when stop is requested or when woken
+			auto deadline = std::max(last_request + m_interval, busy_until);
+			bool woken = m_cv.wait_until(lck, st, deadline, [this]() { return m_woken.load(); });
+			if (st.stop_requested()) break;
+
+			auto stats = m_refresher.stats();
+
+			// refresh may still be running when interval is short, adapt only to completed ones
+			if (stats.completed != last_completed) {
+				last_completed = stats.completed;
+				adapt(stats);
+			}
+
+			if (woken) {
+				// wakes that come until then are covered by this refresh
+				m_cv.wait_until(lck, st, last_request + budget_floor(), []() { return false; });
+				if (st.stop_requested()) break;
+				m_woken = false;
+
+				// refresher cancels a running refresh and starts over, so the change is not missed
+				m_refresher.request();
+				last_request = steady_clock::now();
+				busy_until = steady_clock::time_point::min();
+			}
+			// do not cancel refresh that is still running, check again after another interval
+			else if (m_refresher.idle()) {
+				m_refresher.request();
+				last_request = steady_clock::now();
+				busy_until = steady_clock::time_point::min();
+			}
+			else {
+				busy_until = steady_clock::now() + m_interval;
+			}
+		}
+	}
+
+	// cost / budget, but never longer than max interval, so that one expensive refresh does not stop refreshing
+	std::chrono::milliseconds budget_floor() const {
+		using namespace std::chrono;
+		auto by_budget = duration_cast<milliseconds>(duration<double, std::micro>(m_cost.count() / m_options.cpu_budget));
+		return std::min(by_budget, m_options.max_interval);
+	}
+
+	void adapt(const ConnectionsRefresher::Stats& stats) {
+		using namespace std::chrono;
+
+		m_cost = m_cost.count() ? (m_cost * 3 + stats.cpu) / 4 : stats.cpu;
+
+		milliseconds by_churn = stats.churn ? m_interval / 2 : m_interval * 3 / 2;
+		by_churn = std::clamp(by_churn, m_options.min_interval, m_options.max_interval);
+
+		milliseconds by_budget = budget_floor();
+
+		bool throttling = by_budget > by_churn;
+
+		m_interval = std::max(by_churn, by_budget);
+		m_interval_ms = m_interval.count();
+
+		if (throttling != m_throttling) {
+			m_throttling = throttling;
+			if (m_on_throttle) m_on_throttle(throttling, m_interval);
+		}
+	}
+
+	ConnectionsRefresher& m_refresher;
+	Options m_options;
+	ThrottleCallback m_on_throttle;
+
+	std::chrono::milliseconds m_interval;
+	std::chrono::microseconds m_cost{ 0 };
+	std::atomic<long long> m_interval_ms{ 0 };
+	std::atomic<bool> m_throttling{ false };
+
+	std::mutex m_mut;
+	std::condition_variable_any m_cv;
+	std::atomic<bool> m_woken{ false };
+
+	std::jthread m_thread;
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef ROARING_BITMAP_HPP
+#define ROARING_BITMAP_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <bit>
+
+#include "Bitmap.hpp"
+
+/*
+ * Compressed bitmap of 32-bit ids, split into chunks of 65536 by the high 16 bits.
+ * Chunk with at most 4096 ids is a sorted array of low halves, a fuller one is a 8 KB bitmap,
+ * so that sparse sets (rows of one PID or port) stay small and dense ones (all TCP rows) are plain words.
+ * Bitmap chunk that loses ids becomes an array again only well below 4096 (DenseMin), so that a set whose size
+ * moves around the limit with every refresh is not converted back and forth.
+ * AND, OR and AND NOT work chunk by chunk, bitmap chunks word by word, and counting uses popcount
+ */
+class RoaringBitmap {
+public:
+	RoaringBitmap() {}
+
+	void add(uint32_t x) {
+		Chunk& chunk = chunk_for(High(x));
+		uint16_t low = Low(x);
+
+		if (chunk.dense()) {
+			uint64_t& word = chunk.bits[low >> 6];
+			uint64_t bit = 1ull << (low & 63);
+			if (!(word & bit)) {
+				word |= bit;
+				chunk.count++;
+			}
+			return;
+		}
+
+		auto it = std::lower_bound(chunk.array.begin(), chunk.array.end(), low);
+		if (it != chunk.array.end() && *it == low) return;
+
+		chunk.array.insert(it, low);
+		chunk.count++;
+
+		if (chunk.count > ArrayMax) chunk.to_dense();
+	}
+
+	void remove(uint32_t x) {
+		auto it = find_chunk(High(x));
+		if (it == m_chunks.end()) return;
+
+		Chunk& chunk = *it;
+		uint16_t low = Low(x);
+
+		if (chunk.dense()) {
+			uint64_t& word = chunk.bits[low >> 6];
+			uint64_t bit = 1ull << (low & 63);
+			if (!(word & bit)) return;
+			word &= ~bit;
+			chunk.count--;
+			if (chunk.count < DenseMin) chunk.to_array();
+		}
+		else {
+			auto pos = std::lower_bound(chunk.array.begin(), chunk.array.end(), low);
+			if (pos == chunk.array.end() || *pos != low) return;
+			chunk.array.erase(pos);
+			chunk.count--;
+		}
+
+		if (!chunk.count) m_chunks.erase(it);
+	}
+
+	bool contains(uint32_t x) const {
+		auto it = find_chunk(High(x));
+		if (it == m_chunks.end()) return false;
+
+		uint16_t low = Low(x);
+		if (it->dense()) return (it->bits[low >> 6] >> (low & 63)) & 1;
+		return std::binary_search(it->array.begin(), it->array.end(), low);
+	}
+
+	size_t count() const {
+		size_t n = 0;
+		for (const auto& chunk : m_chunks) n += chunk.count;
+		return n;
+	}
+
+	bool empty() const { return m_chunks.empty(); }
+
+	// calls f with every id, in increasing order
+	template<typename Func>
+	void for_each(Func f) const {
+		for (const auto& chunk : m_chunks) {
+			const uint32_t base = (uint32_t)chunk.key << 16;
+			if (chunk.dense()) {
+				for (size_t w = 0; w < WordsPerChunk; w++) {
+					for (uint64_t word = chunk.bits[w]; word; word &= word - 1) {
+						f(base | (uint32_t)(w * 64 + std::countr_zero(word)));
+					}
+				}
+			}
+			else {
+				for (uint16_t low : chunk.array) f(base | low);
+			}
+		}
+	}
+
+	// dense copy with `size` bits, ids from size on are dropped
+	Bitmap to_bitmap(size_t size) const {
+		Bitmap out(size);
+		auto& words = out.words();
+
+		for (const auto& chunk : m_chunks) {
+			const size_t first_word = (size_t)chunk.key * WordsPerChunk;
+			if (first_word >= words.size()) break;
+
+			if (chunk.dense()) {
+				size_t n = std::min(WordsPerChunk, words.size() - first_word);
+				std::copy(chunk.bits.begin(), chunk.bits.begin() + n, words.begin() + first_word);
+			}
+			else {
+				for (uint16_t low : chunk.array) {
+					size_t x = ((size_t)chunk.key << 16) | low;
+					if (x < size) out.set(x);
+				}
+			}
+		}
+
+		if (size & 63) words.back() &= (1ull << (size & 63)) - 1;
+		return out;
+	}
+
+	RoaringBitmap& operator&=(const RoaringBitmap& other) { return *this = And(*this, other); }
+
+	RoaringBitmap& operator|=(const RoaringBitmap& other) { return *this = Or(*this, other); }
+
+	static RoaringBitmap And(const RoaringBitmap& a, const RoaringBitmap& b) {
+		RoaringBitmap out;
+		auto i = a.m_chunks.begin(), j = b.m_chunks.begin();
+
+		while (i != a.m_chunks.end() && j != b.m_chunks.end()) {
+			if (i->key < j->key) { i++; continue; }
+			if (j->key < i->key) { j++; continue; }
+
+			Chunk chunk = Combine(*i, *j, Op::And);
+			if (chunk.count) out.m_chunks.push_back(std::move(chunk));
+			i++, j++;
+		}
+
+		return out;
+	}
+
+	static RoaringBitmap Or(const RoaringBitmap& a, const RoaringBitmap& b) {
+		RoaringBitmap out;
+		auto i = a.m_chunks.begin(), j = b.m_chunks.begin();
+
+		while (i != a.m_chunks.end() || j != b.m_chunks.end()) {
+			if (j == b.m_chunks.end() || (i != a.m_chunks.end() && i->key < j->key)) { out.m_chunks.push_back(*i++); continue; }
+			if (i == a.m_chunks.end() || j->key < i->key) { out.m_chunks.push_back(*j++); continue; }
+
+			out.m_chunks.push_back(Combine(*i, *j, Op::Or));
+			i++, j++;
+		}
+
+		return out;
+	}
+
+	// ids of a that are not in b
+	static RoaringBitmap AndNot(const RoaringBitmap& a, const RoaringBitmap& b) {
+		RoaringBitmap out;
+		auto j = b.m_chunks.begin();
+
+		for (const auto& chunk : a.m_chunks) {
+			while (j != b.m_chunks.end() && j->key < chunk.key) j++;
+
+			if (j == b.m_chunks.end() || j->key != chunk.key) {
+				out.m_chunks.push_back(chunk);
+				continue;
+			}
+
+			Chunk diff = Combine(chunk, *j, Op::AndNot);
+			if (diff.count) out.m_chunks.push_back(std::move(diff));
+		}
+
+		return out;
+	}
+
+	// count of And(a, b) without building it
+	static size_t AndCount(const RoaringBitmap& a, const RoaringBitmap& b) {
+		size_t n = 0;
+		auto i = a.m_chunks.begin(), j = b.m_chunks.begin();
+
+		while (i != a.m_chunks.end() && j != b.m_chunks.end()) {
+			if (i->key < j->key) { i++; continue; }
+			if (j->key < i->key) { j++; continue; }
+
+			if (i->dense() && j->dense()) {
+				for (size_t w = 0; w < WordsPerChunk; w++) n += std::popcount(i->bits[w] & j->bits[w]);
+			}
+			else {
+				const Chunk& array = i->dense() ? *j : *i;
+				const Chunk& other = i->dense() ? *i : *j;
+				for (uint16_t low : array.array) n += other.test(low) ? 1 : 0;
+			}
+			i++, j++;
+		}
+
+		return n;
+	}
+
+	// same ids, whichever containers hold them
+	bool operator==(const RoaringBitmap& other) const = default;
+
+	static constexpr size_t ArrayMax = 4096;
+	// bitmap chunk is converted to an array when it has fewer ids
+	static constexpr size_t DenseMin = ArrayMax - ArrayMax / 8;
+private:
+	static constexpr size_t WordsPerChunk = 65536 / 64;
+
+	enum class Op { And, Or, AndNot };
+
+	struct Chunk {
+		uint16_t key{ 0 };
+		uint32_t count{ 0 };
+		// sorted low halves while count <= ArrayMax, otherwise empty and bits are used.
+		// Chunk that became a bitmap stays one while count >= DenseMin
+		std::vector<uint16_t> array;
+		std::vector<uint64_t> bits;
+
+		bool dense() const { return !bits.empty(); }
+
+		bool test(uint16_t low) const {
+			if (dense()) return (bits[low >> 6] >> (low & 63)) & 1;
+			return std::binary_search(array.begin(), array.end(), low);
+		}
+
+		void to_dense() {
+			bits.assign(WordsPerChunk, 0);
+			for (uint16_t low : array) bits[low >> 6] |= 1ull << (low & 63);
+			array = {};
+		}
+
+		void to_array() {
+			array.clear();
+			array.reserve(count);
+			for (size_t w = 0; w < WordsPerChunk; w++) {
+				for (uint64_t word = bits[w]; word; word &= word - 1) {
+					array.push_back((uint16_t)(w * 64 + std::countr_zero(word)));
+				}
+			}
+			bits = {};
+		}
+
+		bool operator==(const Chunk& other) const {
+			if (key != other.key || count != other.count) return false;
+			if (dense() == other.dense()) return array == other.array && bits == other.bits;
+
+			// bitmap kept below ArrayMax by removals, counts are equal so ids of the array are enough
+			const Chunk& sparse = dense() ? other : *this;
+			const Chunk& full = dense() ? *this : other;
+			return std::all_of(sparse.array.begin(), sparse.array.end(), [&full](uint16_t low) { return full.test(low); });
+		}
+	};
+
+	static uint16_t High(uint32_t x) { return (uint16_t)(x >> 16); }
+	static uint16_t Low(uint32_t x) { return (uint16_t)x; }
+
+	// chunks of the same key
+	static Chunk Combine(const Chunk& a, const Chunk& b, Op op) {
+		Chunk out;
+		out.key = a.key;
+
+		if (a.dense() || b.dense()) {
+			if (op == Op::And && (!a.dense() || !b.dense())) {
+				// array AND bitmap is at most the array
+				const Chunk& array = a.dense() ? b : a;
+				const Chunk& other = a.dense() ? a : b;
+				for (uint16_t low : array.array) {
+					if (other.test(low)) out.array.push_back(low);
+				}
+				out.count = (uint32_t)out.array.size();
+				return out;
+			}
+
+			Chunk da = a, db = b;
+			if (!da.dense()) da.to_dense();
+			if (!db.dense()) db.to_dense();
+
+			out.bits.resize(WordsPerChunk);
+			for (size_t w = 0; w < WordsPerChunk; w++) {
+				uint64_t word;
+				switch (op) {
+				case Op::And:    word = da.bits[w] & db.bits[w]; break;
+				case Op::Or:     word = da.bits[w] | db.bits[w]; break;
+				default:         word = da.bits[w] & ~db.bits[w]; break;
+				}
+				out.bits[w] = word;
+				out.count += std::popcount(word);
+			}
+
+			if (out.count <= ArrayMax) out.to_array();
+			return out;
+		}
+
+		switch (op) {
+		case Op::And:
+			std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(out.array));
+			break;
+		case Op::Or:
+			std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(out.array));
+			break;
+		case Op::AndNot:
+			std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(out.array));
+			break;
+		}
+		out.count = (uint32_t)out.array.size();
+
+		if (out.count > ArrayMax) out.to_dense();
+		return out;
+	}
+
+	Chunk& chunk_for(uint16_t key) {
+		auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), key, [](const Chunk& c, uint16_t k) { return c.key < k; });
+		if (it == m_chunks.end() || it->key != key) {
+			it = m_chunks.insert(it, Chunk{});
+			it->key = key;
+		}
+		return *it;
+	}
+
+	std::vector<Chunk>::iterator find_chunk(uint16_t key) {
+		auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), key, [](const Chunk& c, uint16_t k) { return c.key < k; });
+		return it != m_chunks.end() && it->key == key ? it : m_chunks.end();
+	}
+
+	std::vector<Chunk>::const_iterator find_chunk(uint16_t key) const {
+		auto it = std::lower_bound(m_chunks.begin(), m_chunks.end(), key, [](const Chunk& c, uint16_t k) { return c.key < k; });
+		return it != m_chunks.end() && it->key == key ? it : m_chunks.end();
+	}
+
+	// sorted by key, none is empty
+	std::vector<Chunk> m_chunks;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef ROW_INDEXES_HPP
+#define ROW_INDEXES_HPP
+
+#include <vector>
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+#include "ConnectionEntry.hpp"
+#include "RoaringBitmap.hpp"
+
+/*
+ * Secondary indexes of rows: for every protocol, address family, TCP state, PID and well-known remote port
+ * a RoaringBitmap of ids of rows that have it. Indexes are updated row by row from refresh deltas,
+ * so that view filters, status bar counts and drill-downs such as "ESTAB TCP over IPv6 owned by PID 4312"
+ * are AND / popcount of a few bitmaps instead of a scan of all rows.
+ * add() gives the row its id (ConnectionEntry::row_id), copies of the row keep it, ids of removed rows are reused
+ */
+class RowIndexes {
+public:
+	using RowId = uint32_t;
+
+	// remote ports below this have their own bitmap
+	static constexpr DWORD WellKnownPorts = 1024;
+
+	// Rows that match every condition that is set
+	struct Selection {
+		std::optional<ConnectionProtocol> protocol;
+		std::optional<ProtocolFamily> family;
+		// bit (1 << state) of every accepted TCP state, 0 is any; when set, only TCP rows match
+		uint32_t states{ 0 };
+		std::optional<DWORD> pid;
+		// below WellKnownPorts
+		std::optional<DWORD> remote_port;
+	};
+
+	void add(ConnectionEntry& row) {
+		RowId id = allocate();
+		row.set_row_id(id);
+
+		Attrs& attrs = m_attrs[id];
+		attrs.proto = row.protocol();
+		attrs.af = row.address_family();
+		attrs.pid = row.pid();
+
+		if (row.protocol() == ConnectionProtocol::PROTO_TCP) {
+			attrs.state = row.state();
+			attrs.remote_port = row.remote_port();
+		}
+
+		m_all.add(id);
+		m_protocols[ProtocolSlot(attrs.proto)].add(id);
+		m_families[FamilySlot(attrs.af)].add(id);
+		m_pids[attrs.pid].add(id);
+
+		if (attrs.proto == ConnectionProtocol::PROTO_TCP) {
+			state_bitmap(attrs.state).add(id);
+			if (attrs.remote_port < WellKnownPorts) m_remote_ports[attrs.remote_port].add(id);
+		}
+	}
+
+	void remove(const ConnectionEntry& row) {
+		RowId id = row.row_id();
+		if (id >= m_attrs.size() || !m_all.contains(id)) return;
+
+		const Attrs& attrs = m_attrs[id];
+
+		m_all.remove(id);
+		m_protocols[ProtocolSlot(attrs.proto)].remove(id);
+		m_families[FamilySlot(attrs.af)].remove(id);
+		Erase(m_pids, attrs.pid, id);
+
+		if (attrs.proto == ConnectionProtocol::PROTO_TCP) {
+			state_bitmap(attrs.state).remove(id);
+			if (attrs.remote_port < WellKnownPorts) Erase(m_remote_ports, attrs.remote_port, id);
+		}
+
+		m_attrs[id] = Attrs{};
+		m_free.push_back(id);
+	}
+
+	// row is a copy of an indexed TCP row with a new state
+	void change_state(const ConnectionEntry& row) {
+		RowId id = row.row_id();
+		if (id >= m_attrs.size() || row.protocol() != ConnectionProtocol::PROTO_TCP) return;
+
+		Attrs& attrs = m_attrs[id];
+		DWORD state = row.state();
+		if (state == attrs.state) return;
+
+		state_bitmap(attrs.state).remove(id);
+		attrs.state = state;
+		state_bitmap(attrs.state).add(id);
+	}
+
+	// every id is less than capacity
+	size_t capacity() const { return m_attrs.size(); }
+
+	const RoaringBitmap& all() const { return m_all; }
+
+	const RoaringBitmap& protocol(ConnectionProtocol proto) const { return m_protocols[ProtocolSlot(proto)]; }
+
+	const RoaringBitmap& family(ProtocolFamily af) const { return m_families[FamilySlot(af)]; }
+
+	const RoaringBitmap& state(DWORD state) const { return m_states[state < m_states.size() ? state : 0]; }
+
+	const RoaringBitmap& pid(DWORD pid) const { return Find(m_pids, pid); }
+
+	const RoaringBitmap& remote_port(DWORD port) const { return Find(m_remote_ports, port); }
+
+	RoaringBitmap select(const Selection& selection) const {
+		auto sets = bitmaps_of(selection);
+		if (sets.empty()) return m_all;
+
+		RoaringBitmap out = sets[0].size() == 1 ? *sets[0][0] : Union(sets[0]);
+		for (size_t i = 1; i < sets.size() && !out.empty(); i++) {
+			out &= sets[i].size() == 1 ? *sets[i][0] : Union(sets[i]);
+		}
+		return out;
+	}
+
+	// number of rows select() would return, two plain conditions are counted without building their AND
+	size_t count(const Selection& selection) const {
+		auto sets = bitmaps_of(selection);
+		if (sets.empty()) return m_all.count();
+		if (sets.size() == 1 && sets[0].size() == 1) return sets[0][0]->count();
+		if (sets.size() == 2 && sets[0].size() == 1 && sets[1].size() == 1) {
+			return RoaringBitmap::AndCount(*sets[0][0], *sets[1][0]);
+		}
+		return select(selection).count();
+	}
+private:
+	struct Attrs {
+		ConnectionProtocol proto{ ConnectionProtocol::UNSET };
+		ProtocolFamily af{ ProtocolFamily::UNSET };
+		DWORD state{ 0 };
+		DWORD pid{ 0 };
+		DWORD remote_port{ 0 };
+	};
+
+	static size_t ProtocolSlot(ConnectionProtocol proto) { return proto == ConnectionProtocol::PROTO_TCP ? 0 : 1; }
+
+	static size_t FamilySlot(ProtocolFamily af) { return af == ProtocolFamily::INET ? 0 : 1; }
+
+	static void Erase(std::unordered_map<DWORD, RoaringBitmap>& map, DWORD key, RowId id) {
+		auto it = map.find(key);
+		if (it == map.end()) return;
+		it->second.remove(id);
+		if (it->second.empty()) map.erase(it);
+	}
+
+	const RoaringBitmap& Find(const std::unordered_map<DWORD, RoaringBitmap>& map, DWORD key) const {
+		auto it = map.find(key);
+		return it == map.end() ? m_empty : it->second;
+	}
+
+	static RoaringBitmap Union(const std::vector<const RoaringBitmap*>& sets) {
+		RoaringBitmap out;
+		for (auto set : sets) out |= *set;
+		return out;
+	}
+
+	// bitmaps of every condition, a row matches a condition if it is in any of its bitmaps
+	std::vector<std::vector<const RoaringBitmap*>> bitmaps_of(const Selection& selection) const {
+		std::vector<std::vector<const RoaringBitmap*>> sets;
+
+		if (selection.protocol) sets.push_back({ &protocol(*selection.protocol) });
+		if (selection.family) sets.push_back({ &family(*selection.family) });
+		if (selection.pid) sets.push_back({ &pid(*selection.pid) });
+		if (selection.remote_port) sets.push_back({ &remote_port(*selection.remote_port) });
+
+		if (selection.states) {
+			std::vector<const RoaringBitmap*> states;
+			for (DWORD s = 1; s < m_states.size(); s++) {
+				if (selection.states & (1u << s)) states.push_back(&m_states[s]);
+			}
+			sets.push_back(std::move(states));
+		}
+
+		// the smallest first, so that AND shrinks as early as possible
+		auto weight = [](const std::vector<const RoaringBitmap*>& set) {
+			return std::pair<size_t, size_t>(set.size(), set.size() == 1 ? set[0]->count() : 0);
+		};
+		std::sort(sets.begin(), sets.end(), [&weight](const auto& a, const auto& b) { return weight(a) < weight(b); });
+
+		return sets;
+	}
+
+	RoaringBitmap& state_bitmap(DWORD state) { return m_states[state < m_states.size() ? state : 0]; }
+
+	RowId allocate() {
+		if (!m_free.empty()) {
+			RowId id = m_free.back();
+			m_free.pop_back();
+			return id;
+		}
+		m_attrs.emplace_back();
+		return (RowId)(m_attrs.size() - 1);
+	}
+
+	std::vector<Attrs> m_attrs;
+	std::vector<RowId> m_free;
+
+	RoaringBitmap m_all;
+	std::array<RoaringBitmap, 2> m_protocols;
+	std::array<RoaringBitmap, 2> m_families;
+	// index is MIB_TCP_STATE_*, 0 holds rows with an unknown state
+	std::array<RoaringBitmap, MIB_TCP_STATE_DELETE_TCB + 1> m_states;
+	std::unordered_map<DWORD, RoaringBitmap> m_pids;
+	std::unordered_map<DWORD, RoaringBitmap> m_remote_ports;
+	RoaringBitmap m_empty;
+};
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef SORT_KEYS_HPP
+#define SORT_KEYS_HPP
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <latch>
+#include <exception>
+#include <type_traits>
+
+#include "ConnectionsSnapshot.hpp"
+#include "Column.hpp"
+#include "Columns.hpp"
+#include "ThreadPool.hpp"
+
+/*
+ * Sorting is done on fixed-width numeric keys, precomputed once per row, instead of comparing formatted strings.
+ * Keys come from the column's Columns::Descriptor. Integer keys are sorted with LSD radix sort,
+ * address keys (Columns::AddressKey) are compared.
+ * All sorts are stable. Descending order inverts keys, so equal rows keep their relative order in both directions
+ */
+namespace SortKeys {
+	// Stable LSD radix sort of `order` by `keys` (keys[i] belongs to order[i]), 8 bits per pass.
+	// Passes in which every key has the same digit are skipped, so narrow columns (protocol, state, ports) take 1-2 passes
+	inline void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& order) {
+		constexpr int digits = sizeof(uint64_t);
+		constexpr int radix = 256;
+		const size_t n = keys.size();
+
+		if (n < 2) return;
+
+		std::vector<std::array<size_t, radix>> counts(digits);
+		for (auto& c : counts) c.fill(0);
+
+		for (uint64_t k : keys) {
+			for (int d = 0; d < digits; d++) {
+				counts[d][(k >> (d * 8)) & 0xff]++;
+			}
+		}
+
+		std::vector<uint64_t> keys_tmp(n);
+		std::vector<uint32_t> order_tmp(n);
+
+		for (int d = 0; d < digits; d++) {
+			auto& c = counts[d];
+
+			// all keys share this digit, pass would not change anything
+			if (std::find(c.begin(), c.end(), n) != c.end()) continue;
+
+			size_t offset = 0;
+			for (auto& bucket : c) {
+				size_t cnt = bucket;
+				bucket = offset;
+				offset += cnt;
+			}
+
+			for (size_t i = 0; i < n; i++) {
+				size_t pos = c[(keys[i] >> (d * 8)) & 0xff]++;
+				keys_tmp[pos] = keys[i];
+				order_tmp[pos] = order[i];
+			}
+
+			keys.swap(keys_tmp);
+			order.swap(order_tmp);
+		}
+	}
+
+	// Rank of every process by name, equal names get equal rank. Names are compared only once per distinct process
+	inline std::vector<uint32_t> ProcessNameRanks(const ConnectionsSnapshot& snap) {
+		std::vector<uint32_t> by_name(snap.processes.size());
+		std::iota(by_name.begin(), by_name.end(), 0);
+
+		std::sort(by_name.begin(), by_name.end(), [&snap](uint32_t a, uint32_t b) {
+			return snap.processes[a]->m_name < snap.processes[b]->m_name;
+			});
+
+		std::vector<uint32_t> ranks(snap.processes.size());
+		uint32_t rank = 0;
+		for (size_t i = 0; i < by_name.size(); i++) {
+			if (i && snap.processes[by_name[i - 1]]->m_name != snap.processes[by_name[i]]->m_name) {
+				rank++;
+			}
+			ranks[by_name[i]] = rank;
+		}
+
+		return ranks;
+	}
+
+	// Precomputed keys of every snapshot row for a single column and direction
+	class RowKeys {
+	public:
+		RowKeys(const ConnectionsSnapshot& snap, SortBy sort_by, bool asc_order = true) {
+			Columns::Visit(sort_by, [this, &snap, asc_order](auto column) {
+				fill<decltype(column)>(snap, asc_order);
+				});
+		}
+
+		// strict weak order of rows a and b, equal keys are not ordered by index
+		bool less(uint32_t a, uint32_t b) const {
+			if (!m_address) {
+				return m_int_keys[a] < m_int_keys[b];
+			}
+
+			return m_addr_keys[a] < m_addr_keys[b];
+		}
+
+		// Stable sort of subset of rows. Existing order is exploited first: rows that are already sorted cost a single pass,
+		// and a few sorted runs (e.g. tables that come presorted by local address and port) are k-way merged in linear time.
+		// Large unordered sequences are sorted in chunks on pool's workers, so pool must not be the one sort is called from
+		void sort(std::vector<uint32_t>& rows, ThreadPool* pool = nullptr) const {
+			if (rows.size() < 2) return;
+
+			std::vector<size_t> runs = find_runs(rows);
+
+			if (runs.size() == 2) {
+				return; // single run, already sorted
+			}
+
+			if (runs.size() - 1 <= MaxMergedRuns) {
+				merge_runs(rows, runs);
+				return;
+			}
+
+			if (pool && pool->size() > 1 && rows.size() >= ParallelThreshold) {
+				parallel_sort(rows, *pool);
+				return;
+			}
+
+			sort_unordered(rows);
+		}
+	private:
+		// more runs than that means there is little order to exploit, so rows are sorted from scratch
+		static constexpr size_t MaxMergedRuns = 16;
+		// below that, handing chunks over to workers costs more than it saves
+		static constexpr size_t ParallelThreshold = 1 << 16;
+
+		// keys of every row from column descriptor D
+		template<typename D>
+		void fill(const ConnectionsSnapshot& snap, bool asc_order) {
+			const size_t n = snap.size();
+
+			std::vector<uint32_t> name_ranks;
+			if constexpr (D::ByName) {
+				name_ranks = ProcessNameRanks(snap);
+			}
+
+			if constexpr (std::is_same_v<typename D::KeyT, Columns::AddressKey>) {
+				m_address = true;
+				m_addr_keys.resize(n);
+				for (size_t i = 0; i < n; i++) {
+					auto k = D::Key(snap, name_ranks, i);
+					m_addr_keys[i] = asc_order ? k : k.inverted();
+				}
+			}
+			else {
+				static_assert(std::is_same_v<typename D::KeyT, uint64_t>, "sort key is either an integer or an address");
+				m_int_keys.resize(n);
+				for (size_t i = 0; i < n; i++) {
+					uint64_t k = D::Key(snap, name_ranks, i);
+					m_int_keys[i] = asc_order ? k : ~k;
+				}
+			}
+		}
+
+		void sort_unordered(std::vector<uint32_t>& rows) const {
+			if (m_address) {
+				std::stable_sort(rows.begin(), rows.end(), [this](uint32_t a, uint32_t b) { return less(a, b); });
+				return;
+			}
+
+			std::vector<uint64_t> keys(rows.size());
+			for (size_t i = 0; i < rows.size(); i++) {
+				keys[i] = m_int_keys[rows[i]];
+			}
+
+			RadixSort(keys, rows);
+		}
+
+		// Every worker sorts its own contiguous chunk, then chunks are k-way merged as sorted runs.
+		// Chunks keep the original order of rows, so the result is as stable as the single-threaded sort
+		void parallel_sort(std::vector<uint32_t>& rows, ThreadPool& pool) const {
+			const size_t chunks = std::min<size_t>(pool.size(), MaxMergedRuns);
+
+			std::vector<size_t> bounds(chunks + 1);
+			for (size_t c = 0; c <= chunks; c++) {
+				bounds[c] = rows.size() * c / chunks;
+			}
+
+			std::vector<std::exception_ptr> errors(chunks);
+			std::latch done((std::ptrdiff_t)chunks);
+
+			for (size_t c = 0; c < chunks; c++) {
+				pool.submit([this, &rows, &bounds, &errors, &done, c]() {
+					try {
+						std::vector<uint32_t> part(rows.begin() + bounds[c], rows.begin() + bounds[c + 1]);
+						sort_unordered(part);
+						std::copy(part.begin(), part.end(), rows.begin() + bounds[c]);
+					}
+					catch (...) {
+						errors[c] = std::current_exception();
+					}
+					done.count_down();
+					});
+			}
+
+			done.wait();
+
+			for (const auto& error : errors) {
+				if (error) std::rethrow_exception(error);
+			}
+
+			merge_runs(rows, bounds);
+		}
+
+		// Splits rows into non-descending runs, returns run boundaries (first is 0, last is rows.size()).
+		// Strictly descending runs are reversed in place, which does not break stability as they have no equal keys
+		std::vector<size_t> find_runs(std::vector<uint32_t>& rows) const {
+			std::vector<size_t> runs{ 0 };
+			const size_t n = rows.size();
+
+			for (size_t i = 0; i < n && runs.size() <= MaxMergedRuns + 1;) {
+				size_t j = i + 1;
+
+				if (j < n && less(rows[j], rows[i])) {
+					while (j < n && less(rows[j], rows[j - 1])) j++;
+					std::reverse(rows.begin() + i, rows.begin() + j);
+				}
+				else {
+					while (j < n && !less(rows[j], rows[j - 1])) j++;
+				}
+
+				runs.push_back(j);
+				i = j;
+			}
+
+			if (runs.back() != n) {
+				runs.push_back(n); // too many runs, scanning stopped early
+			}
+
+			return runs;
+		}
+
+		// K-way merge of sorted runs. On equal keys the run that comes first wins, so merge is stable
+		void merge_runs(std::vector<uint32_t>& rows, const std::vector<size_t>& runs) const {
+			struct Head {
+				size_t pos;
+				size_t end;
+			};
+
+			std::vector<Head> heads;
+			for (size_t r = 0; r + 1 < runs.size(); r++) {
+				heads.push_back({ runs[r], runs[r + 1] });
+			}
+
+			// heap of run indices, min key on top, ties broken by run index
+			auto after = [this, &rows, &heads](size_t a, size_t b) {
+				uint32_t ra = rows[heads[a].pos];
+				uint32_t rb = rows[heads[b].pos];
+				if (less(rb, ra)) return true;
+				if (less(ra, rb)) return false;
+				return a > b;
+			};
+
+			std::vector<size_t> heap(heads.size());
+			std::iota(heap.begin(), heap.end(), 0);
+			std::make_heap(heap.begin(), heap.end(), after);
+
+			std::vector<uint32_t> merged;
+			merged.reserve(rows.size());
+
+			while (!heap.empty()) {
+				std::pop_heap(heap.begin(), heap.end(), after);
+				size_t r = heap.back();
+
+				merged.push_back(rows[heads[r].pos++]);
+
+				if (heads[r].pos == heads[r].end) {
+					heap.pop_back();
+				}
+				else {
+					std::push_heap(heap.begin(), heap.end(), after);
+				}
+			}
+
+			rows.swap(merged);
+		}
+
+		bool m_address{ false };
+		std::vector<uint64_t> m_int_keys;
+		std::vector<Columns::AddressKey> m_addr_keys;
+	};
+
+	// Order of rows that is materialized only as far as it was asked for.
+	// Positions [0, sorted()) are final, the rest is only partitioned: every row there goes after every sorted row.
+	// Equal keys are ordered by row index, so the result is the same as of the stable sort
+	class PartialOrder {
+	public:
+		PartialOrder(const ConnectionsSnapshot& snap, SortBy sort_by, bool asc_order)
+			: m_keys(snap, sort_by, asc_order), m_order(snap.size()), m_sort_by(sort_by), m_asc(asc_order)
+		{
+			std::iota(m_order.begin(), m_order.end(), 0);
+		}
+
+		// only given rows of snapshot are ordered
+		PartialOrder(const ConnectionsSnapshot& snap, std::vector<uint32_t> rows, SortBy sort_by, bool asc_order)
+			: m_keys(snap, sort_by, asc_order), m_order(std::move(rows)), m_sort_by(sort_by), m_asc(asc_order)
+		{
+		}
+
+		// Makes positions [0, last) final. Sorted range at least doubles on every extension,
+		// so scrolling down costs amortized linear time instead of partitioning on every step
+		void extend(size_t last) {
+			last = std::min(last, m_order.size());
+			if (last <= m_sorted) return;
+
+			size_t target = std::min(m_order.size(), std::max(last, m_sorted * 2));
+
+			auto cmp = [this](uint32_t a, uint32_t b) {
+				if (m_keys.less(a, b)) return true;
+				if (m_keys.less(b, a)) return false;
+				return a < b;
+			};
+
+			auto beg = m_order.begin() + m_sorted;
+			auto mid = m_order.begin() + target;
+
+			if (mid != m_order.end()) {
+				std::nth_element(beg, mid, m_order.end(), cmp);
+			}
+			std::sort(beg, mid, cmp);
+
+			m_sorted = target;
+		}
+
+		const std::vector<uint32_t>& order() const { return m_order; }
+
+		size_t sorted() const { return m_sorted; }
+
+		bool sorted_by(SortBy sort_by, bool asc_order) const { return m_sort_by == sort_by && m_asc == asc_order; }
+	private:
+		RowKeys m_keys;
+		std::vector<uint32_t> m_order;
+		size_t m_sorted{ 0 };
+		SortBy m_sort_by;
+		bool m_asc;
+	};
+
+	// Returns permutation of snapshot rows: order[k] is index of the row that goes to position k
+	inline std::vector<uint32_t> MakeSortOrder(const ConnectionsSnapshot& snap, SortBy sort_by, bool asc_order = true, ThreadPool* pool = nullptr) {
+		std::vector<uint32_t> order(snap.size());
+		std::iota(order.begin(), order.end(), 0);
+
+		RowKeys(snap, sort_by, asc_order).sort(order, pool);
+
+		return order;
+	}
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SORT_VIEW_HPP
+#define SORT_VIEW_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "ConnectionsSnapshot.hpp"
+#include "SortKeys.hpp"
+
+/*
+ * SortView is an ordering of an immutable snapshot: position k of the view shows snapshot row order[k].
+ * Rows are never moved, so any number of views (UI, export, etc.) can coexist over the same snapshot.
+ * View holds its snapshot, so it stays valid after manager publishes a newer one
+ */
+class SortView {
+public:
+	using Ptr = std::shared_ptr<const SortView>;
+	using SnapshotPtr = std::shared_ptr<const ConnectionsSnapshot>;
+
+	SortView()
+		: m_snapshot(std::make_shared<const ConnectionsSnapshot>())
+	{
+	}
+
+	SortView(SnapshotPtr snapshot, std::vector<uint32_t> order, SortBy sort_by, bool asc_order)
+		: m_snapshot(std::move(snapshot)), m_order(std::move(order)), m_sort_by(sort_by), m_asc(asc_order)
+	{
+	}
+
+	static SortView make(SnapshotPtr snapshot, SortBy sort_by, bool asc_order = true, ThreadPool* pool = nullptr) {
+		auto order = SortKeys::MakeSortOrder(*snapshot, sort_by, asc_order, pool);
+		return SortView(std::move(snapshot), std::move(order), sort_by, asc_order);
+	}
+
+	size_t size() const { return m_order.size(); }
+
+	// snapshot row shown at position k
+	uint32_t operator[](size_t k) const { return m_order[k]; }
+
+	const ConnectionEntryPtr& entry(size_t k) const { return m_snapshot->entries[m_order[k]]; }
+
+	const ConnectionsSnapshot& snapshot() const { return *m_snapshot; }
+
+	const SnapshotPtr& snapshot_ptr() const { return m_snapshot; }
+
+	const std::vector<uint32_t>& order() const { return m_order; }
+
+	SortBy sort_by() const { return m_sort_by; }
+
+	bool ascending() const { return m_asc; }
+private:
+	SnapshotPtr m_snapshot;
+	std::vector<uint32_t> m_order;
+	SortBy m_sort_by{ SortBy::ProcessName };
+	bool m_asc{ true };
+};
+
+#endif
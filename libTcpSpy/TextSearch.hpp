@@ -0,0 +1,231 @@
+#ifndef TEXT_SEARCH_HPP
+#define TEXT_SEARCH_HPP
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cwchar>
+#include <cwctype>
+#include <bit>
+
+#include "Bitmap.hpp"
+#include "Cpu.hpp"
+
+/*
+ * Case-insensitive search over a column of strings (process names, paths, formatted addresses, domains).
+ * Strings are lowercased once into one contiguous buffer, separated by L'\0', and the whole buffer is searched
+ * in a single pass: SIMD compares needle's first and last characters at 16 (AVX2) or 8 (SSE2) positions at once,
+ * and only positions where both match are verified with wmemcmp. Result is a bitmap of matching strings.
+ * Separator never occurs in a needle, so a match never spans two strings
+ */
+namespace TextSearch {
+	static_assert(sizeof(wchar_t) == 2, "kernels compare 16-bit characters");
+
+	enum class Mode { Equal, Prefix, Substring };
+
+	inline wchar_t LowerChar(wchar_t c) {
+		if (c < 0x80) {
+			return (wchar_t)(c - L'A' < 26u ? c | 0x20 : c);
+		}
+		return (wchar_t)std::towlower(c);
+	}
+
+	inline std::wstring Lower(std::wstring str) {
+		for (auto& c : str) {
+			c = LowerChar(c);
+		}
+		return str;
+	}
+
+	class TextColumn {
+	public:
+		TextColumn() {}
+
+		// column of n strings, str_of(i) is i-th string
+		template<typename Func>
+		static TextColumn Build(size_t n, Func str_of) {
+			TextColumn column;
+			column.m_offsets.reserve(n + 1);
+			for (size_t i = 0; i < n; i++) {
+				column.push_back(str_of(i));
+			}
+			return column;
+		}
+
+		void push_back(std::wstring_view str) {
+			for (wchar_t c : str) {
+				m_text.push_back(LowerChar(c));
+			}
+			m_text.push_back(L'\0');
+			m_offsets.push_back((uint32_t)m_text.size());
+		}
+
+		size_t size() const { return m_offsets.size() - 1; }
+
+		// lowercased i-th string
+		std::wstring_view operator[](size_t i) const {
+			return { m_text.data() + m_offsets[i], m_offsets[i + 1] - m_offsets[i] - 1 };
+		}
+
+		const std::wstring& text() const { return m_text; }
+
+		// string i starts at offsets()[i], the next one at offsets()[i + 1]
+		const std::vector<uint32_t>& offsets() const { return m_offsets; }
+	private:
+		std::wstring m_text;
+		std::vector<uint32_t> m_offsets{ 0 };
+	};
+
+	namespace detail {
+		// Blocks compare Width positions at once, bit 2*k of the mask is set when position k is a candidate
+
+		struct ScalarBlock {
+			static constexpr size_t Width = 1;
+
+			ScalarBlock(wchar_t first, wchar_t last) : m_first(first), m_last(last) {}
+
+			uint32_t candidates(const wchar_t* first, const wchar_t* last) const {
+				return *first == m_first && *last == m_last ? 1 : 0;
+			}
+
+			wchar_t m_first, m_last;
+		};
+
+#ifdef TCPSPY_X86
+		struct Sse2Block {
+			static constexpr size_t Width = 8;
+
+			Sse2Block(wchar_t first, wchar_t last)
+				: m_first(_mm_set1_epi16((short)first)), m_last(_mm_set1_epi16((short)last))
+			{
+			}
+
+			uint32_t candidates(const wchar_t* first, const wchar_t* last) const {
+				__m128i a = _mm_loadu_si128((const __m128i*)first);
+				__m128i b = _mm_loadu_si128((const __m128i*)last);
+				__m128i eq = _mm_and_si128(_mm_cmpeq_epi16(a, m_first), _mm_cmpeq_epi16(b, m_last));
+				return (uint32_t)_mm_movemask_epi8(eq) & 0x5555u;
+			}
+
+			__m128i m_first, m_last;
+		};
+
+		struct Avx2Block {
+			static constexpr size_t Width = 16;
+
+			Avx2Block(wchar_t first, wchar_t last)
+				: m_first(_mm256_set1_epi16((short)first)), m_last(_mm256_set1_epi16((short)last))
+			{
+			}
+
+			uint32_t candidates(const wchar_t* first, const wchar_t* last) const {
+				__m256i a = _mm256_loadu_si256((const __m256i*)first);
+				__m256i b = _mm256_loadu_si256((const __m256i*)last);
+				__m256i eq = _mm256_and_si256(_mm256_cmpeq_epi16(a, m_first), _mm256_cmpeq_epi16(b, m_last));
+				return (uint32_t)_mm256_movemask_epi8(eq) & 0x55555555u;
+			}
+
+			__m256i m_first, m_last;
+		};
+#endif
+
+		// Marks every string of column that contains needle. After a hit the rest of its string is skipped
+		template<typename Block>
+		void FindSubstring(const TextColumn& column, std::wstring_view needle, Bitmap& hits) {
+			const wchar_t* text = column.text().data();
+			const size_t len = column.text().size();
+			const size_t n = needle.size();
+			const auto& offsets = column.offsets();
+
+			if (n > len) return;
+
+			// last position a match may start at
+			const size_t last = len - n;
+
+			const Block block(needle.front(), needle.back());
+
+			size_t row = 0;
+
+			auto verify = [&](size_t at) {
+				return n <= 2 || wmemcmp(text + at + 1, needle.data() + 1, n - 2) == 0;
+			};
+
+			// marks string containing position `at`, returns where the next string starts
+			auto mark = [&](size_t at) {
+				while (offsets[row + 1] <= at) row++;
+				hits.set(row);
+				return (size_t)offsets[row + 1];
+			};
+
+			size_t pos = 0;
+
+			// block reads up to pos + Width - 1 + n - 1, which is within text
+			while (pos + Block::Width - 1 <= last) {
+				size_t next = pos + Block::Width;
+
+				for (uint32_t mask = block.candidates(text + pos, text + pos + n - 1); mask; mask &= mask - 1) {
+					size_t at = pos + std::countr_zero(mask) / 2;
+					if (verify(at)) {
+						next = mark(at);
+						break;
+					}
+				}
+
+				pos = next;
+			}
+
+			const ScalarBlock tail(needle.front(), needle.back());
+			while (pos <= last) {
+				if (tail.candidates(text + pos, text + pos + n - 1) && verify(pos)) {
+					pos = mark(pos);
+				}
+				else {
+					pos++;
+				}
+			}
+		}
+	}
+
+	// Bit i is set if i-th string of column equals, starts with or contains needle, which is expected lowercased
+	inline Bitmap Find(const TextColumn& column, std::wstring_view needle, Mode mode) {
+		Bitmap hits(column.size());
+
+		if (mode != Mode::Substring || needle.empty()) {
+			for (size_t i = 0; i < column.size(); i++) {
+				auto str = column[i];
+				bool match = mode == Mode::Equal ? str == needle : str.substr(0, needle.size()) == needle;
+				if (match) hits.set(i);
+			}
+			return hits;
+		}
+
+		if (needle.find(L'\0') != std::wstring_view::npos) {
+			return hits;
+		}
+
+#ifdef TCPSPY_X86
+		if (Cpu::HasAvx2()) {
+			detail::FindSubstring<detail::Avx2Block>(column, needle, hits);
+		}
+		else {
+			detail::FindSubstring<detail::Sse2Block>(column, needle, hits);
+		}
+#else
+		detail::FindSubstring<detail::ScalarBlock>(column, needle, hits);
+#endif
+
+		return hits;
+	}
+
+	// strings that match any of needles
+	inline Bitmap FindAny(const TextColumn& column, const std::vector<std::wstring>& needles, Mode mode) {
+		Bitmap hits(column.size());
+		for (const auto& needle : needles) {
+			hits |= Find(column, needle, mode);
+		}
+		return hits;
+	}
+}
+
+#endif
@@ -1,15 +1,32 @@
 #ifndef THREAD_POOL_HPP
 #define THREAD_POOL_HPP
 
+#include <winsock2.h>
+
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <functional>
+#include <chrono>
 
 #include "BlockingQueue.hpp"
 
 using Task = std::function<void()>;
 
+// user + kernel time that thread has run for, zero if it cannot be queried
+inline std::chrono::microseconds ThreadCpuTime(HANDLE thread) {
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(thread, &creation, &exit, &kernel, &user)) {
+		return std::chrono::microseconds(0);
+	}
+
+	auto to_100ns = [](const FILETIME& ft) {
+		return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	};
+
+	return std::chrono::microseconds((to_100ns(kernel) + to_100ns(user)) / 10);
+}
+
 class ThreadPool {
 public:
 	ThreadPool(int workers_size = 1)
@@ -26,6 +43,17 @@ public:
 		m_queue.push(task);
 	}
 
+	int size() const { return m_workers_size; }
+
+	// CPU time of all workers since they started, idle workers wait and do not add to it
+	std::chrono::microseconds cpu_time() {
+		std::chrono::microseconds total{ 0 };
+		for (auto& worker : m_workers) {
+			if (worker.joinable()) total += ThreadCpuTime(worker.native_handle());
+		}
+		return total;
+	}
+
 	void stop() {
 		for (int i = 0; i < m_workers_size; i++) {
 			m_queue.push(nullptr);
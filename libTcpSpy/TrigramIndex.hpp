@@ -0,0 +1,308 @@
+#ifndef TRIGRAM_INDEX_HPP
+#define TRIGRAM_INDEX_HPP
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+
+#include "ConnectionEntry.hpp"
+#include "ConnectionKey.hpp"
+#include "TextSearch.hpp"
+#include "Bitmap.hpp"
+
+/*
+ * Trigram index over text of rows: process name, path, local and remote address and resolved domain,
+ * lowercased and joined with L'\0'. Rows with the same ConnectionKey have the same text and share a document.
+ * Posting list of every trigram is a sorted vector of document ids. Substring search intersects posting lists
+ * of needle's trigrams, shortest first, and verifies only the remaining candidates on their text.
+ * Index is updated row by row from refresh deltas, document ids of removed rows are reused
+ */
+class TrigramIndex {
+public:
+	using DocId = uint32_t;
+
+	// documents whose text appeared or disappeared, the same id may be in both when its text changed
+	struct Changes {
+		std::vector<DocId> added;
+		std::vector<DocId> removed;
+	};
+
+	void add(const ConnectionEntry& row, Changes& changes) {
+		ConnectionKey key = MakeConnectionKey(row);
+
+		if (auto it = m_by_key.find(key); it != m_by_key.end()) {
+			m_docs[it->second].refs++;
+			return;
+		}
+
+		DocId id = allocate();
+		Doc& doc = m_docs[id];
+		doc.refs = 1;
+
+		doc.text = TextSearch::Lower(row.get_process_name());
+		doc.text += L'\0';
+		doc.text += TextSearch::Lower(row.proc().m_path);
+		doc.text += L'\0';
+		doc.text += TextSearch::Lower(row.local_addr_str());
+
+		if (row.protocol() == ConnectionProtocol::PROTO_TCP) {
+			doc.remote = row.remote_addr_str();
+			doc.text += L'\0';
+			doc.text += TextSearch::Lower(doc.remote);
+			doc.text += L'\0';
+			doc.domain_pos = doc.text.size();
+
+			m_by_remote.emplace(doc.remote, id);
+			if (auto domain = m_domains.find(doc.remote); domain != m_domains.end()) {
+				doc.text += domain->second;
+			}
+		}
+
+		index(id);
+		m_by_key.emplace(key, id);
+		changes.added.push_back(id);
+	}
+
+	void remove(const ConnectionEntry& row, Changes& changes) {
+		auto it = m_by_key.find(MakeConnectionKey(row));
+		if (it == m_by_key.end()) return;
+
+		DocId id = it->second;
+		Doc& doc = m_docs[id];
+
+		if (--doc.refs) return;
+
+		unindex(id);
+
+		auto [beg, end] = m_by_remote.equal_range(doc.remote);
+		for (auto r = beg; r != end; r++) {
+			if (r->second == id) {
+				m_by_remote.erase(r);
+				break;
+			}
+		}
+
+		m_by_key.erase(it);
+		doc = Doc{};
+		m_free.push_back(id);
+		changes.removed.push_back(id);
+	}
+
+	// Domain of remote address (as formatted), applies to present rows and to rows added later
+	void set_domain(const std::wstring& remote, const std::wstring& domain, Changes& changes) {
+		auto lower = TextSearch::Lower(domain);
+
+		auto& stored = m_domains[remote];
+		if (stored == lower) return;
+		stored = lower;
+
+		auto [beg, end] = m_by_remote.equal_range(remote);
+		for (auto r = beg; r != end; r++) {
+			DocId id = r->second;
+			Doc& doc = m_docs[id];
+
+			unindex(id);
+			doc.text.replace(doc.domain_pos, std::wstring::npos, lower);
+			index(id);
+
+			changes.removed.push_back(id);
+			changes.added.push_back(id);
+		}
+	}
+
+	// document of rows with key, or NoDoc
+	DocId doc_of(const ConnectionKey& key) const {
+		auto it = m_by_key.find(key);
+		return it == m_by_key.end() ? NoDoc : it->second;
+	}
+
+	// every document id is less than capacity
+	size_t capacity() const { return m_docs.size(); }
+
+	bool contains(DocId id, std::wstring_view needle) const {
+		return m_docs[id].refs && m_docs[id].text.find(needle) != std::wstring::npos;
+	}
+
+	// Sorted ids of documents that contain needle (lowercased). When within is given, only its documents are checked.
+	// Needles shorter than a trigram are verified on every candidate
+	std::vector<DocId> find(std::wstring_view needle, const std::vector<DocId>* within = nullptr) const {
+		std::vector<DocId> candidates;
+
+		if (needle.size() < 3) {
+			if (within) {
+				candidates = *within;
+			}
+			else {
+				for (DocId id = 0; id < m_docs.size(); id++) {
+					if (m_docs[id].refs) candidates.push_back(id);
+				}
+			}
+		}
+		else {
+			std::vector<const std::vector<DocId>*> lists;
+			for (uint64_t gram : Trigrams(needle)) {
+				auto it = m_postings.find(gram);
+				if (it == m_postings.end()) return {};
+				lists.push_back(&it->second);
+			}
+
+			std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+
+			candidates = within ? Intersect(*within, *lists[0]) : *lists[0];
+			for (size_t l = 1; l < lists.size() && !candidates.empty(); l++) {
+				candidates = Intersect(candidates, *lists[l]);
+			}
+		}
+
+		std::erase_if(candidates, [this, needle](DocId id) { return !contains(id, needle); });
+		return candidates;
+	}
+
+	static constexpr DocId NoDoc = (DocId)-1;
+private:
+	struct Doc {
+		std::wstring text;
+		// remote address as formatted, empty for UDP rows
+		std::wstring remote;
+		// resolved domain is the tail of text from here
+		size_t domain_pos{ 0 };
+		// rows that share this document, 0 for a free id
+		uint32_t refs{ 0 };
+	};
+
+	// three 16-bit characters, trigrams with the separator are not indexed
+	static std::vector<uint64_t> Trigrams(std::wstring_view text) {
+		std::vector<uint64_t> grams;
+		for (size_t i = 0; i + 3 <= text.size(); i++) {
+			if (!text[i] || !text[i + 1] || !text[i + 2]) continue;
+			grams.push_back((uint64_t)(uint16_t)text[i] | ((uint64_t)(uint16_t)text[i + 1] << 16) | ((uint64_t)(uint16_t)text[i + 2] << 32));
+		}
+		std::sort(grams.begin(), grams.end());
+		grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+		return grams;
+	}
+
+	static std::vector<DocId> Intersect(const std::vector<DocId>& a, const std::vector<DocId>& b) {
+		std::vector<DocId> out;
+		out.reserve(std::min(a.size(), b.size()));
+		std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+		return out;
+	}
+
+	DocId allocate() {
+		if (!m_free.empty()) {
+			DocId id = m_free.back();
+			m_free.pop_back();
+			return id;
+		}
+		m_docs.emplace_back();
+		return (DocId)(m_docs.size() - 1);
+	}
+
+	void index(DocId id) {
+		for (uint64_t gram : Trigrams(m_docs[id].text)) {
+			auto& posting = m_postings[gram];
+			// fresh ids go to the end, only reused ones are inserted in the middle
+			if (posting.empty() || posting.back() < id) {
+				posting.push_back(id);
+			}
+			else {
+				posting.insert(std::lower_bound(posting.begin(), posting.end(), id), id);
+			}
+		}
+	}
+
+	void unindex(DocId id) {
+		for (uint64_t gram : Trigrams(m_docs[id].text)) {
+			auto it = m_postings.find(gram);
+			auto& posting = it->second;
+			posting.erase(std::lower_bound(posting.begin(), posting.end(), id));
+			if (posting.empty()) m_postings.erase(it);
+		}
+	}
+
+	std::vector<Doc> m_docs;
+	std::vector<DocId> m_free;
+	std::unordered_map<ConnectionKey, DocId, ConnectionKeyHash> m_by_key;
+	std::unordered_map<uint64_t, std::vector<DocId>> m_postings;
+	// lowercased domain of every resolved remote address, and TCP documents by their remote address
+	std::unordered_map<std::wstring, std::wstring> m_domains;
+	std::unordered_multimap<std::wstring, DocId> m_by_remote;
+};
+
+/*
+ * Find-as-you-type over TrigramIndex. Text that contains the previous text can only match documents that matched before,
+ * so every further keystroke checks the previous result against the new trigrams instead of the whole index.
+ * Result is kept valid by update() with every change of the index
+ */
+class IncrementalSearch {
+public:
+	// true if result is a subset of the previous one (and previous search was active)
+	bool search(const TrigramIndex& index, const std::wstring& text) {
+		std::wstring needle = TextSearch::Lower(text);
+
+		if (needle.empty()) {
+			clear();
+			return false;
+		}
+
+		const bool narrows = active() && needle.find(m_needle) != std::wstring::npos;
+
+		m_results = index.find(needle, narrows ? &m_results : nullptr);
+		m_needle = std::move(needle);
+		mark(index);
+		return narrows;
+	}
+
+	// removed documents are dropped from result, added ones are checked
+	void update(const TrigramIndex& index, const TrigramIndex::Changes& changes) {
+		if (!active() || (changes.added.empty() && changes.removed.empty())) return;
+
+		auto removed = changes.removed;
+		std::sort(removed.begin(), removed.end());
+
+		std::vector<TrigramIndex::DocId> kept;
+		kept.reserve(m_results.size());
+		std::set_difference(m_results.begin(), m_results.end(), removed.begin(), removed.end(), std::back_inserter(kept));
+
+		for (auto id : changes.added) {
+			if (index.contains(id, m_needle)) kept.push_back(id);
+		}
+		// document added and then given a domain in one update is in added twice
+		std::sort(kept.begin(), kept.end());
+		kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+
+		m_results = std::move(kept);
+		mark(index);
+	}
+
+	void clear() {
+		m_needle.clear();
+		m_results.clear();
+		m_hits = Bitmap();
+	}
+
+	bool active() const { return !m_needle.empty(); }
+
+	bool matches(TrigramIndex::DocId id) const { return id < m_hits.size() && m_hits.test(id); }
+
+	const std::vector<TrigramIndex::DocId>& results() const { return m_results; }
+private:
+	void mark(const TrigramIndex& index) {
+		m_hits = Bitmap(index.capacity());
+		for (auto id : m_results) {
+			m_hits.set(id);
+		}
+	}
+
+	// lowercased text of the last search
+	std::wstring m_needle;
+	std::vector<TrigramIndex::DocId> m_results;
+	Bitmap m_hits;
+};
+
+#endif
@@ -2,20 +2,31 @@
 #define UTILS_HPP
 #include <string>
 #include <sstream>
+#include <charconv>
+#include <type_traits>
 #include "windef.h"
 
 namespace Utils {
 	template<typename From, typename To = std::wstring>
 	inline To ConvertFrom(From from) {
-		std::wstringstream ss;
-		To to{};
+		if constexpr (std::is_integral_v<From> && std::is_same_v<To, std::wstring>) {
+			// integers are converted on every cell draw and export, so do not construct a stream for them
+			char buf[24];
+			auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), from);
 
-		ss << from;
+			return To(buf, end);
+		}
+		else {
+			std::wstringstream ss;
+			To to{};
 
-		ss >> to;
+			ss << from;
 
-		return to;
+			ss >> to;
+
+			return to;
+		}
 	}
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,11 +1,57 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <future>
+#include <functional>
+#include <unordered_set>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <numeric>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
 
 #include "ConnectionEntry.hpp"
 #include "ConnectionsTable.hpp"
+#include "SortKeys.hpp"
+#include "ConnectionsRefresher.hpp"
+#include "Query.hpp"
+#include "TextSearch.hpp"
+#include "TrigramIndex.hpp"
+#include "RowIndexes.hpp"
+#include "ColumnScan.hpp"
+#include "Columns.hpp"
 
 void test_ConnectionsTable();
+void bench_ParallelSort();
+void test_ConnectionsRefresher();
+void bench_Query();
+void bench_TextSearch();
+void bench_IncrementalSearch();
+void bench_RowIndexes();
+void bench_ColumnScan();
+void bench_EntryAccess();
+void bench_ColumnFormat();
+void bench_AddressCompare();
+void test_SortRuns();
+void test_ParallelSort();
+void test_PartialOrder();
+void test_ColumnOrder();
+void test_RoaringBitmap();
+void test_Query();
+void test_AcquisitionFilter();
+void test_IncrementalSearch();
+void test_TextSearch();
+void test_ColumnScan();
+void test_ConnectionsDelta();
+void test_ViewFilters();
+void test_RowIndexes();
+void test_IPAddress();
+void test_ConnectionEntry();
 
 int main()
 {
@@ -19,6 +65,56 @@ int main()
 
     test_ConnectionsTable();
 
+    test_SortRuns();
+
+    test_ParallelSort();
+
+    test_PartialOrder();
+
+    test_ColumnOrder();
+
+    test_RoaringBitmap();
+
+    test_Query();
+
+    test_AcquisitionFilter();
+
+    test_IncrementalSearch();
+
+    test_TextSearch();
+
+    test_ColumnScan();
+
+    test_ConnectionsDelta();
+
+    test_ViewFilters();
+
+    test_RowIndexes();
+
+    test_IPAddress();
+
+    test_ConnectionEntry();
+
+    bench_ParallelSort();
+
+    test_ConnectionsRefresher();
+
+    bench_Query();
+
+    bench_TextSearch();
+
+    bench_IncrementalSearch();
+
+    bench_RowIndexes();
+
+    bench_ColumnScan();
+
+    bench_EntryAccess();
+
+    bench_ColumnFormat();
+
+    bench_AddressCompare();
+
     WSACleanup();
     return 0;
 }
@@ -49,8 +145,8 @@ void test_ConnectionsTable() {
     std::cout << rows.size() << std::endl;
 
     for (auto& row : rows) {
-        if (ConnectionEntryTCP* tcp = dynamic_cast<ConnectionEntryTCP*>(row)) {
-            std::wcout << row->get_process_name() << "\t" << row->local_addr_str() << "\t" << row->local_port_str() << "\t" << tcp->remote_addr_str() << std::endl;
+        if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
+            std::wcout << row->get_process_name() << "\t" << row->local_addr_str() << "\t" << row->local_port_str() << "\t" << row->remote_addr_str() << std::endl;
         }
         else {
             std::wcout << row->get_process_name() << "\t" << row->local_addr_str() << "\t" << row->local_port_str() << std::endl;
@@ -62,3 +158,2167 @@ void test_ConnectionsTable() {
     }
 #endif
 }
+
+// rows with random addresses, ports and states of 300 processes, entries are not created
+ConnectionsSnapshot random_snapshot(size_t rows, std::vector<std::unique_ptr<Process>>& procs) {
+    std::mt19937 rng(42);
+    ConnectionsSnapshot snap;
+
+    for (int i = 0; i < 300; i++) {
+        procs.push_back(std::make_unique<Process>(i * 4));
+        procs.back()->m_name = L"process" + std::to_wstring(rng() % 1000) + L".exe";
+        procs.back()->m_path = L"C:\\Program Files\\Vendor" + std::to_wstring(rng() % 50) + L"\\" + procs.back()->m_name;
+        snap.processes.push_back(procs.back().get());
+    }
+
+    for (size_t i = 0; i < rows; i++) {
+        bool tcp = rng() % 4 != 0;
+        IPAddress local{}, remote{};
+        for (auto& b : local.bytes) b = (UCHAR)rng();
+        for (auto& b : remote.bytes) b = (UCHAR)rng();
+
+        uint32_t proc = rng() % procs.size();
+
+        snap.family.push_back(ProtocolFamily::INET6);
+        snap.protocol.push_back(tcp ? ConnectionProtocol::PROTO_TCP : ConnectionProtocol::PROTO_UDP);
+        snap.state.push_back(tcp ? rng() % 12 + 1 : 0);
+        snap.local_port.push_back((USHORT)rng());
+        snap.remote_port.push_back(tcp ? (USHORT)rng() : 0);
+        snap.local_addr.push_back(local);
+        snap.remote_addr.push_back(tcp ? remote : IPAddress{});
+        snap.pid.push_back(procs[proc]->m_pid);
+        snap.row_id.push_back((uint32_t)i);
+        snap.process.push_back(proc);
+        snap.entries.push_back(nullptr);
+    }
+
+    return snap;
+}
+
+// Sorts synthetic 500k rows snapshot with 1, 2, 4 .. N workers (N is the number of cores, as manager's sort pool),
+// prints wall-clock time per column and speedup over a single worker
+void bench_ParallelSort() {
+    constexpr size_t rows = 500000;
+    const std::array<SortBy, 4> columns{ SortBy::ProcessName, SortBy::LocalAddress, SortBy::RemotePort, SortBy::State };
+
+    std::vector<std::unique_ptr<Process>> procs;
+    ConnectionsSnapshot snap = random_snapshot(rows, procs);
+
+    int max_workers = std::max(1, (int)std::thread::hardware_concurrency());
+
+    std::array<double, columns.size()> single{};
+
+    // doubles up to the number of cores, which is measured too when it is not a power of two
+    for (int workers = 1; ; workers = std::min(workers * 2, max_workers)) {
+        ThreadPool pool(workers);
+
+        std::cout << "workers: " << workers;
+        for (size_t c = 0; c < columns.size(); c++) {
+            auto beg = std::chrono::steady_clock::now();
+            auto order = SortKeys::MakeSortOrder(snap, columns[c], true, &pool);
+            auto end = std::chrono::steady_clock::now();
+
+            double ms = std::chrono::duration<double, std::milli>(end - beg).count();
+            if (workers == 1) single[c] = ms;
+
+            std::cout << "\t" << ms << " ms (x" << single[c] / ms << ")";
+        }
+        std::cout << std::endl;
+
+        pool.stop();
+
+        if (workers == max_workers) break;
+    }
+}
+
+// Find Next from the top and Find All over 1M rows, as Find dialog runs them
+void bench_Query() {
+    constexpr size_t rows = 1000000;
+
+    std::vector<std::unique_ptr<Process>> procs;
+    auto snap = std::make_shared<const ConnectionsSnapshot>(random_snapshot(rows, procs));
+    auto view = SortView::make(snap, SortBy::ProcessName);
+
+    for (auto text : { L"proc~process1 and rport in 80,443,1024-2048 and state=ESTAB", L"not (lport<1024 or state=listen) and af=6" }) {
+        auto query = Query::Compile(text);
+
+        auto beg = std::chrono::steady_clock::now();
+        auto next = query.find_next(view, Query::npos, true);
+        auto mid = std::chrono::steady_clock::now();
+        auto all = query.find_all(view);
+        auto end = std::chrono::steady_clock::now();
+
+        std::wcout << text << std::endl;
+        std::cout << "\tfind next: " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+            << ", find all: " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+            << all.size() << " rows" << std::endl;
+    }
+}
+
+// Case-insensitive substring search over process names, paths and local addresses of 1M rows:
+// copying and lowercasing every cell (as Find dialog did) against TextSearch kernel over a lowercased column
+void bench_TextSearch() {
+    constexpr size_t rows = 1000000;
+
+    std::vector<std::unique_ptr<Process>> procs;
+    ConnectionsSnapshot snap = random_snapshot(rows, procs);
+
+    std::cout << "text search, " << (Cpu::HasAvx2() ? "AVX2" : "SSE2") << std::endl;
+
+    struct Case {
+        const char* name;
+        std::function<std::wstring(size_t)> str;
+        const wchar_t* needle;
+    };
+
+    for (const auto& column : {
+        Case{ "process name", [&snap](size_t i) { return snap.process_name(i); }, L"SS12" },
+        Case{ "path", [&snap](size_t i) { return snap.processes[snap.process[i]]->m_path; }, L"vendor4\\process9" },
+        Case{ "local address", [&snap](size_t i) { return snap.local_addr_str(i); }, L"ab:c" },
+        }) {
+        std::vector<std::wstring> cells(rows);
+        for (size_t i = 0; i < rows; i++) cells[i] = column.str(i);
+
+        const std::wstring needle = TextSearch::Lower(column.needle);
+
+        auto beg = std::chrono::steady_clock::now();
+        size_t loop_hits = 0;
+        for (const auto& cell : cells) {
+            WCHAR buf[512];
+            size_t len = std::min(cell.size(), std::size(buf) - 1);
+            wmemcpy(buf, cell.data(), len);
+            buf[len] = L'\0';
+            CharLowerBuffW(buf, (DWORD)len);
+            loop_hits += wcsstr(buf, needle.c_str()) ? 1 : 0;
+        }
+        auto built = std::chrono::steady_clock::now();
+
+        auto text = TextSearch::TextColumn::Build(rows, [&cells](size_t i) { return std::wstring_view(cells[i]); });
+        auto lowered = std::chrono::steady_clock::now();
+        auto hits = TextSearch::Find(text, needle, TextSearch::Mode::Substring);
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << "\t" << column.name << ": loop " << std::chrono::duration<double, std::milli>(built - beg).count() << " ms"
+            << ", lowercase column " << std::chrono::duration<double, std::milli>(lowered - built).count() << " ms"
+            << ", kernel " << std::chrono::duration<double, std::milli>(end - lowered).count() << " ms, "
+            << hits.count() << " rows (loop " << loop_hits << ")" << std::endl;
+    }
+}
+
+// IPv4 TCP rows of 300 processes with random addresses, ports and states, a quarter of them with well-known remote ports
+ConnectionEntryPtrs random_entries(size_t rows) {
+    std::mt19937 rng(7);
+    std::vector<ProcessPtr> procs;
+    for (int i = 0; i < 300; i++) {
+        procs.push_back(std::make_shared<Process>(i * 4));
+        procs.back()->m_name = L"process" + std::to_wstring(rng() % 1000) + L".exe";
+        procs.back()->m_path = L"C:\\Program Files\\" + procs.back()->m_name;
+    }
+
+    ConnectionEntryPtrs entries;
+    for (size_t i = 0; i < rows; i++) {
+        MIB_TCPROW_OWNER_PID row{};
+        row.dwState = rng() % 12 + 1;
+        row.dwLocalAddr = (DWORD)rng();
+        row.dwRemoteAddr = (DWORD)rng();
+        row.dwLocalPort = (DWORD)(USHORT)rng();
+        row.dwRemotePort = htons(rng() % 4 ? (USHORT)rng() : (USHORT)(rng() % 1024));
+        entries.push_back(std::make_shared<ConnectionEntry>(row, procs[rng() % procs.size()]));
+    }
+
+    return entries;
+}
+
+// Typing "process12.exe" key by key into find-as-you-type over 200k rows, every keystroke narrows the previous result
+void bench_IncrementalSearch() {
+    constexpr size_t rows = 200000;
+
+    ConnectionEntryPtrs entries = random_entries(rows);
+
+    TrigramIndex index;
+    TrigramIndex::Changes changes;
+
+    auto beg = std::chrono::steady_clock::now();
+    for (const auto& row : entries) {
+        index.add(*row, changes);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "trigram index of " << rows << " rows: " << std::chrono::duration<double, std::milli>(end - beg).count() << " ms" << std::endl;
+
+    IncrementalSearch search;
+    const std::wstring typed = L"process12.exe";
+
+    for (size_t len = 1; len <= typed.size(); len++) {
+        auto text = typed.substr(0, len);
+
+        beg = std::chrono::steady_clock::now();
+        search.search(index, text);
+        end = std::chrono::steady_clock::now();
+
+        std::wcout << L"\t" << text;
+        std::cout << ": " << std::chrono::duration<double, std::micro>(end - beg).count() << " us, "
+            << search.results().size() << " documents" << std::endl;
+    }
+}
+
+// "ESTAB rows of PID 400" and per-state counts over 1M rows: scan of entries against indexes
+void bench_RowIndexes() {
+    constexpr size_t rows = 1000000;
+
+    ConnectionEntryPtrs entries = random_entries(rows);
+
+    RowIndexes indexes;
+
+    auto beg = std::chrono::steady_clock::now();
+    for (auto& row : entries) {
+        indexes.add(*row);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "row indexes of " << rows << " rows: " << std::chrono::duration<double, std::milli>(end - beg).count() << " ms" << std::endl;
+
+    beg = std::chrono::steady_clock::now();
+    size_t scanned = 0;
+    std::array<size_t, MIB_TCP_STATE_DELETE_TCB + 1> scanned_states{};
+    for (const auto& row : entries) {
+        scanned_states[row->state()]++;
+        if (row->state() == MIB_TCP_STATE_ESTAB && row->pid() == 400) scanned++;
+    }
+    auto mid = std::chrono::steady_clock::now();
+
+    size_t selected = indexes.count({ .states = 1u << MIB_TCP_STATE_ESTAB, .pid = 400 });
+    size_t counted = 0;
+    for (DWORD state = MIB_TCP_STATE_CLOSED; state <= MIB_TCP_STATE_DELETE_TCB; state++) {
+        counted += indexes.state(state).count();
+    }
+    end = std::chrono::steady_clock::now();
+
+    std::cout << "\tscan: " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+        << ", indexes: " << std::chrono::duration<double, std::micro>(end - mid).count() << " us, "
+        << selected << " rows (scan " << scanned << "), " << counted << " counted" << std::endl;
+}
+
+// Numeric predicates over 1M rows: accessors of every entry against ColumnScan kernels over a snapshot,
+// then a query checked row by row against the whole table matcher
+void bench_ColumnScan() {
+    constexpr size_t rows = 1000000;
+
+    ConnectionEntryPtrs entries = random_entries(rows);
+    ConnectionsSnapshot snap(entries);
+
+    std::cout << "column scan of " << rows << " rows, " << (Cpu::HasAvx2() ? "AVX2" : "scalar") << std::endl;
+
+    IPAddress net = IPAddress::FromIPv4(0);
+    net[12] = 10;
+
+    const uint32_t states = (1u << MIB_TCP_STATE_ESTAB) | (1u << MIB_TCP_STATE_TIME_WAIT);
+
+    struct Case {
+        const char* name;
+        std::function<bool(const ConnectionEntry&)> pred;
+        std::function<Bitmap()> kernel;
+    };
+
+    for (const auto& c : {
+        Case{ "remote port 80-443",
+            [](const ConnectionEntry& row) {
+                return row.protocol() == ConnectionProtocol::PROTO_TCP && row.remote_port() >= 80 && row.remote_port() <= 443;
+            },
+            [&snap]() { return ColumnScan::InRange(snap.remote_port, 80, 443); } },
+        Case{ "state ESTAB or TIME_WAIT",
+            [states](const ConnectionEntry& row) {
+                return row.protocol() == ConnectionProtocol::PROTO_TCP && (states & (1u << row.state()));
+            },
+            [&snap, states]() { return ColumnScan::InMask(snap.state, states); } },
+        Case{ "remote address 10.0.0.0/8",
+            [](const ConnectionEntry& row) {
+                return row.protocol() == ConnectionProtocol::PROTO_TCP && row.remote_addr()[12] == 10;
+            },
+            [&snap, &net]() { return ColumnScan::InPrefix(snap.remote_addr, net, 104); } },
+        }) {
+        auto beg = std::chrono::steady_clock::now();
+        size_t scanned = 0;
+        for (const auto& row : entries) {
+            scanned += c.pred(*row) ? 1 : 0;
+        }
+        auto mid = std::chrono::steady_clock::now();
+        auto hits = c.kernel();
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << "\t" << c.name << ": entries " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+            << ", kernel " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+            << hits.count() << " rows (entries " << scanned << ")" << std::endl;
+    }
+
+    auto query = Query::Compile(L"rport in 80,443,8000-8080 and state=ESTAB,TIME or raddr in 10.0.0.0/8 and not lport<1024");
+
+    auto beg = std::chrono::steady_clock::now();
+    auto by_row = query.bind(snap);
+    size_t checked = 0;
+    for (uint32_t i = 0; i < snap.size(); i++) {
+        checked += by_row(i) ? 1 : 0;
+    }
+    auto mid = std::chrono::steady_clock::now();
+    auto whole = query.bind(snap, true);
+    size_t scanned = 0;
+    for (uint32_t i = 0; i < snap.size(); i++) {
+        scanned += whole(i) ? 1 : 0;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::wcout << L"\t" << query.text();
+    std::cout << ": row by row " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+        << ", whole table " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+        << scanned << " rows (row by row " << checked << ")" << std::endl;
+}
+
+// Sorting 1M entries by state and remote port, and formatting all their cells as list view and export did,
+// over a mix of TCP and UDP rows, so that every access to a remote column checks the kind of row
+void bench_EntryAccess() {
+    constexpr size_t rows = 1000000;
+
+    std::mt19937 rng(11);
+    auto proc = std::make_shared<Process>(4);
+    proc->m_name = L"process.exe";
+
+    ConnectionEntryPtrs entries;
+    for (size_t i = 0; i < rows; i++) {
+        if (i % 4 == 0) {
+            MIB_UDPROW_OWNER_PID row{};
+            row.dwLocalAddr = (DWORD)rng();
+            row.dwLocalPort = (DWORD)(USHORT)rng();
+            entries.push_back(std::make_shared<ConnectionEntry>(row, proc));
+            continue;
+        }
+        MIB_TCPROW_OWNER_PID row{};
+        row.dwState = rng() % 12 + 1;
+        row.dwLocalAddr = (DWORD)rng();
+        row.dwRemoteAddr = (DWORD)rng();
+        row.dwLocalPort = (DWORD)(USHORT)rng();
+        row.dwRemotePort = (DWORD)(USHORT)rng();
+        entries.push_back(std::make_shared<ConnectionEntry>(row, proc));
+    }
+
+    // UDP rows first, as they have neither state nor remote port
+    auto key = [](const ConnectionEntry& row) {
+        if (row.protocol() != ConnectionProtocol::PROTO_TCP) return std::pair<DWORD, DWORD>(0, 0);
+        return std::pair<DWORD, DWORD>(row.state(), row.remote_port());
+    };
+
+    auto beg = std::chrono::steady_clock::now();
+    std::stable_sort(entries.begin(), entries.end(), [&key](const auto& a, const auto& b) { return key(*a) < key(*b); });
+    auto mid = std::chrono::steady_clock::now();
+
+    size_t chars = 0;
+    std::wstring line;
+    for (const auto& row : entries) {
+        line = row->get_process_name() + L"," + row->pid_str() + L"," + row->proto_str() + L"," + row->address_family_str()
+            + L"," + row->local_addr_str() + L"," + row->local_port_str();
+        if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
+            line += L"," + row->remote_addr_str() + L"," + row->remote_port_str() + L"," + row->state_str();
+        }
+        chars += line.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "entries of " << rows << " rows: sort " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+        << ", format " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+        << chars << " characters" << std::endl;
+}
+
+// Text of every cell of 500k rows from column descriptors: a cell at a time with the column chosen at run time,
+// as list view asks for them, and a row at a time with all columns unrolled, as export writes them
+void bench_ColumnFormat() {
+    constexpr size_t rows = 500000;
+
+    std::vector<std::unique_ptr<Process>> procs;
+    ConnectionsSnapshot snap = random_snapshot(rows, procs);
+
+    auto beg = std::chrono::steady_clock::now();
+    size_t by_cell = 0;
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t c = 0; c < Columns::Count; c++) {
+            by_cell += Columns::Text((Column)c, snap, i).size();
+        }
+    }
+    auto mid = std::chrono::steady_clock::now();
+
+    size_t by_row = 0;
+    for (size_t i = 0; i < rows; i++) {
+        Columns::ForEach([&snap, i, &by_row](auto column) {
+            using D = decltype(column);
+            if (Columns::Has<D>(snap, i)) by_row += D::Format(snap, i).size();
+            });
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "format of " << rows << " rows: by cell " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+        << ", by row " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+        << by_row << " characters (by cell " << by_cell << ")" << std::endl;
+}
+
+// Sorting, deduplicating and hashing 1M addresses, half IPv4 and half IPv6, as byte arrays compared byte by byte
+// against IPAddress compared with SSE2 and hashed in two multiplies
+void bench_AddressCompare() {
+    constexpr size_t count = 1000000;
+
+    std::mt19937 rng(5);
+    std::vector<IPAddress> addrs;
+    for (size_t i = 0; i < count; i++) {
+        if (i % 2) {
+            // few IPv4 networks, so that many addresses share their first 14 bytes
+            addrs.push_back(IPAddress::FromIPv4(htonl(0x0a000000 | (rng() % 0x10000))));
+            continue;
+        }
+        IPAddress addr{};
+        addr[0] = 0x20;
+        addr[1] = 0x01;
+        for (size_t b = 8; b < IPAddress::Size; b++) addr[b] = (UCHAR)(rng() % 4);
+        addrs.push_back(addr);
+    }
+
+    std::vector<std::array<UCHAR, IPAddress::Size>> arrays(count);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(arrays[i].data(), addrs[i].data(), IPAddress::Size);
+    }
+
+    auto beg = std::chrono::steady_clock::now();
+    std::sort(arrays.begin(), arrays.end());
+    size_t array_unique = std::unique(arrays.begin(), arrays.end()) - arrays.begin();
+    auto mid = std::chrono::steady_clock::now();
+    std::sort(addrs.begin(), addrs.end());
+    size_t addr_unique = std::unique(addrs.begin(), addrs.end()) - addrs.begin();
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "addresses: sort and unique of " << count << ", arrays " << std::chrono::duration<double, std::milli>(mid - beg).count() << " ms"
+        << ", IPAddress " << std::chrono::duration<double, std::milli>(end - mid).count() << " ms, "
+        << addr_unique << " unique (arrays " << array_unique << ")" << std::endl;
+
+    std::shuffle(addrs.begin(), addrs.end(), rng);
+
+    beg = std::chrono::steady_clock::now();
+    std::unordered_set<IPAddress, IPAddressHash> set(addrs.begin(), addrs.end());
+    end = std::chrono::steady_clock::now();
+
+    std::cout << "\thash set: " << std::chrono::duration<double, std::milli>(end - beg).count() << " ms, " << set.size() << " addresses" << std::endl;
+}
+
+// Rows of 20 processes (10 distinct names) with few distinct addresses, ports and states, TCP and UDP, IPv4 and IPv6,
+// so that most rows have equal keys in every column. TCP listeners have the same remote columns as UDP rows
+ConnectionsSnapshot tied_snapshot(size_t rows, std::vector<std::unique_ptr<Process>>& procs, unsigned seed) {
+    std::mt19937 rng(seed);
+    ConnectionsSnapshot snap;
+
+    for (int i = 0; i < 20; i++) {
+        procs.push_back(std::make_unique<Process>(i * 4 + 4));
+        procs.back()->m_name = L"process" + std::to_wstring(i % 10) + L".exe";
+        snap.processes.push_back(procs.back().get());
+    }
+
+    auto address = [&rng](bool v4) {
+        if (v4) return IPAddress::FromIPv4(htonl(0x0a000000 | (rng() % 4)));
+        IPAddress addr{};
+        addr[0] = 0xfe;
+        addr[1] = 0x80;
+        addr[15] = (UCHAR)(rng() % 4);
+        return addr;
+    };
+
+    for (size_t i = 0; i < rows; i++) {
+        bool tcp = rng() % 3 != 0;
+        bool v4 = rng() % 2 != 0;
+        uint32_t proc = rng() % 20;
+        DWORD state = tcp ? rng() % 3 + 1 : 0;
+        // listeners have zero remote address and port, as UDP rows
+        bool remote = tcp && state != MIB_TCP_STATE_LISTEN;
+
+        snap.family.push_back(v4 ? ProtocolFamily::INET : ProtocolFamily::INET6);
+        snap.protocol.push_back(tcp ? ConnectionProtocol::PROTO_TCP : ConnectionProtocol::PROTO_UDP);
+        snap.state.push_back(state);
+        snap.local_port.push_back((USHORT)(80 + rng() % 4));
+        snap.remote_port.push_back(remote ? (USHORT)(440 + rng() % 4) : 0);
+        snap.local_addr.push_back(address(v4));
+        snap.remote_addr.push_back(remote ? address(v4) : IPAddress{});
+        snap.pid.push_back(snap.processes[proc]->m_pid);
+        snap.row_id.push_back((uint32_t)i);
+        snap.process.push_back(proc);
+        snap.entries.push_back(nullptr);
+    }
+
+    return snap;
+}
+
+// Column order as the list shows it, from snapshot values rather than from column descriptors.
+// UDP rows have no remote address, remote port and state, they go before TCP rows in these columns
+bool reference_less(const ConnectionsSnapshot& snap, Column col, uint32_t a, uint32_t b) {
+    switch (col) {
+    case Column::ProcessName: return snap.processes[snap.process[a]]->m_name < snap.processes[snap.process[b]]->m_name;
+    case Column::PID: return snap.pid[a] < snap.pid[b];
+    case Column::Protocol: return snap.protocol[a] < snap.protocol[b];
+    case Column::INET: return snap.family[a] < snap.family[b];
+    case Column::LocalAddress: return snap.local_addr[a] < snap.local_addr[b];
+    case Column::LocalPort: return snap.local_port[a] < snap.local_port[b];
+    default: break;
+    }
+
+    bool tcp_a = snap.protocol[a] == ConnectionProtocol::PROTO_TCP;
+    bool tcp_b = snap.protocol[b] == ConnectionProtocol::PROTO_TCP;
+    if (tcp_a != tcp_b) return tcp_b;
+
+    switch (col) {
+    case Column::RemoteAddress: return snap.remote_addr[a] < snap.remote_addr[b];
+    case Column::RemotePort: return snap.remote_port[a] < snap.remote_port[b];
+    default: return snap.state[a] < snap.state[b];
+    }
+}
+
+// std::stable_sort of rows, descending order keeps equal rows in their order too
+std::vector<uint32_t> reference_sort(const ConnectionsSnapshot& snap, std::vector<uint32_t> rows, Column col, bool asc) {
+    std::stable_sort(rows.begin(), rows.end(), [&snap, col, asc](uint32_t a, uint32_t b) {
+        return asc ? reference_less(snap, col, a, b) : reference_less(snap, col, b, a);
+        });
+    return rows;
+}
+
+std::vector<uint32_t> all_rows(const ConnectionsSnapshot& snap) {
+    std::vector<uint32_t> rows(snap.size());
+    std::iota(rows.begin(), rows.end(), 0);
+    return rows;
+}
+
+// RadixSort and RowKeys::sort give the same order as std::stable_sort for every kind of input it treats differently:
+// empty and single row, already sorted, reversed (descending runs with ties), a few sorted runs that are merged,
+// and unordered rows, in every column in both directions
+void test_SortRuns() {
+    std::mt19937 rng(11);
+
+    for (size_t n : { 0, 1, 2, 100, 5000 }) {
+        std::vector<uint64_t> keys(n);
+        for (auto& k : keys) k = (uint64_t)(rng() % 8) << (rng() % 2 ? 56 : 0);
+
+        std::vector<uint32_t> expected(n);
+        std::iota(expected.begin(), expected.end(), 0);
+        std::stable_sort(expected.begin(), expected.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        auto sorted_keys = keys;
+        SortKeys::RadixSort(sorted_keys, order);
+
+        assert(order == expected);
+        assert(std::is_sorted(sorted_keys.begin(), sorted_keys.end()));
+    }
+
+    for (size_t n : { 0, 1, 7, 3000 }) {
+        std::vector<std::unique_ptr<Process>> procs;
+        ConnectionsSnapshot snap = tied_snapshot(n, procs, (unsigned)n);
+
+        for (size_t c = 0; c < (size_t)Column::Count; c++) {
+            Column col = (Column)c;
+
+            for (bool asc : { true, false }) {
+                std::vector<std::vector<uint32_t>> inputs;
+
+                auto shuffled = all_rows(snap);
+                std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+                inputs.push_back(all_rows(snap));
+                inputs.push_back(shuffled);
+                inputs.push_back(reference_sort(snap, all_rows(snap), col, asc));
+
+                auto reversed = inputs.back();
+                std::reverse(reversed.begin(), reversed.end());
+                inputs.push_back(reversed);
+
+                // 2 to 16 sorted runs are merged, more are sorted from scratch
+                for (size_t runs : { 2, 5, 16, 17 }) {
+                    std::vector<uint32_t> input;
+                    for (size_t r = 0; r < runs; r++) {
+                        std::vector<uint32_t> part(shuffled.begin() + n * r / runs, shuffled.begin() + n * (r + 1) / runs);
+                        part = reference_sort(snap, std::move(part), col, asc);
+                        input.insert(input.end(), part.begin(), part.end());
+                    }
+                    inputs.push_back(input);
+                }
+
+                SortKeys::RowKeys keys(snap, col, asc);
+                for (const auto& input : inputs) {
+                    auto rows = input;
+                    keys.sort(rows);
+                    assert(rows == reference_sort(snap, input, col, asc));
+                }
+            }
+        }
+    }
+
+    std::cout << "sort runs: ok" << std::endl;
+}
+
+// Sort on workers (chunks sorted in parallel and merged) gives the std::stable_sort order, with chunks of equal
+// and unequal sizes, rows just above and far above the parallel threshold, in every column in both directions
+void test_ParallelSort() {
+    std::mt19937 rng(13);
+
+    for (int workers : { 2, 3, 4 }) {
+        ThreadPool pool(workers);
+
+        for (size_t n : { (size_t)1 << 16, (size_t)200003 }) {
+            std::vector<std::unique_ptr<Process>> procs;
+            ConnectionsSnapshot snap = tied_snapshot(n, procs, (unsigned)(n + workers));
+
+            auto shuffled = all_rows(snap);
+            std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+            for (size_t c = 0; c < (size_t)Column::Count; c++) {
+                for (bool asc : { true, false }) {
+                    auto rows = shuffled;
+                    SortKeys::RowKeys(snap, (Column)c, asc).sort(rows, &pool);
+                    assert(rows == reference_sort(snap, shuffled, (Column)c, asc));
+
+                    // from storage order, as manager sorts
+                    assert(SortKeys::MakeSortOrder(snap, (Column)c, asc, &pool) == reference_sort(snap, all_rows(snap), (Column)c, asc));
+                }
+            }
+        }
+
+        pool.stop();
+    }
+
+    std::cout << "parallel sort: ok" << std::endl;
+}
+
+// PartialOrder::extend makes a prefix final that is the prefix of the std::stable_sort order, the rest stays a permutation
+// of the remaining rows. Extended by small and large steps, past the end, with empty and single row snapshots,
+// over all rows and over a subset of them, in every column in both directions
+void test_PartialOrder() {
+    for (size_t n : { 0, 1, 2, 1000 }) {
+        std::vector<std::unique_ptr<Process>> procs;
+        ConnectionsSnapshot snap = tied_snapshot(n, procs, (unsigned)(n + 1));
+
+        // rows of a window over a filtered view come in storage order
+        std::vector<uint32_t> subset;
+        for (uint32_t i = 0; i < n; i += 3) subset.push_back(i);
+
+        for (size_t c = 0; c < (size_t)Column::Count; c++) {
+            for (bool asc : { true, false }) {
+                for (const auto& rows : { all_rows(snap), subset }) {
+                    const auto expected = reference_sort(snap, rows, (Column)c, asc);
+
+                    auto order = rows.size() == n ? SortKeys::PartialOrder(snap, (Column)c, asc) : SortKeys::PartialOrder(snap, rows, (Column)c, asc);
+                    assert(order.sorted() == 0);
+
+                    for (size_t last : { 0, 1, 2, 5, 30, 31, 400, 1000, 1001, 5000 }) {
+                        order.extend(last);
+
+                        const auto& got = order.order();
+                        assert(order.sorted() >= std::min(last, rows.size()) && order.sorted() <= rows.size());
+                        assert(std::equal(got.begin(), got.begin() + order.sorted(), expected.begin()));
+
+                        auto all = got;
+                        std::sort(all.begin(), all.end());
+                        assert(all == rows);
+                    }
+                    assert(order.sorted() == rows.size() && order.order() == expected);
+                }
+            }
+        }
+    }
+
+    std::cout << "partial order: ok" << std::endl;
+}
+
+// Sort keys generated from column descriptors order rows as the reference comparator does, in every column
+// in both directions: processes by name (different processes with equal names tie), addresses numerically,
+// UDP rows before TCP ones in columns they do not have, and these columns are empty for UDP rows.
+// Query field of every column is one that Find can search it by
+void test_ColumnOrder() {
+    for (size_t c = 0; c < (size_t)Column::Count; c++) {
+        assert(!Query::ColumnPrefix((Column)c, L"1").empty());
+    }
+
+    for (size_t n : { 0, 1, 2, 5000 }) {
+        std::vector<std::unique_ptr<Process>> tied_procs, random_procs;
+        ConnectionsSnapshot tied = tied_snapshot(n, tied_procs, (unsigned)(n + 2));
+        ConnectionsSnapshot random = random_snapshot(n, random_procs);
+
+        for (const ConnectionsSnapshot* snap : { &tied, &random }) {
+            for (size_t c = 0; c < (size_t)Column::Count; c++) {
+                Column col = (Column)c;
+
+                for (bool asc : { true, false }) {
+                    auto order = SortKeys::MakeSortOrder(*snap, col, asc);
+                    assert(order == reference_sort(*snap, all_rows(*snap), col, asc));
+
+                    SortKeys::RowKeys keys(*snap, col, asc);
+                    for (size_t i = 1; i < order.size(); i++) {
+                        bool ref = asc ? reference_less(*snap, col, order[i - 1], order[i]) : reference_less(*snap, col, order[i], order[i - 1]);
+                        assert(keys.less(order[i - 1], order[i]) == ref);
+                    }
+                }
+
+                for (size_t i = 0; i < snap->size(); i++) {
+                    bool tcp = snap->protocol[i] == ConnectionProtocol::PROTO_TCP;
+                    bool has = Columns::Has(col, *snap, i);
+                    assert(has || !tcp);
+                    if (!has) assert(Columns::Text(col, *snap, i).empty());
+                }
+            }
+        }
+    }
+
+    std::cout << "column order: ok" << std::endl;
+}
+
+// ids of RoaringBitmap, in increasing order
+std::vector<uint32_t> roaring_ids(const RoaringBitmap& bitmap) {
+    std::vector<uint32_t> ids;
+    bitmap.for_each([&ids](uint32_t id) { ids.push_back(id); });
+    return ids;
+}
+
+// RoaringBitmap holds the same ids as a sorted vector through adds and removes, and its and, or, and not and counts
+// match std::set_* over every pair of sets with array chunks, bitmap chunks and both, also around ArrayMax and DenseMin
+void test_RoaringBitmap() {
+    std::mt19937 rng(17);
+
+    auto check = [](const RoaringBitmap& bitmap, const std::vector<uint32_t>& ids) {
+        assert(bitmap.count() == ids.size() && bitmap.empty() == ids.empty());
+        assert(roaring_ids(bitmap) == ids);
+
+        for (size_t k = 0; k < ids.size(); k += 97) assert(bitmap.contains(ids[k]) && !bitmap.contains(ids[k] ^ 0x80000000));
+
+        Bitmap dense = bitmap.to_bitmap(0x18000);
+        for (uint32_t id : ids) assert(id >= 0x18000 || dense.test(id));
+        assert(dense.count() == (size_t)(std::lower_bound(ids.begin(), ids.end(), 0x18000u) - ids.begin()));
+    };
+
+    // per chunk id counts: empty, arrays, around DenseMin and ArrayMax, bitmaps, full chunk
+    const size_t dense_min = RoaringBitmap::DenseMin, array_max = RoaringBitmap::ArrayMax;
+    std::vector<std::vector<uint32_t>> sets;
+    for (size_t per_chunk : { (size_t)0, (size_t)1, (size_t)100, dense_min - 1, dense_min, array_max, array_max + 1, (size_t)20000, (size_t)65536 }) {
+        // chunk 0 and 2 of the given size, chunk 1 small, so that chunks of one set differ
+        std::vector<uint32_t> ids;
+        for (uint32_t chunk : { 0u, 1u, 2u }) {
+            std::vector<uint32_t> lows(65536);
+            std::iota(lows.begin(), lows.end(), 0);
+            std::shuffle(lows.begin(), lows.end(), rng);
+            lows.resize(chunk == 1 ? std::min<size_t>(per_chunk, 50) : per_chunk);
+            for (uint32_t low : lows) ids.push_back(chunk << 16 | low);
+        }
+        std::sort(ids.begin(), ids.end());
+        sets.push_back(ids);
+    }
+
+    std::vector<RoaringBitmap> bitmaps;
+    for (const auto& ids : sets) {
+        auto shuffled = ids;
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+        RoaringBitmap bitmap;
+        for (uint32_t id : shuffled) bitmap.add(id);
+        bitmap.add(shuffled.empty() ? 0 : shuffled[0]); // already there
+        if (shuffled.empty()) bitmap.remove(0);
+
+        check(bitmap, ids);
+        bitmaps.push_back(std::move(bitmap));
+    }
+
+    for (size_t a = 0; a < sets.size(); a++) {
+        for (size_t b = 0; b < sets.size(); b++) {
+            std::vector<uint32_t> expected;
+            std::set_intersection(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), std::back_inserter(expected));
+            check(RoaringBitmap::And(bitmaps[a], bitmaps[b]), expected);
+            assert(RoaringBitmap::AndCount(bitmaps[a], bitmaps[b]) == expected.size());
+
+            expected.clear();
+            std::set_union(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), std::back_inserter(expected));
+            check(RoaringBitmap::Or(bitmaps[a], bitmaps[b]), expected);
+
+            expected.clear();
+            std::set_difference(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(), std::back_inserter(expected));
+            check(RoaringBitmap::AndNot(bitmaps[a], bitmaps[b]), expected);
+        }
+    }
+
+    // a chunk goes dense past ArrayMax, stays dense while removals keep it at DenseMin or above, then becomes an array;
+    // in every state it equals the bitmap built from scratch, and sizes moving around ArrayMax keep the same ids
+    std::vector<uint32_t> lows(array_max + 200);
+    std::iota(lows.begin(), lows.end(), 0);
+    std::shuffle(lows.begin(), lows.end(), rng);
+
+    RoaringBitmap bitmap;
+    std::vector<uint32_t> ids;
+    auto compare = [&bitmap, &ids, &check]() {
+        auto sorted = ids;
+        std::sort(sorted.begin(), sorted.end());
+        check(bitmap, sorted);
+
+        RoaringBitmap fresh;
+        for (uint32_t id : sorted) fresh.add(id);
+        assert(bitmap == fresh);
+    };
+
+    for (uint32_t low : lows) {
+        bitmap.add(low);
+        ids.push_back(low);
+    }
+    compare();
+
+    for (int round = 0; round < 4; round++) {
+        for (int k = 0; k < 300; k++) {
+            bitmap.remove(ids.back());
+            ids.pop_back();
+        }
+        compare();
+        for (int k = 0; k < 150; k++) {
+            uint32_t low = 10000 + round * 1000 + k;
+            bitmap.add(low);
+            ids.push_back(low);
+        }
+        compare();
+    }
+
+    while (ids.size() > dense_min - 10) {
+        bitmap.remove(ids.back());
+        ids.pop_back();
+    }
+    compare();
+
+    while (!ids.empty()) {
+        bitmap.remove(ids.back());
+        ids.pop_back();
+    }
+    compare();
+    bitmap.remove(12345); // not there, bitmap has no chunks
+
+    std::cout << "roaring bitmap: ok" << std::endl;
+}
+
+// Query matches the same rows as the predicate it is written for, row by row (Matcher, postfix program with jumps),
+// over the whole table (column kernels and bitmaps), and through find_all and find_next of a sorted view
+void check_query(const std::shared_ptr<const ConnectionsSnapshot>& snap, const wchar_t* text, const std::function<bool(size_t)>& pred) {
+    auto query = Query::Compile(text);
+    auto rows = query.bind(*snap);
+    auto table = query.bind(*snap, true);
+
+    for (uint32_t i = 0; i < snap->size(); i++) {
+        bool expected = pred(i);
+        assert(rows(i) == expected);
+        assert(table(i) == expected);
+    }
+
+    auto view = SortView::make(snap, SortBy::LocalPort, false);
+    std::vector<uint32_t> expected;
+    for (size_t k = 0; k < view.size(); k++) {
+        if (pred(view[k])) expected.push_back((uint32_t)k);
+    }
+    assert(query.find_all(view) == expected);
+
+    auto next = query.find_next(view, Query::npos, true);
+    assert(expected.empty() ? !next : next && *next == expected[0]);
+    auto prev = query.find_next(view, Query::npos, false);
+    assert(expected.empty() ? !prev : prev && *prev == expected.back());
+}
+
+// Queries of every kind of test, != on local and remote fields (UDP rows never match remote ones), precedence
+// of not, and, or and parentheses, port ranges and sets, CIDR prefixes of both families, text and service tests;
+// malformed queries fail at the position of the offending token
+void test_Query() {
+    std::vector<std::unique_ptr<Process>> procs;
+    auto snap = std::make_shared<const ConnectionsSnapshot>(tied_snapshot(3000, procs, 19));
+    const auto& s = *snap;
+
+    auto tcp = [&s](size_t i) { return s.protocol[i] == ConnectionProtocol::PROTO_TCP; };
+    auto v4 = [&s](size_t i) { return s.family[i] == ProtocolFamily::INET; };
+    auto lport = [&s](size_t i) { return s.local_port[i]; };
+    auto rport = [&s](size_t i) { return s.remote_port[i]; };
+    auto state = [&s](size_t i) { return s.state[i]; };
+    // host order IPv4 address, first `bits` of it
+    auto net4 = [](const IPAddress& addr, int bits) { return ntohl(addr.ipv4()) >> (32 - bits); };
+    auto name = [&s](size_t i) { return s.processes[s.process[i]]->m_name; };
+
+    check_query(snap, L"lport=80", [&](size_t i) { return lport(i) == 80; });
+    check_query(snap, L"lport!=80", [&](size_t i) { return lport(i) != 80; });
+    check_query(snap, L"rport!=443", [&](size_t i) { return tcp(i) && rport(i) != 443; });
+    check_query(snap, L"not rport=443", [&](size_t i) { return !(tcp(i) && rport(i) == 443); });
+    check_query(snap, L"state!=LISTEN", [&](size_t i) { return tcp(i) && state(i) != MIB_TCP_STATE_LISTEN; });
+    check_query(snap, L"not state=listen", [&](size_t i) { return !(tcp(i) && state(i) == MIB_TCP_STATE_LISTEN); });
+    check_query(snap, L"proto=udp and rport!=443", [&](size_t i) { return false; });
+    check_query(snap, L"port!=80", [&](size_t i) { return lport(i) != 80 && !(tcp(i) && rport(i) == 80); });
+    check_query(snap, L"port=443", [&](size_t i) { return lport(i) == 443 || (tcp(i) && rport(i) == 443); });
+
+    check_query(snap, L"lport=80 or lport=81 and proto=udp", [&](size_t i) { return lport(i) == 80 || (lport(i) == 81 && !tcp(i)); });
+    check_query(snap, L"(lport=80 or lport=81) and proto=udp", [&](size_t i) { return (lport(i) == 80 || lport(i) == 81) && !tcp(i); });
+    check_query(snap, L"not lport=80 and proto=tcp", [&](size_t i) { return lport(i) != 80 && tcp(i); });
+    check_query(snap, L"not (lport=80 and proto=tcp)", [&](size_t i) { return !(lport(i) == 80 && tcp(i)); });
+    check_query(snap, L"lport=80 OR af=4 AND state=syn", [&](size_t i) {
+        return lport(i) == 80 || (v4(i) && tcp(i) && (state(i) == MIB_TCP_STATE_SYN_SENT || state(i) == MIB_TCP_STATE_SYN_RCVD));
+        });
+    check_query(snap, L"lport=80 and lport=81 or lport=82 and not lport=83", [&](size_t i) { return lport(i) == 82; });
+    check_query(snap, L"not not (af=6 or state=closed)", [&](size_t i) { return !v4(i) || (tcp(i) && state(i) == MIB_TCP_STATE_CLOSED); });
+
+    check_query(snap, L"rport in 440-441,443", [&](size_t i) { return tcp(i) && (rport(i) == 440 || rport(i) == 441 || rport(i) == 443); });
+    check_query(snap, L"lport>=82", [&](size_t i) { return lport(i) >= 82; });
+    check_query(snap, L"lport<81", [&](size_t i) { return lport(i) < 81; });
+    check_query(snap, L"rport>441", [&](size_t i) { return tcp(i) && rport(i) > 441; });
+    check_query(snap, L"lport<0 or lport>65535", [&](size_t i) { return false; });
+    check_query(snap, L"pid in 8-12,80", [&](size_t i) { return (s.pid[i] >= 8 && s.pid[i] <= 12) || s.pid[i] == 80; });
+
+    check_query(snap, L"laddr in 10.0.0.2/31", [&](size_t i) { return v4(i) && net4(s.local_addr[i], 31) == 0x0a000002 >> 1; });
+    check_query(snap, L"raddr=fe80::/10", [&](size_t i) {
+        return tcp(i) && !v4(i) && s.remote_addr[i][0] == 0xfe && (s.remote_addr[i][1] & 0xc0) == 0x80;
+        });
+    check_query(snap, L"raddr!=10.0.0.0/8", [&](size_t i) { return tcp(i) && !(v4(i) && s.remote_addr[i].is_v4_mapped() && net4(s.remote_addr[i], 8) == 10); });
+    check_query(snap, L"laddr in 10.0.0.0/31,fe80::3", [&](size_t i) {
+        return v4(i) ? net4(s.local_addr[i], 31) == 0x0a000000 >> 1 : s.local_addr[i][0] == 0xfe && s.local_addr[i][15] == 3;
+        });
+    check_query(snap, L"laddr=0.0.0.0/0", [&](size_t i) { return v4(i); });
+    // IPv4 addresses are IPv4-mapped IPv6 ones, but IPv6 prefixes do not match IPv4 rows
+    check_query(snap, L"laddr=::/0", [&](size_t i) { return !v4(i); });
+    check_query(snap, L"laddr=::ffff:0:0/96", [&](size_t i) { return false; });
+
+    check_query(snap, L"proc=PROCESS3.EXE", [&](size_t i) { return name(i) == L"process3.exe"; });
+    check_query(snap, L"proc~SS1 or path~x", [&](size_t i) { return name(i).find(L"ss1") != std::wstring::npos; });
+    check_query(snap, L"proc^\"process \"", [&](size_t i) { return false; });
+    check_query(snap, L"proc^\"PROCESS\" or proc=x", [&](size_t i) { return true; });
+    check_query(snap, L"laddr~0.0.3", [&](size_t i) { return s.local_addr_str(i).find(L"0.0.3") != std::wstring::npos; });
+    check_query(snap, L"raddr^FE80 and not rport=440", [&](size_t i) {
+        return tcp(i) && s.remote_addr_str(i).rfind(L"fe80", 0) == 0 && rport(i) != 440;
+        });
+    check_query(snap, L"rport~HTTP", [&](size_t i) {
+        return tcp(i) && TextSearch::Lower(Net::ConvertPortToService(rport(i), "tcp")).find(L"http") != std::wstring::npos;
+        });
+
+    // text, position of the token that fails
+    const std::vector<std::pair<const wchar_t*, size_t>> errors{
+        { L"", 0 }, { L"foo=1", 0 }, { L"lport", 5 }, { L"lport=", 6 }, { L"lport=70000", 6 }, { L"lport=5-3", 6 },
+        { L"lport<1,2", 8 }, { L"proc<a", 4 }, { L"raddr=10.0.0.0/", 6 }, { L"raddr=10.0.0.0/abc", 6 }, { L"raddr=10.0.0.0/8x", 6 },
+        { L"raddr=10.0.0.0/33", 6 }, { L"(lport=80", 9 }, { L"lport=80 and", 12 }, { L"lport=80)", 8 }, { L"state=bogus", 6 },
+        { L"proc=\"x", 5 }, { L"lport=80 lport=81", 9 }, { L"lport~=80", 6 }, { L"not", 3 },
+    };
+    for (const auto& [text, pos] : errors) {
+        bool failed = false;
+        try {
+            Query::Compile(text);
+        }
+        catch (const QueryError& e) {
+            failed = true;
+            assert(e.position() == pos);
+        }
+        assert(failed);
+    }
+
+    std::cout << "query: ok" << std::endl;
+}
+
+// AcquisitionFilter on raw MIB rows: ports are compared in host order while rows have them in network order,
+// IPv4 prefixes count bits of IPv4-mapped addresses (/8 is 104), listeners alone fetch only the listener table,
+// UDP tables are dropped when remote fields are constrained, and malformed prefixes are rejected
+void test_AcquisitionFilter() {
+    using Filter = AcquisitionFilter;
+
+    MIB_TCPROW_OWNER_PID tcp4{};
+    tcp4.dwState = MIB_TCP_STATE_ESTAB;
+    tcp4.dwLocalAddr = htonl(0xc0a80105);
+    tcp4.dwLocalPort = htons(50000);
+    tcp4.dwRemoteAddr = htonl(0x0a010203);
+    tcp4.dwRemotePort = htons(443);
+
+    MIB_TCPROW_OWNER_PID listener4{};
+    listener4.dwState = MIB_TCP_STATE_LISTEN;
+    listener4.dwLocalPort = htons(443);
+
+    MIB_TCP6ROW_OWNER_PID tcp6{};
+    tcp6.dwState = MIB_TCP_STATE_ESTAB;
+    tcp6.ucLocalAddr[0] = 0xfe;
+    tcp6.ucLocalAddr[1] = 0x80;
+    tcp6.ucLocalAddr[15] = 1;
+    tcp6.dwLocalPort = htons(50001);
+    tcp6.ucRemoteAddr[0] = 0x20;
+    tcp6.ucRemoteAddr[1] = 0x01;
+    tcp6.ucRemoteAddr[2] = 0x0d;
+    tcp6.ucRemoteAddr[3] = 0xb8;
+    tcp6.dwRemotePort = htons(443);
+
+    MIB_UDPROW_OWNER_PID udp4{};
+    udp4.dwLocalAddr = htonl(0x0a000001);
+    udp4.dwLocalPort = htons(53);
+
+    MIB_UDP6ROW_OWNER_PID udp6{};
+    udp6.dwLocalPort = htons(443);
+
+    Filter all;
+    assert(all.keeps_all() && all.tcp_table_class() == TCP_TABLE_OWNER_PID_ALL);
+    assert(all.matches(tcp4) && all.matches(listener4) && all.matches(tcp6) && all.matches(udp4) && all.matches(udp6));
+    for (auto proto : { ConnectionProtocol::PROTO_TCP, ConnectionProtocol::PROTO_UDP }) {
+        for (auto af : { ProtocolFamily::INET, ProtocolFamily::INET6 }) assert(all.accepts_table(proto, af));
+    }
+
+    // listeners on :443, UDP tables are still fetched unless udp is off
+    Filter listeners;
+    listeners.tcp_states = Filter::StateBit(MIB_TCP_STATE_LISTEN);
+    listeners.local_ports = { { 443, 443 } };
+    assert(!listeners.keeps_all() && listeners.tcp_table_class() == TCP_TABLE_OWNER_PID_LISTENER);
+    assert(listeners.matches(listener4) && !listeners.matches(tcp4) && !listeners.matches(tcp6));
+    assert(listeners.matches(udp6) && !listeners.matches(udp4));
+    assert(listeners.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET));
+    listeners.udp = false;
+    assert(!listeners.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET) && !listeners.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET6));
+    assert(listeners.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET) && listeners.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET6));
+
+    // port in host order, the row has it in network order
+    Filter host_order;
+    host_order.local_ports = { { 0xbb01, 0xbb01 } };
+    assert(!host_order.matches(listener4));
+
+    Filter connections;
+    connections.tcp_states = Filter::AllTcpStates & ~Filter::StateBit(MIB_TCP_STATE_LISTEN);
+    assert(connections.tcp_table_class() == TCP_TABLE_OWNER_PID_CONNECTIONS);
+    assert(connections.matches(tcp4) && !connections.matches(listener4));
+    connections.tcp_states |= Filter::StateBit(MIB_TCP_STATE_LISTEN) | Filter::StateBit(MIB_TCP_STATE_ESTAB);
+    assert(connections.tcp_table_class() == TCP_TABLE_OWNER_PID_ALL);
+    connections.tcp_states = 0;
+    assert(!connections.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET));
+
+    // UDP rows have no remote fields, so their tables are not fetched when remote ones are constrained
+    Filter remote_https;
+    remote_https.remote_ports = { { 443, 443 } };
+    assert(remote_https.matches(tcp4) && remote_https.matches(tcp6) && !remote_https.matches(listener4));
+    assert(!remote_https.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET) && !remote_https.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET6));
+    assert(remote_https.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET6));
+
+    Filter v6_only;
+    v6_only.ipv4 = false;
+    assert(!v6_only.accepts_table(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET) && v6_only.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET6));
+
+    auto ten = AddressPrefix::Parse(L"10.0.0.0/8");
+    assert(ten && ten->af == ProtocolFamily::INET && ten->bits == 104);
+    assert(ten->addr == IPAddress::FromIPv4(htonl(0x0a000000)) && ten->mask == IPAddress::PrefixMask(104));
+    assert(ten->mask[11] == 0xff && ten->mask[12] == 0xff && ten->mask[13] == 0);
+
+    Filter remote_ten;
+    remote_ten.remote_addrs = { *ten };
+    assert(remote_ten.matches(tcp4) && !remote_ten.matches(tcp6) && !remote_ten.matches(listener4));
+    tcp4.dwRemoteAddr = htonl(0x0b010203);
+    assert(!remote_ten.matches(tcp4));
+
+    // host bits are cleared, so 10.1.2.3/16 is 10.1.0.0/16
+    auto sixteen = AddressPrefix::Parse(L"10.1.2.3/16");
+    assert(sixteen && sixteen->bits == 112 && sixteen->addr == IPAddress::FromIPv4(htonl(0x0a010000)));
+
+    Filter local_ten;
+    local_ten.local_addrs = { *AddressPrefix::Parse(L"10.0.0.0/31") };
+    assert(local_ten.matches(udp4) && !local_ten.matches(listener4) && !local_ten.matches(udp6));
+    assert(local_ten.accepts_table(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET));
+
+    auto doc = AddressPrefix::Parse(L"2001:db8::/32");
+    assert(doc && doc->af == ProtocolFamily::INET6 && doc->bits == 32);
+    Filter remote_doc;
+    remote_doc.remote_addrs = { *doc };
+    assert(remote_doc.matches(tcp6) && !remote_doc.matches(listener4));
+
+    auto host = AddressPrefix::Parse(L"fe80::1");
+    assert(host && host->bits == 128);
+
+    for (auto bad : { L"10.0.0.0/", L"10.0.0.0/abc", L"10.0.0.0/8x", L"10.0.0.0/33", L"10.0.0.0/-1", L"10.0.0.0/ 8", L"fe80::/129", L"10.0.0", L"host/8", L"" }) {
+        assert(!AddressPrefix::Parse(bad));
+    }
+
+    std::cout << "acquisition filter: ok" << std::endl;
+}
+
+// IncrementalSearch gives the documents a fresh search and TrigramIndex::find give, and those of rows whose
+// process name, path, local or remote address or domain contain the text, checked field by field:
+// while text is typed on (narrowing), erased (widening) or replaced, across updates that remove rows and reuse
+// their document ids, add rows sharing a document, and change domains of remote addresses
+void test_IncrementalSearch() {
+    std::mt19937 rng(23);
+
+    std::vector<ProcessPtr> procs;
+    for (int i = 0; i < 30; i++) {
+        procs.push_back(std::make_shared<Process>(i * 4 + 4));
+        procs.back()->m_name = L"Process" + std::to_wstring(i) + L".exe";
+        procs.back()->m_path = L"C:\\Apps\\Vendor" + std::to_wstring(i % 5) + L"\\" + procs.back()->m_name;
+    }
+
+    // few distinct keys, so that rows often share a document
+    auto make_row = [&rng, &procs]() {
+        const auto& proc = procs[rng() % procs.size()];
+        if (rng() % 4 == 0) {
+            MIB_UDPROW_OWNER_PID row{};
+            row.dwLocalAddr = htonl(0x0a000000 | (rng() % 8));
+            row.dwLocalPort = htons((USHORT)(53 + rng() % 2));
+            row.dwOwningPid = proc->m_pid;
+            return std::make_shared<ConnectionEntry>(row, proc);
+        }
+        MIB_TCPROW_OWNER_PID row{};
+        row.dwState = MIB_TCP_STATE_ESTAB;
+        row.dwLocalAddr = htonl(0x0a000000 | (rng() % 8));
+        row.dwLocalPort = htons((USHORT)(80 + rng() % 3));
+        row.dwRemoteAddr = htonl(0x0a000100 | (rng() % 8));
+        row.dwRemotePort = htons(443);
+        row.dwOwningPid = proc->m_pid;
+        return std::make_shared<ConnectionEntry>(row, proc);
+    };
+
+    TrigramIndex index;
+    TrigramIndex::Changes changes;
+    ConnectionEntryPtrs rows;
+    std::unordered_map<std::wstring, std::wstring> domains;
+
+    for (int i = 0; i < 400; i++) {
+        rows.push_back(make_row());
+        index.add(*rows.back(), changes);
+    }
+
+    auto contains = [](const std::wstring& field, const std::wstring& needle) {
+        return TextSearch::Lower(field).find(needle) != std::wstring::npos;
+    };
+
+    IncrementalSearch search;
+
+    auto check = [&](const std::wstring& text) {
+        const std::wstring needle = TextSearch::Lower(text);
+
+        std::vector<TrigramIndex::DocId> expected;
+        for (const auto& row : rows) {
+            bool match = contains(row->get_process_name(), needle) || contains(row->proc().m_path, needle) || contains(row->local_addr_str(), needle);
+            if (row->protocol() == ConnectionProtocol::PROTO_TCP) {
+                auto domain = domains.find(row->remote_addr_str());
+                match = match || contains(row->remote_addr_str(), needle) || (domain != domains.end() && contains(domain->second, needle));
+            }
+            if (match) expected.push_back(index.doc_of(MakeConnectionKey(*row)));
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+        IncrementalSearch fresh;
+        fresh.search(index, text);
+
+        assert(search.results() == expected);
+        assert(fresh.results() == expected);
+        assert(index.find(needle) == expected);
+
+        for (TrigramIndex::DocId id = 0; id < index.capacity() + 2; id++) {
+            assert(search.matches(id) == std::binary_search(expected.begin(), expected.end(), id));
+        }
+    };
+
+    // typed on, erased, replaced by unrelated text
+    const std::vector<std::pair<std::wstring, bool>> typed{
+        { L"p", false }, { L"pR", true }, { L"PRO", true }, { L"proc", true }, { L"process1", true }, { L"process12", true },
+        { L"process1", false }, { L"pro", false }, { L"0.1.", false }, { L"10.0.1.3", true }, { L"vendor3\\", false },
+    };
+    for (const auto& [text, narrows] : typed) {
+        assert(search.search(index, text) == narrows);
+        check(text);
+    }
+
+    // removed rows free their documents, added ones reuse them, domains change text of present documents
+    for (int round = 0; round < 6; round++) {
+        const std::wstring text = round % 2 ? L"cdn" : L"process2";
+        search.search(index, text);
+
+        changes = {};
+        std::shuffle(rows.begin(), rows.end(), rng);
+        for (size_t k = 0; k < rows.size() / 3; k++) {
+            index.remove(*rows.back(), changes);
+            rows.pop_back();
+        }
+        for (int k = 0; k < 120; k++) {
+            rows.push_back(make_row());
+            index.add(*rows.back(), changes);
+        }
+
+        std::wstring remote = L"10.0.1." + std::to_wstring(rng() % 8);
+        std::wstring domain = L"Edge" + std::to_wstring(round) + (round % 2 ? L".CDN.example" : L".example");
+        domains[remote] = TextSearch::Lower(domain);
+        index.set_domain(remote, domain, changes);
+
+        search.update(index, changes);
+        check(text);
+
+        // typing on after an update narrows the updated result
+        const std::wstring longer = text + (round % 2 ? L".e" : L"1");
+        assert(search.search(index, longer) == true);
+        check(longer);
+    }
+
+    // new domain replaces the old one, documents no longer match by it
+    search.search(index, L"cdn");
+    for (const wchar_t* domain : { L"A.CDN.example", L"b.example" }) {
+        changes = {};
+        domains[L"10.0.1.1"] = TextSearch::Lower(domain);
+        index.set_domain(L"10.0.1.1", domain, changes);
+        assert(!changes.added.empty());
+
+        search.update(index, changes);
+        check(L"cdn");
+    }
+
+    search.clear();
+    assert(!search.active() && search.results().empty() && !search.matches(0));
+    assert(!search.search(index, L""));
+
+    std::cout << "incremental search: ok" << std::endl;
+}
+
+// Substring kernels mark the strings a naive loop over lowercased strings finds the needle in: scalar, SSE2 and,
+// when the CPU has it, AVX2 blocks, and Find which picks one of them. Needles of 1, 2 and more characters (first and
+// last character compares only, or wmemcmp too), columns shorter than one block, matches in the last partial block,
+// upper case and non-ASCII letters in the strings
+void test_TextSearch() {
+    using namespace TextSearch;
+
+    std::mt19937 rng(19);
+
+    auto check = [](const std::vector<std::wstring>& strs, const std::wstring& needle) {
+        const auto column = TextColumn::Build(strs.size(), [&](size_t i) { return strs[i]; });
+
+        Bitmap expected(strs.size());
+        for (size_t i = 0; i < strs.size(); i++) {
+            if (Lower(strs[i]).find(needle) != std::wstring::npos) expected.set(i);
+        }
+
+        auto same = [&](const Bitmap& hits) { return hits.size() == expected.size() && hits.words() == expected.words(); };
+
+        Bitmap scalar(column.size());
+        detail::FindSubstring<detail::ScalarBlock>(column, needle, scalar);
+        assert(same(scalar));
+
+#ifdef TCPSPY_X86
+        Bitmap sse2(column.size());
+        detail::FindSubstring<detail::Sse2Block>(column, needle, sse2);
+        assert(same(sse2));
+
+        if (Cpu::HasAvx2()) {
+            Bitmap avx2(column.size());
+            detail::FindSubstring<detail::Avx2Block>(column, needle, avx2);
+            assert(same(avx2));
+        }
+#endif
+
+        assert(same(Find(column, needle, Mode::Substring)));
+    };
+
+    // shorter than one SSE2 / AVX2 block, needle in the first and last characters
+    check({ L"aB" }, L"a");
+    check({ L"aB" }, L"b");
+    check({ L"aB" }, L"ab");
+    check({ L"aB" }, L"ba");
+    check({ L"", L"X", L"", L"x" }, L"x");
+    check({ L"abc", L"cAB" }, L"cab");
+    check({ L"PROC" }, L"procs");
+
+    // match ends at the last character of the text, behind full blocks, with needles of 1 to 17 characters
+    for (size_t len = 1; len <= 40; len++) {
+        for (size_t n : { 1, 2, 3, 5, 17 }) {
+            if (n > len) continue;
+            std::wstring str(len - n, L'a');
+            std::wstring needle;
+            for (size_t k = 0; k < n; k++) needle += (wchar_t)(L'b' + k % 3);
+            check({ str + needle }, needle);
+            check({ L"bc", str + needle }, needle);
+
+            // upper case match, the same needle unmatched in a near miss before it
+            std::wstring upper = needle;
+            for (auto& c : upper) c = (wchar_t)std::towupper(c);
+            std::wstring miss = needle;
+            miss.back() = L'a';
+            check({ miss + str + upper }, needle);
+        }
+    }
+
+    // a match never spans two strings
+    check({ L"ab", L"cd" }, L"bc");
+    check({ L"aaaaaaaaaaaaaaaaab", L"caaaaaaaaaaaaaaaaaaa" }, L"bc");
+
+    // random strings over a few letters of both cases, ASCII and not, so that first and last characters repeat
+    const std::wstring letters = L"abAB.\u00c4\u00e4";
+    auto random_str = [&](size_t max_len) {
+        std::wstring str(rng() % (max_len + 1), L' ');
+        for (auto& c : str) c = letters[rng() % letters.size()];
+        return str;
+    };
+
+    for (size_t rows : { 0, 1, 2, 3, 7, 20, 100 }) {
+        for (int round = 0; round < 20; round++) {
+            std::vector<std::wstring> strs;
+            for (size_t i = 0; i < rows; i++) strs.push_back(random_str(round % 2 ? 6 : 40));
+
+            for (size_t n : { 1, 2, 3, 5, 17 }) {
+                std::wstring needle(n, L' ');
+                for (auto& c : needle) c = LowerChar(letters[rng() % letters.size()]);
+                check(strs, needle);
+
+                // taken from a string, so that it matches at least once
+                if (!strs.empty()) {
+                    const auto& str = strs[rng() % strs.size()];
+                    if (str.size() >= n) check(strs, Lower(str.substr(rng() % (str.size() - n + 1), n)));
+                }
+            }
+        }
+    }
+
+    std::cout << "text search: ok" << std::endl;
+}
+
+// ColumnScan kernels give the bitmap of a row by row check, for columns of 0 to 1000 rows, most of them not a multiple
+// of 64 (rows of the last word are checked by scalar code): port ranges from 0 and to 0xffff, empty and inverted ones,
+// 32-bit ranges, masks over values from 32 on, port sets of 8 ranges (OR of range kernels) and 9 ranges (lookup in the set),
+// address prefixes of 0 to 128 bits over IPv4-mapped and IPv6 addresses
+void test_ColumnScan() {
+    std::mt19937 rng(22);
+
+    // every bit is that of pred, bits past the last row stay clear
+    auto same = [](const Bitmap& hits, size_t n, const std::function<bool(size_t)>& pred) {
+        if (hits.size() != n) return false;
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (hits.test(i) != pred(i)) return false;
+            count += pred(i) ? 1 : 0;
+        }
+        return hits.count() == count;
+    };
+
+    const USHORT edge_ports[]{ 0, 1, 79, 80, 443, 444, 0x7fff, 0x8000, 0xfffe, 0xffff };
+    const DWORD edge_values[]{ 0, 1, 2, 12, 31, 32, 33, 63, 64, 0x7fffffff, 0x80000000, 0xffffffff };
+
+    for (size_t n : { 0, 1, 31, 63, 64, 65, 100, 127, 128, 129, 1000 }) {
+        std::vector<USHORT> ports(n);
+        for (auto& port : ports) port = rng() % 2 ? edge_ports[rng() % std::size(edge_ports)] : (USHORT)rng();
+
+        std::vector<std::pair<USHORT, USHORT>> port_ranges{
+            { 0, 0 }, { 0, 80 }, { 0, 0xffff }, { 80, 443 }, { 443, 80 }, { 444, 0xffff }, { 0xffff, 0xffff }, { 0x7fff, 0x8000 },
+        };
+        for (int k = 0; k < 8; k++) {
+            USHORT a = (USHORT)rng(), b = (USHORT)rng();
+            port_ranges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+        for (const auto& [first, last] : port_ranges) {
+            auto hits = ColumnScan::InRange(ports, first, last);
+            assert(same(hits, n, [&](size_t i) { return first <= ports[i] && ports[i] <= last; }));
+        }
+        for (USHORT port : edge_ports) {
+            assert(same(ColumnScan::Equal(ports, port), n, [&](size_t i) { return ports[i] == port; }));
+        }
+
+        std::vector<DWORD> values(n);
+        for (auto& value : values) value = rng() % 2 ? edge_values[rng() % std::size(edge_values)] : (DWORD)rng();
+
+        std::vector<std::pair<DWORD, DWORD>> value_ranges{
+            { 0, 0 }, { 0, 31 }, { 0, 0xffffffff }, { 32, 0xffffffff }, { 64, 12 }, { 0x7fffffff, 0x80000000 }, { 0xffffffff, 0xffffffff },
+        };
+        for (int k = 0; k < 8; k++) {
+            DWORD a = (DWORD)rng(), b = (DWORD)rng();
+            value_ranges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+        for (const auto& [first, last] : value_ranges) {
+            auto hits = ColumnScan::InRange(values, first, last);
+            assert(same(hits, n, [&](size_t i) { return first <= values[i] && values[i] <= last; }));
+        }
+
+        // values from 32 on shift the bit out, never in
+        for (uint32_t mask : { 0u, 1u, 1u << 1 | 1u << 12, 0x80000000u, 0xffffffffu, (uint32_t)rng(), (uint32_t)rng() }) {
+            auto hits = ColumnScan::InMask(values, mask);
+            assert(same(hits, n, [&](size_t i) { return values[i] < 32 && ((mask >> values[i]) & 1); }));
+        }
+
+        // disjoint ranges, with port 0 and 0xffff among them: up to 8 are range kernels, from 9 on the set is looked up
+        for (size_t count : { 1, 7, 8, 9, 10, 40 }) {
+            std::vector<uint64_t> set(65536 / 64);
+            auto add = [&set](DWORD first, DWORD last) {
+                for (DWORD port = first; port <= last; port++) set[port >> 6] |= 1ull << (port & 63);
+            };
+
+            add(0, rng() % 3);
+            for (size_t k = 1; k + 1 < count; k++) {
+                DWORD first = (DWORD)(k * 65536 / count) + rng() % 100;
+                add(first, first + rng() % 300);
+            }
+            if (count > 1) add(0xffff - rng() % 3, 0xffff);
+
+            auto hits = ColumnScan::InSet(ports, set);
+            assert(same(hits, n, [&](size_t i) { return (set[ports[i] >> 6] >> (ports[i] & 63)) & 1; }));
+        }
+
+        // addresses differ from net in one random bit, in a byte of their own or in all bytes
+        IPAddress net6{};
+        for (auto& byte : net6.bytes) byte = (UCHAR)rng();
+        const IPAddress net4 = IPAddress::FromIPv4((DWORD)rng());
+
+        std::vector<IPAddress> addrs(n);
+        for (auto& addr : addrs) {
+            addr = rng() % 2 ? net4 : net6;
+            switch (rng() % 3) {
+            case 0: addr[rng() % 16] ^= (UCHAR)(1 << rng() % 8); break;
+            case 1: addr[rng() % 16] = (UCHAR)rng(); break;
+            default: for (auto& byte : addr.bytes) byte = (UCHAR)rng(); break;
+            }
+        }
+
+        for (const IPAddress& net : { net4, net6 }) {
+            for (UCHAR bits : { 0, 1, 7, 8, 9, 64, 95, 96, 97, 104, 120, 127, 128 }) {
+                auto hits = ColumnScan::InPrefix(addrs, net, bits);
+                assert(same(hits, n, [&](size_t i) {
+                    for (size_t b = 0; b < bits; b++) {
+                        if (((addrs[i][b / 8] ^ net[b / 8]) >> (7 - b % 8)) & 1) return false;
+                    }
+                    return true;
+                    }));
+            }
+        }
+    }
+
+    std::cout << "column scan: ok" << std::endl;
+}
+
+// Fetch of rows of one table, as the system fills it: asks for a bigger buffer when rows do not fit.
+// Fails with error if it is set. on_fetch, if set, is called first
+template<typename T, typename R>
+TableFetch fake_fetch(const std::vector<R>& rows, const DWORD& error, std::atomic<size_t>& fetches, const std::function<void()>& on_fetch) {
+    return [&rows, &error, &fetches, &on_fetch](PVOID table, PDWORD size, ULONG) -> DWORD {
+        fetches++;
+        if (on_fetch) on_fetch();
+        if (error != NO_ERROR) return error;
+
+        const DWORD needed = (DWORD)(offsetof(T, table) + rows.size() * sizeof(R));
+        if (*size < needed) {
+            *size = needed;
+            return ERROR_INSUFFICIENT_BUFFER;
+        }
+
+        auto out = (T*)table;
+        out->dwNumEntries = (DWORD)rows.size();
+        std::copy(rows.begin(), rows.end(), out->table);
+        return NO_ERROR;
+    };
+}
+
+// Rows of the four tables that a manager fetches instead of the system ones. Rows belong to this process,
+// so that it is opened as the owner of them
+struct FakeTables {
+    std::vector<MIB_TCPROW_OWNER_PID> tcp4;
+    std::vector<MIB_TCP6ROW_OWNER_PID> tcp6;
+    std::vector<MIB_UDPROW_OWNER_PID> udp4;
+    std::vector<MIB_UDP6ROW_OWNER_PID> udp6;
+    DWORD tcp4_error{ NO_ERROR }, tcp6_error{ NO_ERROR }, udp4_error{ NO_ERROR }, udp6_error{ NO_ERROR };
+    std::atomic<size_t> fetches{ 0 };
+    // called on the worker of every fetch, e.g. to hold an update while it acquires tables
+    std::function<void()> on_fetch;
+
+    void attach(ConnectionsTableManager& mgr) {
+        mgr.set_table_fetch(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET, fake_fetch<MIB_TCPTABLE_OWNER_PID>(tcp4, tcp4_error, fetches, on_fetch));
+        mgr.set_table_fetch(ConnectionProtocol::PROTO_TCP, ProtocolFamily::INET6, fake_fetch<MIB_TCP6TABLE_OWNER_PID>(tcp6, tcp6_error, fetches, on_fetch));
+        mgr.set_table_fetch(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET, fake_fetch<MIB_UDPTABLE_OWNER_PID>(udp4, udp4_error, fetches, on_fetch));
+        mgr.set_table_fetch(ConnectionProtocol::PROTO_UDP, ProtocolFamily::INET6, fake_fetch<MIB_UDP6TABLE_OWNER_PID>(udp6, udp6_error, fetches, on_fetch));
+    }
+
+    // ports are in network order, as in MIB rows
+    void add_tcp4(DWORD local, USHORT lport, DWORD remote, USHORT rport, DWORD state) {
+        MIB_TCPROW_OWNER_PID row{};
+        row.dwLocalAddr = htonl(local);
+        row.dwLocalPort = htons(lport);
+        row.dwRemoteAddr = htonl(remote);
+        row.dwRemotePort = htons(rport);
+        row.dwState = state;
+        row.dwOwningPid = GetCurrentProcessId();
+        tcp4.push_back(row);
+    }
+
+    // fe80::local to fe80::remote
+    void add_tcp6(UCHAR local, USHORT lport, UCHAR remote, USHORT rport, DWORD state) {
+        MIB_TCP6ROW_OWNER_PID row{};
+        row.ucLocalAddr[0] = row.ucRemoteAddr[0] = 0xfe;
+        row.ucLocalAddr[1] = row.ucRemoteAddr[1] = 0x80;
+        row.ucLocalAddr[15] = local;
+        row.ucRemoteAddr[15] = remote;
+        row.dwLocalPort = htons(lport);
+        row.dwRemotePort = htons(rport);
+        row.dwState = state;
+        row.dwOwningPid = GetCurrentProcessId();
+        tcp6.push_back(row);
+    }
+
+    void add_udp4(DWORD local, USHORT lport) {
+        MIB_UDPROW_OWNER_PID row{};
+        row.dwLocalAddr = htonl(local);
+        row.dwLocalPort = htons(lport);
+        row.dwOwningPid = GetCurrentProcessId();
+        udp4.push_back(row);
+    }
+
+    void add_udp6(UCHAR local, USHORT lport) {
+        MIB_UDP6ROW_OWNER_PID row{};
+        row.ucLocalAddr[0] = 0xfe;
+        row.ucLocalAddr[1] = 0x80;
+        row.ucLocalAddr[15] = local;
+        row.dwLocalPort = htons(lport);
+        row.dwOwningPid = GetCurrentProcessId();
+        udp6.push_back(row);
+    }
+};
+
+using KeySet = std::unordered_multiset<ConnectionKey, ConnectionKeyHash>;
+
+template<typename Rows>
+KeySet keys_of(const Rows& rows) {
+    KeySet keys;
+    for (const auto& row : rows) keys.insert(MakeConnectionKey(*row));
+    return keys;
+}
+
+// Rows of stubbed tables across refreshes: the delta reports exactly the rows that appeared, disappeared and changed
+// state, and the published snapshot has the rows of the tables. Rows that survive keep their entries and row ids,
+// rows of a table that failed to be fetched are kept as they were, duplicate keys (a UDP port bound twice) are rows
+// of their own, tables too big for the buffer are fetched again into a bigger one, and a cancelled update changes nothing
+void test_ConnectionsDelta() {
+    FakeTables tables;
+    ConnectionsTableManager mgr;
+    tables.attach(mgr);
+
+    size_t notified = 0;
+    KeySet added, removed, changed;
+    mgr.subscribe([&](const ConnectionsDelta& delta) {
+        notified++;
+        added = keys_of(delta.added);
+        removed = keys_of(delta.removed);
+        changed = keys_of(delta.state_changed);
+        });
+
+    // key of a row of a table
+    auto key = [](const auto& row) {
+        auto k = MakeConnectionKey(row);
+        return KeySet{ k };
+    };
+
+    // row id and state of every row of the snapshot by its key, rows are the rows of tables
+    auto check_rows = [&]() {
+        auto view = mgr.view();
+        const auto& snap = view->snapshot();
+
+        KeySet expected;
+        std::unordered_map<ConnectionKey, DWORD, ConnectionKeyHash> states;
+        for (const auto& row : tables.tcp4) { expected.insert(MakeConnectionKey(row)); states[MakeConnectionKey(row)] = row.dwState; }
+        for (const auto& row : tables.tcp6) { expected.insert(MakeConnectionKey(row)); states[MakeConnectionKey(row)] = row.dwState; }
+        for (const auto& row : tables.udp4) expected.insert(MakeConnectionKey(row));
+        for (const auto& row : tables.udp6) expected.insert(MakeConnectionKey(row));
+
+        assert(view->size() == snap.size());
+        assert(keys_of(snap.entries) == expected);
+        assert(mgr.count() == snap.size());
+
+        std::unordered_map<ConnectionKey, uint32_t, ConnectionKeyHash> ids;
+        std::unordered_set<uint32_t> distinct;
+        for (size_t i = 0; i < snap.size(); i++) {
+            const auto& entry = *snap.entries[i];
+            assert(entry.row_id() == snap.row_id[i]);
+            assert(distinct.insert(entry.row_id()).second);
+            if (entry.protocol() == ConnectionProtocol::PROTO_TCP) assert(entry.state() == states[MakeConnectionKey(entry)]);
+            ids[MakeConnectionKey(entry)] = entry.row_id();
+        }
+        return ids;
+    };
+
+    // first refresh adds every row
+    tables.add_tcp4(0x0a000001, 50000, 0x0a000101, 443, MIB_TCP_STATE_ESTAB);
+    tables.add_tcp4(0x0a000001, 50001, 0x0a000102, 80, MIB_TCP_STATE_ESTAB);
+    tables.add_tcp4(0x0a000001, 50002, 0x0a000103, 22, MIB_TCP_STATE_SYN_SENT);
+    tables.add_tcp4(0, 8080, 0, 0, MIB_TCP_STATE_LISTEN);
+    tables.add_tcp6(1, 50000, 2, 443, MIB_TCP_STATE_ESTAB);
+    tables.add_udp4(0x0a000001, 53);
+    tables.add_udp4(0x0a000001, 53);
+    tables.add_udp6(1, 5353);
+
+    assert(mgr.update());
+    assert(notified == 1);
+    assert(added.size() == 8 && removed.empty() && changed.empty());
+    auto ids = check_rows();
+    auto first = mgr.view()->snapshot_ptr();
+
+    // nothing changed, nothing is reported, rows stay the same entries
+    assert(mgr.update());
+    assert(notified == 2 && added.empty() && removed.empty() && changed.empty());
+    assert(check_rows() == ids);
+    {
+        KeySet before = keys_of(first->entries), after = keys_of(mgr.view()->snapshot().entries);
+        assert(before == after);
+        std::unordered_set<const ConnectionEntry*> entries;
+        for (const auto& row : first->entries) entries.insert(row.get());
+        for (const auto& row : mgr.view()->snapshot().entries) assert(entries.contains(row.get()));
+    }
+
+    // second refresh: one connection closed, one established, one new, one of the duplicate UDP rows closed
+    const auto closed = tables.tcp4[1];
+    tables.tcp4.erase(tables.tcp4.begin() + 1);
+    tables.tcp4[1].dwState = MIB_TCP_STATE_ESTAB;
+    tables.add_tcp4(0x0a000001, 50003, 0x0a000104, 8443, MIB_TCP_STATE_SYN_SENT);
+    tables.udp4.pop_back();
+
+    assert(mgr.update());
+    assert(added == key(tables.tcp4.back()));
+    assert(changed == key(tables.tcp4[1]));
+    KeySet gone = key(closed);
+    gone.insert(MakeConnectionKey(tables.udp4.back()));
+    assert(removed == gone);
+
+    auto survivors = check_rows();
+    for (const auto& [k, id] : survivors) {
+        if (ids.contains(k)) assert(ids[k] == id);
+    }
+    // published rows are never modified, changed state is a new entry
+    for (const auto& row : first->entries) {
+        if (MakeConnectionKey(*row) == MakeConnectionKey(tables.tcp4[1])) assert(row->state() == MIB_TCP_STATE_SYN_SENT);
+    }
+    ids = survivors;
+
+    // third refresh: UDP IPv4 table fails and keeps its rows, IPv6 TCP table is empty,
+    // IPv4 TCP table outgrows the initial buffer
+    tables.udp4_error = ERROR_NOT_SUPPORTED;
+    const auto tcp6 = tables.tcp6;
+    tables.tcp6.clear();
+    for (USHORT port = 1; port <= 500; port++) {
+        tables.add_tcp4(0x0a000002, port, 0x0a000201, 443, MIB_TCP_STATE_ESTAB);
+    }
+
+    assert(mgr.update());
+    assert(added.size() == 500 && changed.empty());
+    assert(removed == key(tcp6[0]));
+    survivors = check_rows();
+    for (const auto& [k, id] : ids) {
+        if (survivors.contains(k)) assert(survivors[k] == id);
+    }
+    assert(survivors.contains(MakeConnectionKey(tables.udp4[0])));
+    ids = survivors;
+
+    // the table fetched again gives the same rows, nothing changes
+    tables.udp4_error = NO_ERROR;
+    assert(mgr.update());
+    assert(added.empty() && removed.empty() && changed.empty());
+    assert(check_rows() == ids);
+
+    // cancelled update reports nothing and keeps rows, the next one reports what changed since the last completed one
+    const auto shown = keys_of(mgr.view()->snapshot().entries);
+    const size_t closing = tables.tcp4.size() - 2;
+    tables.tcp4.resize(2);
+
+    std::stop_source cancel;
+    cancel.request_stop();
+    const size_t notified_before = notified;
+    assert(!mgr.update(cancel.get_token()));
+    assert(notified == notified_before);
+    assert(keys_of(mgr.view()->snapshot().entries) == shown);
+
+    assert(mgr.update());
+    assert(added.empty() && changed.empty() && removed.size() == closing);
+    survivors = check_rows();
+    for (const auto& [k, id] : survivors) assert(ids[k] == id);
+
+    std::cout << "connections delta: ok" << std::endl;
+}
+
+// View filters over stubbed tables: for every combination of filters the view has the rows of shown families that are
+// UDP, TCP listeners or TCP connections as filters allow, in the order of the unfiltered view. Toggling a filter does
+// not fetch tables and does not change counts; filters are kept by updates, also for a listener that got connected
+void test_ViewFilters() {
+    using Filters = ConnectionsTableManager::Filters;
+
+    FakeTables tables;
+    ConnectionsTableManager mgr;
+    tables.attach(mgr);
+
+    for (USHORT k = 0; k < 3; k++) tables.add_tcp4(0x0a000001, 50000 + k, 0x0a000101 + k, 443, MIB_TCP_STATE_ESTAB);
+    tables.add_tcp4(0x0a000001, 50003, 0x0a000104, 80, MIB_TCP_STATE_TIME_WAIT);
+    tables.add_tcp4(0, 80, 0, 0, MIB_TCP_STATE_LISTEN);
+    tables.add_tcp4(0, 443, 0, 0, MIB_TCP_STATE_LISTEN);
+    tables.add_tcp6(1, 50000, 2, 443, MIB_TCP_STATE_ESTAB);
+    tables.add_tcp6(1, 50001, 3, 443, MIB_TCP_STATE_CLOSE_WAIT);
+    tables.add_tcp6(0, 80, 0, 0, MIB_TCP_STATE_LISTEN);
+    tables.add_udp4(0x0a000001, 53);
+    tables.add_udp4(0, 67);
+    tables.add_udp6(1, 5353);
+
+    assert(mgr.update());
+    mgr.sort(SortBy::LocalPort);
+
+    auto shown_by = [](uint32_t filters, const ConnectionEntry& row) {
+        using M = ConnectionsTableManager;
+        const bool family = row.address_family() == ProtocolFamily::INET ? filters & M::FilterBit(Filters::IPv4) : filters & M::FilterBit(Filters::IPv6);
+        if (row.protocol() == ConnectionProtocol::PROTO_UDP) return family && (filters & M::FilterBit(Filters::UDP));
+        if (row.state() == MIB_TCP_STATE_LISTEN) return family && (filters & M::FilterBit(Filters::TCP_LISTENING));
+        return family && (filters & M::FilterBit(Filters::TCP_CONNECTIONS));
+    };
+
+    // every combination, the view is the unfiltered one without rows that filters hide
+    auto check_filters = [&]() {
+        mgr.set_filters(ConnectionsTableManager::AllFilters);
+        const auto all = mgr.view();
+        const size_t rows = mgr.count();
+        const size_t fetches = tables.fetches;
+        assert(all->size() == rows);
+
+        for (uint32_t filters = 0; filters <= ConnectionsTableManager::AllFilters; filters++) {
+            mgr.set_filters(filters);
+            assert(mgr.filters() == filters);
+
+            const auto view = mgr.view();
+            assert(view->snapshot_ptr() == all->snapshot_ptr());
+
+            std::vector<uint32_t> expected;
+            for (uint32_t i : all->order()) {
+                if (shown_by(filters, *all->snapshot().entries[i])) expected.push_back(i);
+            }
+            assert(view->order() == expected);
+            assert(mgr.count() == rows);
+        }
+        assert(tables.fetches == fetches);
+    };
+
+    check_filters();
+
+    // toggling one filter on and off
+    mgr.set_filters(ConnectionsTableManager::AllFilters);
+    assert(mgr.remove_filter(Filters::UDP));
+    assert(!mgr.remove_filter(Filters::UDP));
+    assert(mgr.view()->size() == mgr.count() - 3);
+    mgr.add_filter(Filters::UDP);
+    assert(mgr.filters() == ConnectionsTableManager::AllFilters);
+    assert(mgr.view()->size() == mgr.count());
+
+    // updates keep filters: a listener that got connected is shown as a connection, new rows are filtered as well
+    const uint32_t connections = ConnectionsTableManager::FilterBit(Filters::IPv4) | ConnectionsTableManager::FilterBit(Filters::TCP_CONNECTIONS);
+    mgr.set_filters(connections);
+    const size_t shown = mgr.view()->size();
+
+    tables.tcp4[4].dwState = MIB_TCP_STATE_ESTAB;
+    tables.add_tcp4(0, 8080, 0, 0, MIB_TCP_STATE_LISTEN);
+    tables.add_udp4(0x0a000001, 123);
+    assert(mgr.update());
+
+    assert(mgr.filters() == connections);
+    assert(mgr.view()->size() == shown + 1);
+    for (size_t k = 0; k < mgr.view()->size(); k++) {
+        assert(shown_by(connections, *mgr.view()->entry(k)));
+    }
+
+    check_filters();
+
+    std::cout << "view filters: ok" << std::endl;
+}
+
+// Refreshes over stubbed tables whose fetches are held by the test, so that it knows a refresh is running:
+// request() returns while a refresh runs, a request cancels the running refresh, which stops without publishing,
+// the refresh after a cancelled one is not cancelled, a burst of requests is one more refresh, and the destructor
+// joins the thread, also when a refresh is running
+void test_ConnectionsRefresher() {
+    using namespace std::chrono_literals;
+
+    FakeTables tables;
+    tables.add_tcp4(0x0a000001, 50000, 0x0a000101, 443, MIB_TCP_STATE_ESTAB);
+    tables.add_udp6(1, 5353);
+
+    // every refresh fetches four tables, fetches of k-th refresh wait until more than k refreshes are let through
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t entered = 0, let_through = 0;
+    tables.on_fetch = [&]() {
+        std::unique_lock<std::mutex> lck(mutex);
+        const size_t refresh = entered++ / 4;
+        cv.notify_all();
+        cv.wait(lck, [&]() { return refresh < let_through; });
+    };
+    auto wait_entered = [&](size_t n) {
+        std::unique_lock<std::mutex> lck(mutex);
+        return cv.wait_for(lck, 10s, [&]() { return entered >= n; });
+    };
+    auto let = [&](size_t refreshes) {
+        std::lock_guard<std::mutex> lck(mutex);
+        let_through = refreshes;
+        cv.notify_all();
+    };
+
+    ConnectionsTableManager mgr;
+    tables.attach(mgr);
+
+    // rows of every view the callback got
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    std::vector<size_t> ready;
+    auto wait_ready = [&](size_t n) {
+        std::unique_lock<std::mutex> lck(ready_mutex);
+        return ready_cv.wait_for(lck, 10s, [&]() { return ready.size() >= n; });
+    };
+
+    std::optional<ConnectionsRefresher> refresher;
+    refresher.emplace(mgr, [&](SortView::Ptr view, std::exception_ptr error) {
+        assert(!error);
+        std::lock_guard<std::mutex> lck(ready_mutex);
+        ready.push_back(view->size());
+        ready_cv.notify_all();
+        });
+    refresher->start();
+
+    // first refresh is held in its fetches, requests return and only cancel it
+    refresher->request();
+    assert(wait_entered(4));
+    for (int i = 0; i < 1000; i++) {
+        refresher->request();
+    }
+    assert(refresher->completed() == 0 && refresher->cancelled() == 0 && !refresher->idle());
+
+    // cancelled refresh publishes nothing, the one that follows is not cancelled by requests
+    let(1);
+    assert(wait_entered(8));
+    assert(refresher->cancelled() == 1 && refresher->completed() == 0);
+    assert(mgr.view()->size() == 0);
+    for (int i = 0; i < 1000; i++) {
+        refresher->request();
+    }
+
+    // burst that came while it ran is one more refresh
+    let(100);
+    assert(wait_ready(2));
+    for (int k = 0; k < 1000 && !refresher->idle(); k++) {
+        std::this_thread::sleep_for(10ms);
+    }
+    assert(refresher->idle());
+    std::this_thread::sleep_for(50ms);
+    {
+        std::lock_guard<std::mutex> lck(mutex);
+        assert(entered == 12);
+    }
+    assert(refresher->completed() == 2 && refresher->cancelled() == 1 && refresher->stats().completed == 2);
+    assert((ready == std::vector<size_t>{ 2, 2 }));
+    assert(mgr.view()->size() == 2);
+
+    // destructor stops the running refresh and waits for it, its view is not handed to callback
+    let(3);
+    tables.add_udp4(0x0a000001, 53);
+    refresher->request();
+    assert(wait_entered(16));
+
+    auto destroyed = std::async(std::launch::async, [&refresher]() { refresher.reset(); });
+    assert(destroyed.wait_for(100ms) == std::future_status::timeout);
+    let(100);
+    assert(destroyed.wait_for(10s) == std::future_status::ready);
+    assert(ready.size() == 2);
+    assert(mgr.view()->size() == 2);
+
+    // manager is left usable, rows the stopped refresh did not merge come with the next update
+    assert(mgr.update());
+    assert(mgr.view()->size() == 3);
+
+    // refreshers that are idle or were never started are destroyed at once
+    refresher.emplace(mgr, [](SortView::Ptr, std::exception_ptr) {});
+    refresher->start();
+    refresher.reset();
+    refresher.emplace(mgr, [](SortView::Ptr, std::exception_ptr) {});
+    refresher.reset();
+
+    std::cout << "connections refresher: ok" << std::endl;
+}
+
+// RowIndexes give the rows a scan of the snapshot finds, through rounds of updates as the manager makes them:
+// rows removed (their ids reused), added, and replaced by copies with a new state. Every bitmap, and select() and count()
+// of single and combined conditions, of TCP and UDP rows of both families, well-known and other remote ports
+void test_RowIndexes() {
+    std::mt19937 rng(21);
+
+    std::vector<ProcessPtr> procs;
+    for (DWORD pid = 4; pid <= 40; pid += 4) {
+        procs.push_back(std::make_shared<Process>(pid));
+    }
+
+    auto make_row = [&]() -> ConnectionEntryPtr {
+        const ProcessPtr& proc = procs[rng() % procs.size()];
+        const USHORT rport = htons(rng() % 2 ? (USHORT)(rng() % 1100) : (USHORT)rng());
+        switch (rng() % 4) {
+        case 0: {
+            MIB_TCPROW_OWNER_PID row{};
+            row.dwState = rng() % 12 + 1;
+            row.dwRemotePort = rport;
+            return std::make_shared<ConnectionEntry>(row, proc);
+        }
+        case 1: {
+            MIB_TCP6ROW_OWNER_PID row{};
+            row.dwState = rng() % 12 + 1;
+            row.dwRemotePort = rport;
+            return std::make_shared<ConnectionEntry>(row, proc);
+        }
+        case 2: return std::make_shared<ConnectionEntry>(MIB_UDPROW_OWNER_PID{}, proc);
+        default: return std::make_shared<ConnectionEntry>(MIB_UDP6ROW_OWNER_PID{}, proc);
+        }
+    };
+
+    RowIndexes indexes;
+    ConnectionEntryPtrs rows;
+
+    auto ids_of = [](const ConnectionsSnapshot& snap, const std::function<bool(size_t)>& pred) {
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < snap.size(); i++) {
+            if (pred(i)) ids.push_back(snap.row_id[i]);
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+
+    auto check = [&]() {
+        const ConnectionsSnapshot snap(rows);
+        const auto tcp = [&snap](size_t i) { return snap.protocol[i] == ConnectionProtocol::PROTO_TCP; };
+
+        // ids are unique and below capacity
+        auto all = ids_of(snap, [](size_t) { return true; });
+        assert(std::adjacent_find(all.begin(), all.end()) == all.end());
+        assert(all.empty() || all.back() < indexes.capacity());
+        assert(roaring_ids(indexes.all()) == all);
+        assert(indexes.count({}) == rows.size());
+
+        for (auto proto : { ConnectionProtocol::PROTO_TCP, ConnectionProtocol::PROTO_UDP }) {
+            assert(roaring_ids(indexes.protocol(proto)) == ids_of(snap, [&](size_t i) { return snap.protocol[i] == proto; }));
+        }
+        for (auto af : { ProtocolFamily::INET, ProtocolFamily::INET6 }) {
+            assert(roaring_ids(indexes.family(af)) == ids_of(snap, [&](size_t i) { return snap.family[i] == af; }));
+        }
+        for (DWORD state = MIB_TCP_STATE_CLOSED; state <= MIB_TCP_STATE_DELETE_TCB; state++) {
+            assert(roaring_ids(indexes.state(state)) == ids_of(snap, [&](size_t i) { return tcp(i) && snap.state[i] == state; }));
+        }
+        for (const auto& proc : procs) {
+            const DWORD pid = proc->m_pid;
+            assert(roaring_ids(indexes.pid(pid)) == ids_of(snap, [&](size_t i) { return snap.pid[i] == pid; }));
+        }
+        assert(indexes.pid(1).empty());
+        for (DWORD port = 0; port < RowIndexes::WellKnownPorts; port++) {
+            assert(roaring_ids(indexes.remote_port(port)) == ids_of(snap, [&](size_t i) { return tcp(i) && snap.remote_port[i] == port; }));
+        }
+
+        // random combinations of conditions
+        for (int k = 0; k < 200; k++) {
+            RowIndexes::Selection sel;
+            if (rng() % 3 == 0) sel.protocol = rng() % 2 ? ConnectionProtocol::PROTO_TCP : ConnectionProtocol::PROTO_UDP;
+            if (rng() % 3 == 0) sel.family = rng() % 2 ? ProtocolFamily::INET : ProtocolFamily::INET6;
+            if (rng() % 3 == 0) sel.states = (rng() % 2 ? (uint32_t)rng() : 1u << (rng() % 12 + 1)) & ~1u & ((1u << (MIB_TCP_STATE_DELETE_TCB + 1)) - 1);
+            if (rng() % 3 == 0) sel.pid = procs[rng() % procs.size()]->m_pid;
+            if (rng() % 3 == 0) sel.remote_port = rng() % RowIndexes::WellKnownPorts;
+
+            auto expected = ids_of(snap, [&](size_t i) {
+                return (!sel.protocol || snap.protocol[i] == *sel.protocol)
+                    && (!sel.family || snap.family[i] == *sel.family)
+                    && (!sel.states || (tcp(i) && ((sel.states >> snap.state[i]) & 1)))
+                    && (!sel.pid || snap.pid[i] == *sel.pid)
+                    && (!sel.remote_port || (tcp(i) && snap.remote_port[i] == *sel.remote_port));
+                });
+            assert(roaring_ids(indexes.select(sel)) == expected);
+            assert(indexes.count(sel) == expected.size());
+        }
+    };
+
+    check();
+
+    for (int round = 0; round < 30; round++) {
+        std::shuffle(rows.begin(), rows.end(), rng);
+
+        // removed first, so that their ids go to added rows
+        const size_t removed = round % 5 == 4 ? rows.size() : rng() % (rows.size() / 2 + 1);
+        for (size_t k = 0; k < removed; k++) {
+            indexes.remove(*rows.back());
+            rows.pop_back();
+        }
+
+        const size_t added = rng() % 400;
+        for (size_t k = 0; k < added; k++) {
+            rows.push_back(make_row());
+            indexes.add(*rows.back());
+        }
+
+        // copy with a new state keeps the id of the row it replaces, UDP rows never change state
+        for (auto& row : rows) {
+            if (row->protocol() != ConnectionProtocol::PROTO_TCP || rng() % 4) continue;
+            auto copy = std::make_shared<ConnectionEntry>(*row);
+            copy->set_state(rng() % 12 + 1);
+            indexes.change_state(*copy);
+            row = std::move(copy);
+        }
+
+        check();
+    }
+
+    std::cout << "row indexes: ok" << std::endl;
+}
+
+// IPAddress equality and order are those of memcmp and of a byte by byte comparison, hi() and lo() order them too,
+// and equal addresses hash equally. Pairs of IPv4-mapped and IPv6 addresses that differ in one byte at every position,
+// by values around the sign bit, so that a signed or word-wise comparison would misorder them; IPv4-mapped ones are
+// in numeric order of the IPv4 address and map back to it
+void test_IPAddress() {
+    std::mt19937 rng(25);
+
+    std::vector<DWORD> v4{ 0, 1, 0x7f, 0x80, 0xff, 0x100, 0x7f000001, 0x7fffffff, 0x80000000, 0x80000001, 0xc0a80001, 0xfffffffe, 0xffffffff };
+    for (int k = 0; k < 20; k++) v4.push_back((DWORD)rng());
+
+    std::vector<IPAddress> addrs;
+    for (DWORD a : v4) {
+        const IPAddress addr = IPAddress::FromIPv4(htonl(a));
+        assert(addr.is_v4_mapped() && addr.ipv4() == htonl(a));
+        addrs.push_back(addr);
+    }
+
+    IPAddress zero{}, ones{}, base{};
+    memset(ones.bytes, 0xff, IPAddress::Size);
+    base[0] = 0x20;
+    base[1] = 0x01;
+    base[2] = 0x0d;
+    base[3] = 0xb8;
+    for (const IPAddress& addr : { zero, ones, base }) {
+        addrs.push_back(addr);
+        for (size_t b = 0; b < IPAddress::Size; b++) {
+            for (UCHAR value : { 0x00, 0x01, 0x7f, 0x80, 0x81, 0xfe, 0xff }) {
+                IPAddress other = addr;
+                other[b] = value;
+                addrs.push_back(other);
+            }
+        }
+    }
+    for (int k = 0; k < 50; k++) {
+        IPAddress addr{};
+        for (auto& byte : addr.bytes) byte = (UCHAR)rng();
+        addrs.push_back(addr);
+    }
+    assert(!base.is_v4_mapped() && !ones.is_v4_mapped());
+
+    for (const auto& a : addrs) {
+        for (const auto& b : addrs) {
+            const int cmp = memcmp(a.data(), b.data(), IPAddress::Size);
+            const bool bytewise_less = std::lexicographical_compare(a.bytes, a.bytes + IPAddress::Size, b.bytes, b.bytes + IPAddress::Size);
+
+            assert((a == b) == (cmp == 0));
+            assert((a != b) == (cmp != 0));
+            assert((a <=> b) == (cmp <=> 0));
+            assert((a < b) == bytewise_less);
+            assert((std::pair(a.hi(), a.lo()) <=> std::pair(b.hi(), b.lo())) == (cmp <=> 0));
+            if (a == b) assert(a.hash() == b.hash() && IPAddressHash{}(a) == IPAddressHash{}(b));
+        }
+    }
+
+    for (DWORD a : v4) {
+        for (DWORD b : v4) {
+            assert((IPAddress::FromIPv4(htonl(a)) <=> IPAddress::FromIPv4(htonl(b))) == (a <=> b));
+        }
+    }
+
+    // sorted and deduplicated as byte arrays are
+    std::vector<std::array<UCHAR, IPAddress::Size>> arrays(addrs.size());
+    for (size_t i = 0; i < addrs.size(); i++) {
+        memcpy(arrays[i].data(), addrs[i].data(), IPAddress::Size);
+    }
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+    std::sort(arrays.begin(), arrays.end());
+    arrays.erase(std::unique(arrays.begin(), arrays.end()), arrays.end());
+    assert(addrs.size() == arrays.size());
+    for (size_t i = 0; i < addrs.size(); i++) {
+        assert(memcmp(addrs[i].data(), arrays[i].data(), IPAddress::Size) == 0);
+    }
+
+    std::cout << "ip address: ok" << std::endl;
+}
+
+// ConnectionEntry built from a row of each of the four tables has the values of the row: kind from RowTraits,
+// addresses byte for byte (IPv4 ones mapped), ports from their two network order bytes whatever the upper bytes
+// of the DWORD hold, state and scope ids, and UDP rows have zeroed remote columns. Its key is the key of the row
+void test_ConnectionEntry() {
+    std::mt19937 rng(23);
+
+    auto proc = std::make_shared<Process>(GetCurrentProcessId());
+    const IPAddress none{};
+    const USHORT edge_ports[]{ 0, 1, 0x00ff, 0x0100, 0x7fff, 0x8000, 0xfffe, 0xffff };
+
+    // as rows hold ports: network order in the first two bytes, anything in the other two
+    auto mib_port = [&rng](USHORT port) {
+        DWORD value = (DWORD)rng();
+        UCHAR* bytes = (UCHAR*)&value;
+        bytes[0] = (UCHAR)(port >> 8);
+        bytes[1] = (UCHAR)port;
+        return value;
+    };
+    auto port_of = [](DWORD value) {
+        const UCHAR* bytes = (const UCHAR*)&value;
+        return (DWORD)(bytes[0] << 8 | bytes[1]);
+    };
+    auto random_port = [&](int k) {
+        return mib_port(k < (int)std::size(edge_ports) ? edge_ports[k] : (USHORT)rng());
+    };
+    auto random_addr6 = [&rng](UCHAR* addr) {
+        for (size_t b = 0; b < IPAddress::Size; b++) addr[b] = (UCHAR)rng();
+    };
+
+    auto check_row = [&](const ConnectionEntry& entry, const auto& row) {
+        using Row = std::decay_t<decltype(row)>;
+        assert(entry.protocol() == RowTraits<Row>::protocol);
+        assert(entry.address_family() == RowTraits<Row>::family);
+        assert(entry.local_port() == port_of(row.dwLocalPort));
+        assert(entry.pid() == row.dwOwningPid);
+        assert(MakeConnectionKey(entry) == MakeConnectionKey(row));
+    };
+
+    for (int k = 0; k < 200; k++) {
+        MIB_TCPROW_OWNER_PID tcp4{};
+        tcp4.dwState = rng() % 12 + 1;
+        tcp4.dwLocalAddr = (DWORD)rng();
+        tcp4.dwLocalPort = random_port(k);
+        tcp4.dwRemoteAddr = (DWORD)rng();
+        tcp4.dwRemotePort = random_port(k + 1);
+        tcp4.dwOwningPid = proc->m_pid;
+
+        const ConnectionEntry t4(tcp4, proc);
+        check_row(t4, tcp4);
+        assert(t4.local_addr().is_v4_mapped() && memcmp(t4.local_addr().data() + 12, &tcp4.dwLocalAddr, 4) == 0);
+        assert(t4.remote_addr().is_v4_mapped() && memcmp(t4.remote_addr().data() + 12, &tcp4.dwRemoteAddr, 4) == 0);
+        assert(t4.remote_port() == port_of(tcp4.dwRemotePort));
+        assert(t4.state() == tcp4.dwState);
+        assert(t4.local_scope_id() == 0 && t4.remote_scope_id() == 0);
+
+        MIB_TCP6ROW_OWNER_PID tcp6{};
+        tcp6.dwState = rng() % 12 + 1;
+        random_addr6(tcp6.ucLocalAddr);
+        tcp6.dwLocalScopeId = (DWORD)rng();
+        tcp6.dwLocalPort = random_port(k);
+        random_addr6(tcp6.ucRemoteAddr);
+        tcp6.dwRemoteScopeId = (DWORD)rng();
+        tcp6.dwRemotePort = random_port(k + 1);
+        tcp6.dwOwningPid = proc->m_pid;
+
+        const ConnectionEntry t6(tcp6, proc);
+        check_row(t6, tcp6);
+        assert(memcmp(t6.local_addr().data(), tcp6.ucLocalAddr, IPAddress::Size) == 0);
+        assert(memcmp(t6.remote_addr().data(), tcp6.ucRemoteAddr, IPAddress::Size) == 0);
+        assert(t6.remote_port() == port_of(tcp6.dwRemotePort));
+        assert(t6.state() == tcp6.dwState);
+        assert(t6.local_scope_id() == tcp6.dwLocalScopeId && t6.remote_scope_id() == tcp6.dwRemoteScopeId);
+
+        MIB_UDPROW_OWNER_PID udp4{};
+        udp4.dwLocalAddr = (DWORD)rng();
+        udp4.dwLocalPort = random_port(k);
+        udp4.dwOwningPid = proc->m_pid;
+
+        const ConnectionEntry u4(udp4, proc);
+        check_row(u4, udp4);
+        assert(u4.local_addr().is_v4_mapped() && memcmp(u4.local_addr().data() + 12, &udp4.dwLocalAddr, 4) == 0);
+        assert(u4.remote_addr() == none && u4.remote_port() == 0 && u4.state() == 0);
+        assert(u4.local_scope_id() == 0 && u4.remote_scope_id() == 0);
+
+        MIB_UDP6ROW_OWNER_PID udp6{};
+        random_addr6(udp6.ucLocalAddr);
+        udp6.dwLocalScopeId = (DWORD)rng();
+        udp6.dwLocalPort = random_port(k);
+        udp6.dwOwningPid = proc->m_pid;
+
+        const ConnectionEntry u6(udp6, proc);
+        check_row(u6, udp6);
+        assert(memcmp(u6.local_addr().data(), udp6.ucLocalAddr, IPAddress::Size) == 0);
+        assert(u6.remote_addr() == none && u6.remote_port() == 0 && u6.state() == 0);
+        assert(u6.local_scope_id() == udp6.dwLocalScopeId && u6.remote_scope_id() == 0);
+    }
+
+    std::cout << "connection entry: ok" << std::endl;
+}